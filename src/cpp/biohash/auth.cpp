@@ -0,0 +1,138 @@
+#include <string.h>
+#include <strings.h>
+#include <functional>
+
+#include "auth.hpp"
+#include "base64.hpp"
+#include "assert.hpp"
+
+using namespace biohash;
+
+namespace {
+
+// token68 = 1*( ALPHA / DIGIT / "-" / "." / "_" / "~" / "+" / "/" ) *"="
+bool is_token68(std::string_view str)
+{
+    size_t ndx = 0;
+    while (ndx < str.size()) {
+        char ch = str[ndx];
+        bool valid = (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') ||
+            (ch >= '0' && ch <= '9') || ch == '-' || ch == '.' || ch == '_' ||
+            ch == '~' || ch == '+' || ch == '/';
+        if (!valid)
+            break;
+        ++ndx;
+    }
+    if (ndx == 0)
+        return false;
+    while (ndx < str.size() && str[ndx] == '=')
+        ++ndx;
+    return ndx == str.size();
+}
+
+}
+
+bool auth::parse_authorization(std::string_view value, Credentials& credentials)
+{
+    size_t scheme_size = value.find(' ');
+    if (scheme_size == std::string_view::npos)
+        return false;
+    std::string_view scheme = value.substr(0, scheme_size);
+    std::string_view param = value.substr(scheme_size);
+    while (!param.empty() && param.front() == ' ')
+        param.remove_prefix(1);
+    if (!is_token68(param))
+        return false;
+
+    if (scheme.size() == 6 && strncasecmp(scheme.data(), "Bearer", 6) == 0) {
+        credentials.scheme = Credentials::Scheme::Bearer;
+        credentials.token = param;
+        return true;
+    }
+
+    if (scheme.size() != 5 || strncasecmp(scheme.data(), "Basic", 5) != 0)
+        return false;
+    if (base64::max_decoded_size(param.size()) > max_basic_credentials_size)
+        return false;
+    size_t size;
+    if (!base64::decode(param.data(), param.size(), credentials.buffer, size))
+        return false;
+    const char* colon = static_cast<const char*>(memchr(credentials.buffer, ':', size));
+    if (!colon)
+        return false;
+    size_t user_id_size = colon - credentials.buffer;
+    credentials.scheme = Credentials::Scheme::Basic;
+    credentials.user_id = std::string_view {credentials.buffer, user_id_size};
+    credentials.password = std::string_view {colon + 1, size - user_id_size - 1};
+    return true;
+}
+
+auth::Cache::Cache(size_t capacity, int_fast64_t ttl, size_t num_shards):
+    m_shard_capacity {(capacity + num_shards - 1) / num_shards},
+    m_ttl {ttl}
+{
+    ASSERT(num_shards > 0);
+    for (size_t i = 0; i < num_shards; ++i)
+        m_shards.emplace_back(new Shard);
+}
+
+auth::Cache::Shard& auth::Cache::shard(size_t hash)
+{
+    // The low bits select the bucket within the shard's map, so the shard
+    // is selected by the high bits.
+    return *m_shards[(hash >> 32 ^ hash >> 16) % m_shards.size()];
+}
+
+bool auth::Cache::lookup(std::string_view value, int_fast64_t now, Verification& verification)
+{
+    size_t hash = std::hash<std::string_view> {}(value);
+    Shard& s = shard(hash);
+    std::lock_guard<std::mutex> lock {s.mutex};
+    auto i = s.index.find(hash);
+    if (i == s.index.end() || i->second->value != value)
+        return false;
+    auto entry = i->second;
+    if (entry->expiry <= now) {
+        s.index.erase(i);
+        s.entries.erase(entry);
+        return false;
+    }
+    s.entries.splice(s.entries.begin(), s.entries, entry);
+    verification = entry->verification;
+    return true;
+}
+
+void auth::Cache::insert(std::string_view value, int_fast64_t now,
+                         const Verification& verification)
+{
+    if (m_shard_capacity == 0)
+        return;
+    size_t hash = std::hash<std::string_view> {}(value);
+    Shard& s = shard(hash);
+    std::lock_guard<std::mutex> lock {s.mutex};
+    auto i = s.index.find(hash);
+    if (i != s.index.end()) {
+        auto entry = i->second;
+        entry->value = value;
+        entry->expiry = now + m_ttl;
+        entry->verification = verification;
+        s.entries.splice(s.entries.begin(), s.entries, entry);
+        return;
+    }
+    if (s.entries.size() == m_shard_capacity) {
+        s.index.erase(s.entries.back().hash);
+        s.entries.pop_back();
+    }
+    s.entries.push_front(Entry {hash, std::string {value}, now + m_ttl, verification});
+    s.index.emplace(hash, s.entries.begin());
+}
+
+size_t auth::Cache::size()
+{
+    size_t size = 0;
+    for (auto& s: m_shards) {
+        std::lock_guard<std::mutex> lock {s->mutex};
+        size += s->entries.size();
+    }
+    return size;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+namespace biohash {
+namespace auth {
+
+// The maximum size of decoded Basic credentials, user-id ":" password.
+constexpr size_t max_basic_credentials_size = 192;
+
+// Credentials parsed from the value of an Authorization header, RFC 7617 and
+// RFC 6750. The views refer to the header value or to the buffer inside the
+// Credentials object, which is meant to live on the stack. Nothing is
+// allocated. A copy would refer to the buffer of the original, so Credentials
+// can be neither copied nor moved.
+struct Credentials {
+
+    Credentials() = default;
+    Credentials(const Credentials&) = delete;
+    Credentials& operator=(const Credentials&) = delete;
+
+    enum class Scheme {
+        Basic,
+        Bearer
+    };
+
+    Scheme scheme;
+
+    // Basic
+    std::string_view user_id;
+    std::string_view password;
+
+    // Bearer
+    std::string_view token;
+
+    char buffer[max_basic_credentials_size];
+};
+
+// Parses the value of an Authorization header such as
+// http::Message::header_authorization. The scheme name is case insensitive.
+// The return value is false if the scheme is neither Basic nor Bearer, if the
+// credentials are malformed, or if decoded Basic credentials do not fit in the
+// buffer.
+bool parse_authorization(std::string_view value, Credentials& credentials);
+
+// The result of verifying a set of credentials.
+struct Verification {
+    bool valid = false;
+    // An application defined identifier of the authenticated principal.
+    uint_least64_t principal = 0;
+};
+
+// A Cache remembers the verification results of Authorization header values
+// for a limited time, so that requests repeating the same header can skip the
+// decoding and the verification. The cache is split into shards, selected by
+// the hash of the header value, that are locked independently. Each shard
+// holds at most 'capacity / num_shards' entries and evicts the least recently
+// used one when full. Times are in nanoseconds of time::monotonic_now().
+class Cache {
+public:
+
+    Cache(size_t capacity, int_fast64_t ttl, size_t num_shards = 16);
+
+    // Returns true and sets 'verification' if 'value' is in the cache and has
+    // not expired at time 'now'. Nothing is allocated.
+    bool lookup(std::string_view value, int_fast64_t now, Verification& verification);
+
+    // Inserts or replaces the verification result of 'value'. The entry
+    // expires at 'now' + ttl.
+    void insert(std::string_view value, int_fast64_t now, const Verification& verification);
+
+    // The number of entries, including expired ones that have not been
+    // evicted yet.
+    size_t size();
+
+private:
+
+    struct Entry {
+        size_t hash;
+        std::string value;
+        int_fast64_t expiry;
+        Verification verification;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        // Most recently used first.
+        std::list<Entry> entries;
+        // Entries by the hash of their value. Values with colliding hashes
+        // replace each other.
+        std::unordered_map<size_t, std::list<Entry>::iterator> index;
+    };
+
+    const size_t m_shard_capacity;
+    const int_fast64_t m_ttl;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+
+    Shard& shard(size_t hash);
+};
+
+}
+}
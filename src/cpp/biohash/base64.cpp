@@ -1,37 +1,692 @@
 #include <climits>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
 
 #include "base64.hpp"
 #include <biohash/assert.hpp>
+#include <biohash/thread_pool.hpp>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BIOHASH_BASE64_X86 1
+#include <immintrin.h>
+#endif
 
 using namespace biohash;
 
-static const char characters[64] = {
-    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
-    'Q', 'R', 'S' ,'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
-    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
-    'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+' , '/'
+static const char pad = '=';
+
+namespace {
+
+// The lookup tables of the SSE4.1 and AVX2 kernels. They are derived by hand
+// for each alphabet, see encode_translate_sse41() and decode_translate_sse41().
+struct Luts {
+    signed char encode_offsets[16];
+    signed char decode_lo[16];
+    signed char decode_hi[16];
+    signed char decode_roll[16];
+    // One of the two special characters shares its high nibble with another
+    // range and is moved to its own slot of decode_roll by adding
+    // decode_special_shift to the high nibble.
+    char decode_special;
+    signed char decode_special_shift;
 };
 
-static const char pad = '=';
+// An alphabet with tables generated at compile time from its 64 characters.
+struct Alphabet {
+    char characters[64];
+    // The two characters encoding each 12 bit value.
+    char pairs[4096][2];
+    // The index of each character shifted into position i of a group, or
+    // invalid_index if the character is outside the alphabet.
+    uint_least32_t indices[4][256];
+    // The index of each of the first 128 characters, with the top bit set
+    // for characters outside the alphabet.
+    char ascii[128];
+    Luts luts;
+};
+
+constexpr uint_least32_t invalid_index = 0x01000000;
+
+constexpr Alphabet make_alphabet(const char (&characters)[65], const Luts& luts)
+{
+    Alphabet alphabet {};
+    for (int i = 0; i < 64; ++i)
+        alphabet.characters[i] = characters[i];
+    for (int i = 0; i < 4096; ++i) {
+        alphabet.pairs[i][0] = characters[i >> 6];
+        alphabet.pairs[i][1] = characters[i & 0x3f];
+    }
+    for (int pos = 0; pos < 4; ++pos) {
+        for (int ch = 0; ch < 256; ++ch)
+            alphabet.indices[pos][ch] = invalid_index;
+    }
+    for (int ch = 0; ch < 128; ++ch)
+        alphabet.ascii[ch] = static_cast<char>(0x80);
+    for (int i = 0; i < 64; ++i) {
+        unsigned char ch = static_cast<unsigned char>(characters[i]);
+        for (int pos = 0; pos < 4; ++pos)
+            alphabet.indices[pos][ch] = static_cast<uint_least32_t>(i) << (18 - 6 * pos);
+        alphabet.ascii[ch] = static_cast<char>(i);
+    }
+    alphabet.luts = luts;
+    return alphabet;
+}
+
+// decode_roll holds the difference between a character and its index.
+constexpr Alphabet standard_alphabet = make_alphabet(
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+    {
+        {'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0},
+        {0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+         0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a},
+        {0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10},
+        {0, '/' - 63, '+' - 62, '0' - 52, 'A', 'A', 'a' - 26, 'a' - 26,
+         0, 0, 0, 0, 0, 0, 0, 0},
+        '/',
+        -1
+    });
+
+// In the URL alphabet '_' is the special character, and 0x70..0x7f gets its
+// own bit in decode_hi since '_' makes 0x50..0x5f differ from it.
+constexpr Alphabet url_alphabet = make_alphabet(
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_",
+    {
+        {'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+         '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0},
+        {0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+         0x11, 0x11, 0x13, 0x3b, 0x3b, 0x3a, 0x3b, 0x33},
+        {0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x20,
+         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10},
+        {0, 0, '-' - 62, '0' - 52, 'A', 'A', 'a' - 26, 'a' - 26,
+         '_' - 63, 0, 0, 0, 0, 0, 0, 0},
+        '_',
+        3
+    });
+
+// Each variant is described by a specialization of Traits.
+template <base64::Variant variant> struct Traits;
+
+template <> struct Traits<base64::Variant::standard> {
+    static constexpr const Alphabet& alphabet = standard_alphabet;
+    static constexpr bool padded = true;
+    static constexpr bool wrapped = false;
+};
+
+template <> struct Traits<base64::Variant::standard_unpadded> {
+    static constexpr const Alphabet& alphabet = standard_alphabet;
+    static constexpr bool padded = false;
+    static constexpr bool wrapped = false;
+};
+
+template <> struct Traits<base64::Variant::url> {
+    static constexpr const Alphabet& alphabet = url_alphabet;
+    static constexpr bool padded = true;
+    static constexpr bool wrapped = false;
+};
+
+template <> struct Traits<base64::Variant::url_unpadded> {
+    static constexpr const Alphabet& alphabet = url_alphabet;
+    static constexpr bool padded = false;
+    static constexpr bool wrapped = false;
+};
+
+template <> struct Traits<base64::Variant::mime> {
+    static constexpr const Alphabet& alphabet = standard_alphabet;
+    static constexpr bool padded = true;
+    static constexpr bool wrapped = true;
+};
+
+// The number of characters per line of the MIME variant and the
+// corresponding number of bytes.
+constexpr size_t mime_line_size = 76;
+constexpr size_t mime_line_decoded_size = 57;
+
+// The SIMD kernels process a prefix of the data in whole 3 byte or 4
+// character groups and return the size of the processed prefix. The scalar
+// code takes over from there. Kernels never read or write outside the ranges
+// given to them; this is why they stop a few groups before the end of the data.
+
+#ifdef BIOHASH_BASE64_X86
+
+// Splits groups of 3 bytes into 4 indices of 6 bits, one per byte.
+// The input has the bytes of group i at positions 4i to 4i+3 as [b1 b0 b2 b1].
+__attribute__((target("sse4.1")))
+inline __m128i encode_reshuffle_sse41(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                            7, 6, 8, 7, 10, 9, 11, 10));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
 
-static unsigned char character_to_index(char ch)
+// Maps indices in 0..63 to characters by adding an offset that depends on
+// the range the index belongs to.
+__attribute__((target("sse4.1")))
+inline __m128i encode_translate_sse41(__m128i indices, __m128i offsets)
 {
-    if (ch >= 'A' && ch <= 'Z')
-        return ch - 'A';
+    // 0..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12.
+    __m128i ndx = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    // 0..25 -> 13.
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    ndx = _mm_or_si128(ndx, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, ndx));
+}
 
-    if (ch >= 'a' && ch <= 'z')
-        return ch - 'a' + 26;
+__attribute__((target("sse4.1")))
+size_t encode_sse41(const Luts& luts, const char* in, size_t size, char* out)
+{
+    const __m128i offsets = _mm_loadu_si128(reinterpret_cast<const __m128i*>(luts.encode_offsets));
 
-    if (ch >= '0' && ch <= '9')
-        return ch - '0' + 52;
+    // 16 bytes are loaded for every 12 that are used.
+    size_t ndx = 0;
+    while (size - ndx >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + ndx));
+        v = encode_translate_sse41(encode_reshuffle_sse41(v), offsets);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+        ndx += 12;
+        out += 16;
+    }
+    return ndx;
+}
 
-    if (ch == '+')
-        return 62;
+// Translates characters to indices. Returns false if any character is outside
+// the alphabet. The validity of a character is determined by intersecting a
+// set of bits looked up by its high nibble with a set looked up by its low
+// nibble.
+struct DecodeLutsSse41 {
+    __m128i lo;
+    __m128i hi;
+    __m128i roll;
+    __m128i special_char;
+    __m128i special_shift;
+};
 
-    if (ch == '/')
-        return 63;
+__attribute__((target("sse4.1")))
+inline bool decode_translate_sse41(__m128i& v, const DecodeLutsSse41& luts)
+{
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(v, mask_2f);
+    __m128i hi = _mm_shuffle_epi8(luts.hi, hi_nibbles);
+    __m128i lo = _mm_shuffle_epi8(luts.lo, lo_nibbles);
+    if (!_mm_testz_si128(lo, hi))
+        return false;
+    __m128i special = _mm_cmpeq_epi8(v, luts.special_char);
+    special = _mm_and_si128(special, luts.special_shift);
+    __m128i roll = _mm_shuffle_epi8(luts.roll, _mm_add_epi8(special, hi_nibbles));
+    v = _mm_sub_epi8(v, roll);
+    return true;
+}
 
-    return 255;
+// Packs 4 indices of 6 bits into 3 bytes. The 12 bytes end up in the low
+// part of the register.
+__attribute__((target("sse4.1")))
+inline __m128i decode_reshuffle_sse41(__m128i v)
+{
+    __m128i merge_ab_and_bc = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    __m128i merged = _mm_madd_epi16(merge_ab_and_bc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                                  8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("sse4.1")))
+size_t decode_sse41(const Luts& luts, const char* in, size_t size, char* out, bool& valid)
+{
+    const DecodeLutsSse41 decode_luts {
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(luts.decode_lo)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(luts.decode_hi)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(luts.decode_roll)),
+        _mm_set1_epi8(luts.decode_special),
+        _mm_set1_epi8(luts.decode_special_shift)
+    };
+
+    // 16 bytes are stored for every 12 that are produced. The 8 characters
+    // left over guarantee room for the 4 extra bytes.
+    size_t ndx = 0;
+    while (size - ndx >= 24) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + ndx));
+        if (!decode_translate_sse41(v, decode_luts)) {
+            valid = false;
+            return ndx;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), decode_reshuffle_sse41(v));
+        ndx += 16;
+        out += 12;
+    }
+    return ndx;
+}
+
+__attribute__((target("avx2")))
+inline __m256i broadcast_avx2(const signed char* lut)
+{
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lut)));
+}
+
+__attribute__((target("avx2")))
+size_t encode_avx2(const Luts& luts, const char* in, size_t size, char* out)
+{
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                             7, 6, 8, 7, 10, 9, 11, 10,
+                                             1, 0, 2, 1, 4, 3, 5, 4,
+                                             7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i offsets = broadcast_avx2(luts.encode_offsets);
+
+    // Each 128 bit lane takes 12 of the 24 input bytes. The loads of the
+    // second lane reach 28 bytes ahead.
+    size_t ndx = 0;
+    while (size - ndx >= 28) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + ndx));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + ndx + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i n = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        n = _mm256_or_si256(n, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        v = _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, n));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+        ndx += 24;
+        out += 32;
+    }
+    return ndx;
+}
+
+__attribute__((target("avx2")))
+size_t decode_avx2(const Luts& luts, const char* in, size_t size, char* out, bool& valid)
+{
+    const __m256i lut_lo = broadcast_avx2(luts.decode_lo);
+    const __m256i lut_hi = broadcast_avx2(luts.decode_hi);
+    const __m256i lut_roll = broadcast_avx2(luts.decode_roll);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i special_char = _mm256_set1_epi8(luts.decode_special);
+    const __m256i special_shift = _mm256_set1_epi8(luts.decode_special_shift);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9,
+                                          8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9,
+                                          8, 14, 13, 12, -1, -1, -1, -1);
+
+    // 32 bytes are stored for every 24 that are produced. The 12 characters
+    // left over guarantee room for the 8 extra bytes.
+    size_t ndx = 0;
+    while (size - ndx >= 44) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + ndx));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+        __m256i lo_nibbles = _mm256_and_si256(v, mask_2f);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) {
+            valid = false;
+            return ndx;
+        }
+        __m256i special = _mm256_cmpeq_epi8(v, special_char);
+        special = _mm256_and_si256(special, special_shift);
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(special, hi_nibbles));
+        v = _mm256_sub_epi8(v, roll);
+
+        __m256i merge_ab_and_bc = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(merge_ab_and_bc, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+        ndx += 32;
+        out += 24;
+    }
+    return ndx;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+size_t encode_avx512vbmi(const Alphabet& alphabet, const char* in, size_t size, char* out)
+{
+    // Byte i of each 32 bit word of the shuffled input receives the bytes
+    // [b1 b0 b2 b1] of group i, as in the SSE4.1 kernel.
+    const __m512i shuffle = _mm512_setr_epi32(
+        0x01020001, 0x04050304, 0x07080607, 0x0a0b090a,
+        0x0d0e0c0d, 0x10110f10, 0x13141213, 0x16171516,
+        0x191a1819, 0x1c1d1b1c, 0x1f201e1f, 0x22232122,
+        0x25262425, 0x28292728, 0x2b2c2a2b, 0x2e2f2d2e);
+    // The bit offsets of the four 6 bit indices within each 32 bit word.
+    const __m512i shifts = _mm512_set1_epi64(0x3036242a1016040a);
+    const __m512i lookup = _mm512_loadu_si512(alphabet.characters);
+    // The unmasked forms trip -Wmaybe-uninitialized in some GCC versions.
+    const __mmask64 all = ~__mmask64 {0};
+
+    // The masked load touches exactly the 48 bytes that are used.
+    size_t ndx = 0;
+    while (size - ndx >= 48) {
+        __m512i v = _mm512_maskz_loadu_epi8(0x0000ffffffffffff, in + ndx);
+        v = _mm512_maskz_permutexvar_epi8(all, shuffle, v);
+        v = _mm512_maskz_multishift_epi64_epi8(all, shifts, v);
+        v = _mm512_maskz_permutexvar_epi8(all, v, lookup);
+        _mm512_storeu_si512(out, v);
+        ndx += 48;
+        out += 64;
+    }
+    return ndx;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+size_t decode_avx512vbmi(const Alphabet& alphabet, const char* in, size_t size, char* out,
+                         bool& valid)
+{
+    const __m512i lookup_0 = _mm512_loadu_si512(alphabet.ascii);
+    const __m512i lookup_1 = _mm512_loadu_si512(alphabet.ascii + 64);
+    const __m512i pack = _mm512_setr_epi32(
+        0x06000102, 0x090a0405, 0x0c0d0e08, 0x16101112,
+        0x191a1415, 0x1c1d1e18, 0x26202122, 0x292a2425,
+        0x2c2d2e28, 0x36303132, 0x393a3435, 0x3c3d3e38,
+        0, 0, 0, 0);
+
+    // The masked store touches exactly the 48 bytes that are produced.
+    size_t ndx = 0;
+    while (size - ndx >= 64) {
+        __m512i v = _mm512_loadu_si512(in + ndx);
+        __m512i indices = _mm512_permutex2var_epi8(lookup_0, v, lookup_1);
+        // Characters from 128 and up, and those outside the alphabet.
+        if (_mm512_movepi8_mask(_mm512_or_si512(indices, v)) != 0) {
+            valid = false;
+            return ndx;
+        }
+        __m512i merge_ab_and_bc = _mm512_maddubs_epi16(indices, _mm512_set1_epi32(0x01400140));
+        v = _mm512_madd_epi16(merge_ab_and_bc, _mm512_set1_epi32(0x00011000));
+        v = _mm512_maskz_permutexvar_epi8(0x0000ffffffffffff, pack, v);
+        _mm512_mask_storeu_epi8(out, 0x0000ffffffffffff, v);
+        ndx += 64;
+        out += 48;
+    }
+    return ndx;
+}
+
+#endif // BIOHASH_BASE64_X86
+
+base64::Isa select_isa()
+{
+#ifdef BIOHASH_BASE64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vbmi"))
+        return base64::Isa::avx512vbmi;
+    if (__builtin_cpu_supports("avx2"))
+        return base64::Isa::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return base64::Isa::sse41;
+#endif
+    return base64::Isa::scalar;
+}
+
+const base64::Isa selected_isa = select_isa();
+
+size_t encode_bulk(base64::Isa isa, const Alphabet& alphabet, const char* in, size_t size,
+                   char* out)
+{
+    switch (isa) {
+        case base64::Isa::scalar:
+            return 0;
+#ifdef BIOHASH_BASE64_X86
+        case base64::Isa::sse41:
+            return encode_sse41(alphabet.luts, in, size, out);
+        case base64::Isa::avx2:
+            return encode_avx2(alphabet.luts, in, size, out);
+        case base64::Isa::avx512vbmi:
+            return encode_avx512vbmi(alphabet, in, size, out);
+#endif
+        default:
+            ASSERT(false);
+            return 0;
+    }
+}
+
+size_t decode_bulk(base64::Isa isa, const Alphabet& alphabet, const char* in, size_t size,
+                   char* out, bool& valid)
+{
+    switch (isa) {
+        case base64::Isa::scalar:
+            return 0;
+#ifdef BIOHASH_BASE64_X86
+        case base64::Isa::sse41:
+            return decode_sse41(alphabet.luts, in, size, out, valid);
+        case base64::Isa::avx2:
+            return decode_avx2(alphabet.luts, in, size, out, valid);
+        case base64::Isa::avx512vbmi:
+            return decode_avx512vbmi(alphabet, in, size, out, valid);
+#endif
+        default:
+            ASSERT(false);
+            return 0;
+    }
+}
+
+// Encodes 'size' bytes, a multiple of 3, with the scalar code.
+void encode_groups(const Alphabet& alphabet, const char* in, size_t size, char* out)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(in);
+    for (size_t i = 0; i < size; i += 3) {
+        uint_least32_t group = (uint_least32_t {data[i]} << 16) |
+            (uint_least32_t {data[i + 1]} << 8) | data[i + 2];
+        const char* pair_0 = alphabet.pairs[group >> 12];
+        const char* pair_1 = alphabet.pairs[group & 0xfff];
+        out[0] = pair_0[0];
+        out[1] = pair_0[1];
+        out[2] = pair_1[0];
+        out[3] = pair_1[1];
+        out += 4;
+    }
+}
+
+// Decodes 'size' characters, a multiple of 4, with the scalar code. The
+// validity of the characters is accumulated and checked once at the end.
+bool decode_groups(const Alphabet& alphabet, const char* in, size_t size, char* out)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(in);
+    uint_least32_t error = 0;
+    for (size_t i = 0; i < size; i += 4) {
+        uint_least32_t group = alphabet.indices[0][data[i]] | alphabet.indices[1][data[i + 1]] |
+            alphabet.indices[2][data[i + 2]] | alphabet.indices[3][data[i + 3]];
+        error |= group;
+        out[0] = static_cast<char>(group >> 16);
+        out[1] = static_cast<char>(group >> 8);
+        out[2] = static_cast<char>(group);
+        out += 3;
+    }
+    return (error & invalid_index) == 0;
+}
+
+template <base64::Variant variant>
+size_t encode_unwrapped(const char* in, size_t size, char* out, base64::Isa isa)
+{
+    using T = Traits<variant>;
+    size_t rem = size % 3;
+    size_t ndx_in = encode_bulk(isa, T::alphabet, in, size, out);
+    ASSERT(ndx_in % 3 == 0);
+    size_t ndx_out = 4 * (ndx_in / 3);
+    encode_groups(T::alphabet, in + ndx_in, size - rem - ndx_in, out + ndx_out);
+    ndx_in = size - rem;
+    ndx_out = 4 * (ndx_in / 3);
+    if (rem != 0) {
+        uint_least32_t byte_0 = static_cast<unsigned char>(in[ndx_in]);
+        uint_least32_t byte_1 = rem == 2 ? static_cast<unsigned char>(in[ndx_in + 1]) : 0;
+        uint_least32_t group = (byte_0 << 16) | (byte_1 << 8);
+        out[ndx_out++] = T::alphabet.characters[group >> 18];
+        out[ndx_out++] = T::alphabet.characters[(group >> 12) & 0x3f];
+        if (rem == 2)
+            out[ndx_out++] = T::alphabet.characters[(group >> 6) & 0x3f];
+        if constexpr (T::padded) {
+            if (rem == 1)
+                out[ndx_out++] = pad;
+            out[ndx_out++] = pad;
+        }
+    }
+    return ndx_out;
+}
+
+template <base64::Variant variant>
+size_t encode_variant(const char* in, size_t size, char* out, base64::Isa isa)
+{
+    if constexpr (!Traits<variant>::wrapped) {
+        return encode_unwrapped<variant>(in, size, out, isa);
+    }
+    else {
+        size_t ndx_in = 0;
+        size_t ndx_out = 0;
+        while (size - ndx_in > mime_line_decoded_size) {
+            ndx_out += encode_unwrapped<variant>(in + ndx_in, mime_line_decoded_size,
+                                                 out + ndx_out, isa);
+            out[ndx_out++] = '\r';
+            out[ndx_out++] = '\n';
+            ndx_in += mime_line_decoded_size;
+        }
+        ndx_out += encode_unwrapped<variant>(in + ndx_in, size - ndx_in, out + ndx_out, isa);
+        return ndx_out;
+    }
+}
+
+template <base64::Variant variant>
+bool decode_unwrapped(const char* in, size_t size, char* out, size_t& out_size,
+                      base64::Isa isa)
+{
+    using T = Traits<variant>;
+    if (size == 0) {
+        out_size = 0;
+        return true;
+    }
+
+    // The final group of 2 or 3 characters, if any, is decoded separately.
+    size_t tail;
+    size_t groups_size;
+    if constexpr (T::padded) {
+        if (size % 4 != 0)
+            return false;
+        tail = in[size - 1] != pad ? 0 : in[size - 2] != pad ? 3 : 2;
+        groups_size = tail == 0 ? size : size - 4;
+    }
+    else {
+        tail = size % 4;
+        if (tail == 1)
+            return false;
+        groups_size = size - tail;
+    }
+
+    bool valid = true;
+    size_t ndx_in = decode_bulk(isa, T::alphabet, in, groups_size, out, valid);
+    if (!valid)
+        return false;
+    ASSERT(ndx_in % 4 == 0);
+    size_t ndx_out = 3 * (ndx_in / 4);
+    if (!decode_groups(T::alphabet, in + ndx_in, groups_size - ndx_in, out + ndx_out))
+        return false;
+    ndx_in = groups_size;
+    ndx_out = 3 * (groups_size / 4);
+
+    if (tail != 0) {
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(in + ndx_in);
+        uint_least32_t group = T::alphabet.indices[0][data[0]] | T::alphabet.indices[1][data[1]];
+        if (tail == 3)
+            group |= T::alphabet.indices[2][data[2]];
+        // The bits that do not make up a whole byte must be zero.
+        uint_least32_t unused = tail == 3 ? 0x000000ff : 0x0000ffff;
+        if ((group & (invalid_index | unused)) != 0)
+            return false;
+        out[ndx_out++] = static_cast<char>(group >> 16);
+        if (tail == 3)
+            out[ndx_out++] = static_cast<char>(group >> 8);
+    }
+    out_size = ndx_out;
+    return true;
+}
+
+bool is_whitespace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+// Whitespace can appear anywhere in the input. The runs between whitespace
+// are decoded in whole groups and groups that are split by whitespace are
+// reassembled in 'group'.
+template <base64::Variant variant>
+bool decode_wrapped(const char* in, size_t size, char* out, size_t& out_size,
+                    base64::Isa isa)
+{
+    constexpr base64::Variant unwrapped = base64::Variant::standard;
+    static_assert(&Traits<variant>::alphabet == &Traits<unwrapped>::alphabet);
+
+    char group[4];
+    size_t group_size = 0;
+    bool padded = false;
+    size_t ndx_in = 0;
+    size_t ndx_out = 0;
+    while (true) {
+        while (ndx_in < size && is_whitespace(in[ndx_in]))
+            ++ndx_in;
+        if (ndx_in == size)
+            break;
+        // Nothing but whitespace may follow a padded group.
+        if (padded)
+            return false;
+
+        size_t size_out;
+        if (group_size != 0) {
+            group[group_size++] = in[ndx_in++];
+            if (group_size == 4) {
+                if (!decode_unwrapped<unwrapped>(group, 4, out + ndx_out, size_out, isa))
+                    return false;
+                ndx_out += size_out;
+                padded = group[3] == pad;
+                group_size = 0;
+            }
+            continue;
+        }
+
+        size_t begin = ndx_in;
+        while (ndx_in < size && !is_whitespace(in[ndx_in]))
+            ++ndx_in;
+        size_t rem = (ndx_in - begin) % 4;
+        size_t run_size = ndx_in - begin - rem;
+        if (run_size != 0) {
+            if (!decode_unwrapped<unwrapped>(in + begin, run_size, out + ndx_out, size_out, isa))
+                return false;
+            ndx_out += size_out;
+            padded = in[begin + run_size - 1] == pad;
+            if (padded && rem != 0)
+                return false;
+        }
+        for (size_t i = 0; i < rem; ++i)
+            group[group_size++] = in[begin + run_size + i];
+    }
+    out_size = ndx_out;
+    return group_size == 0;
+}
+
+template <base64::Variant variant>
+bool decode_variant(const char* in, size_t size, char* out, size_t& out_size, base64::Isa isa)
+{
+    if constexpr (!Traits<variant>::wrapped)
+        return decode_unwrapped<variant>(in, size, out, out_size, isa);
+    else
+        return decode_wrapped<variant>(in, size, out, out_size, isa);
+}
+
+}
+
+bool base64::isa_supported(Isa isa)
+{
+    return isa <= selected_isa;
+}
+
+base64::Isa base64::default_isa()
+{
+    return selected_isa;
 }
 
 size_t base64::encoded_size(size_t decoded_size)
@@ -39,6 +694,23 @@ size_t base64::encoded_size(size_t decoded_size)
     return ((decoded_size + 2) / 3) * 4;
 }
 
+size_t base64::encoded_size(size_t decoded_size, Variant variant)
+{
+    size_t padded_size = encoded_size(decoded_size);
+    switch (variant) {
+        case Variant::standard:
+        case Variant::url:
+            return padded_size;
+        case Variant::standard_unpadded:
+        case Variant::url_unpadded:
+            return decoded_size % 3 == 0 ? padded_size : padded_size - 3 + decoded_size % 3;
+        case Variant::mime:
+            return padded_size == 0 ? 0 : padded_size + 2 * ((padded_size - 1) / mime_line_size);
+    }
+    ASSERT(false);
+    return 0;
+}
+
 size_t base64::decoded_size(const char* encoded_data,  size_t encoded_size)
 {
     if (encoded_size == 0)
@@ -50,99 +722,279 @@ size_t base64::decoded_size(const char* encoded_data,  size_t encoded_size)
     return 3 * (encoded_size / 4) - npads;
 }
 
+size_t base64::max_decoded_size(size_t encoded_size)
+{
+    return 3 * ((encoded_size + 3) / 4);
+}
+
 size_t base64::encode(const char* decoded_data,  size_t decoded_size,
                       char* encoded_data)
+{
+    return encode(decoded_data, decoded_size, encoded_data, Variant::standard, selected_isa);
+}
+
+size_t base64::encode(const char* decoded_data,  size_t decoded_size,
+                      char* encoded_data, Isa isa)
+{
+    return encode(decoded_data, decoded_size, encoded_data, Variant::standard, isa);
+}
+
+size_t base64::encode(const char* decoded_data,  size_t decoded_size,
+                      char* encoded_data, Variant variant)
+{
+    return encode(decoded_data, decoded_size, encoded_data, variant, selected_isa);
+}
+
+size_t base64::encode(const char* decoded_data,  size_t decoded_size,
+                      char* encoded_data, Variant variant, Isa isa)
 {
     ASSERT(CHAR_BIT == 8);
-    size_t quot = decoded_size / 3;
-    size_t rem = decoded_size % 3;
-    size_t ndx_in = 0;
-    size_t ndx_out = 0;
-    for (size_t i = 0; i < quot; ++i) {
-        unsigned char byte_0 = decoded_data[ndx_in++];
-        unsigned char byte_1 = decoded_data[ndx_in++];
-        unsigned char byte_2 = decoded_data[ndx_in++];
-        unsigned char ndx_0 = byte_0 >> 2;
-        unsigned char ndx_1 = ((byte_0 & 0x03) << 4) | (byte_1 >> 4);
-        unsigned char ndx_2 = ((byte_1 & 0x0f) << 2) | (byte_2 >> 6);
-        unsigned char ndx_3 = byte_2 & 0x3f;
-        encoded_data[ndx_out++] = characters[ndx_0];
-        encoded_data[ndx_out++] = characters[ndx_1];
-        encoded_data[ndx_out++] = characters[ndx_2];
-        encoded_data[ndx_out++] = characters[ndx_3];
+    ASSERT(isa_supported(isa));
+    size_t size = 0;
+    switch (variant) {
+        case Variant::standard:
+            size = encode_variant<Variant::standard>(decoded_data, decoded_size,
+                                                     encoded_data, isa);
+            break;
+        case Variant::standard_unpadded:
+            size = encode_variant<Variant::standard_unpadded>(decoded_data, decoded_size,
+                                                              encoded_data, isa);
+            break;
+        case Variant::url:
+            size = encode_variant<Variant::url>(decoded_data, decoded_size,
+                                                encoded_data, isa);
+            break;
+        case Variant::url_unpadded:
+            size = encode_variant<Variant::url_unpadded>(decoded_data, decoded_size,
+                                                         encoded_data, isa);
+            break;
+        case Variant::mime:
+            size = encode_variant<Variant::mime>(decoded_data, decoded_size,
+                                                 encoded_data, isa);
+            break;
     }
-    if (rem != 0) {
-        unsigned char byte_0 = decoded_data[ndx_in++];
-        unsigned char byte_1 = rem == 2 ? decoded_data[ndx_in++] : 0;
-        unsigned char ndx_0 = byte_0 >> 2;
-        unsigned char ndx_1 = ((byte_0 & 0x03) << 4) | (byte_1 >> 4);
-        encoded_data[ndx_out++] = characters[ndx_0];
-        encoded_data[ndx_out++] = characters[ndx_1];
-        if (rem == 2) {
-            unsigned char ndx_2 = (byte_1 & 0x0f) << 2;
-            encoded_data[ndx_out++] = characters[ndx_2];
+    ASSERT(size == encoded_size(decoded_size, variant));
+    return size;
+}
+
+bool base64::decode(const char* encoded_data, size_t encoded_size,
+                    char* decoded_data, size_t& decoded_size)
+{
+    return decode(encoded_data, encoded_size, decoded_data, decoded_size,
+                  Variant::standard, selected_isa);
+}
+
+bool base64::decode(const char* encoded_data, size_t encoded_size,
+                    char* decoded_data, size_t& decoded_size, Isa isa)
+{
+    return decode(encoded_data, encoded_size, decoded_data, decoded_size,
+                  Variant::standard, isa);
+}
+
+bool base64::decode(const char* encoded_data, size_t encoded_size,
+                    char* decoded_data, size_t& decoded_size, Variant variant)
+{
+    return decode(encoded_data, encoded_size, decoded_data, decoded_size,
+                  variant, selected_isa);
+}
+
+bool base64::decode(const char* encoded_data, size_t encoded_size,
+                    char* decoded_data, size_t& decoded_size, Variant variant, Isa isa)
+{
+    ASSERT(CHAR_BIT == 8);
+    ASSERT(isa_supported(isa));
+    switch (variant) {
+        case Variant::standard:
+            return decode_variant<Variant::standard>(encoded_data, encoded_size,
+                                                     decoded_data, decoded_size, isa);
+        case Variant::standard_unpadded:
+            return decode_variant<Variant::standard_unpadded>(encoded_data, encoded_size,
+                                                              decoded_data, decoded_size, isa);
+        case Variant::url:
+            return decode_variant<Variant::url>(encoded_data, encoded_size,
+                                                decoded_data, decoded_size, isa);
+        case Variant::url_unpadded:
+            return decode_variant<Variant::url_unpadded>(encoded_data, encoded_size,
+                                                         decoded_data, decoded_size, isa);
+        case Variant::mime:
+            return decode_variant<Variant::mime>(encoded_data, encoded_size,
+                                                 decoded_data, decoded_size, isa);
+    }
+    ASSERT(false);
+    return false;
+}
+
+namespace {
+
+// Splits 'size' into at most 'max_chunks' chunks of a multiple of 'unit'
+// and at least 'min_chunk_size'. Returns the number of chunks and sets
+// 'chunk_size' to the size of all but the last one.
+size_t split(size_t size, size_t unit, size_t min_chunk_size, size_t max_chunks,
+             size_t& chunk_size)
+{
+    size_t num_chunks = std::min(max_chunks, size / std::max<size_t>(min_chunk_size, 1));
+    if (num_chunks < 2)
+        return 1;
+    chunk_size = (size / num_chunks + unit - 1) / unit * unit;
+    return (size + chunk_size - 1) / chunk_size;
+}
+
+}
+
+size_t base64::parallel_encode(ThreadPool& pool, const char* decoded_data, size_t decoded_size,
+                               char* encoded_data, Variant variant, size_t min_chunk_size)
+{
+    // A MIME chunk is made of whole lines, and the line break after it is
+    // added separately.
+    bool wrapped = variant == Variant::mime;
+    size_t unit = wrapped ? mime_line_decoded_size : 3;
+    size_t chunk_size;
+    size_t num_chunks = split(decoded_size, unit, min_chunk_size, pool.size() + 1, chunk_size);
+    if (num_chunks == 1)
+        return encode(decoded_data, decoded_size, encoded_data, variant);
+
+    size_t chunk_encoded_size = encoded_size(chunk_size, variant) + (wrapped ? 2 : 0);
+    pool.parallel_for(num_chunks, [&](size_t i) {
+        size_t begin = i * chunk_size;
+        size_t size = std::min(chunk_size, decoded_size - begin);
+        char* out = encoded_data + i * chunk_encoded_size;
+        size_t size_out = encode(decoded_data + begin, size, out, variant);
+        if (wrapped && i != num_chunks - 1) {
+            out[size_out] = '\r';
+            out[size_out + 1] = '\n';
         }
-        else {
-            encoded_data[ndx_out++] = pad;
+    });
+    return encoded_size(decoded_size, variant);
+}
+
+bool base64::parallel_decode(ThreadPool& pool, const char* encoded_data, size_t encoded_size,
+                             char* decoded_data, size_t& decoded_size, Variant variant,
+                             size_t min_chunk_size)
+{
+    size_t chunk_size;
+    size_t num_chunks = split(encoded_size, 4, min_chunk_size, pool.size() + 1, chunk_size);
+    if (num_chunks == 1 || variant == Variant::mime)
+        return decode(encoded_data, encoded_size, decoded_data, decoded_size, variant);
+
+    // All chunks but the last consist of whole groups without padding, and
+    // decode to exactly 3 bytes per group.
+    std::atomic<bool> valid {true};
+    std::atomic<size_t> last_size {0};
+    pool.parallel_for(num_chunks, [&](size_t i) {
+        size_t begin = i * chunk_size;
+        size_t size = std::min(chunk_size, encoded_size - begin);
+        bool last = i == num_chunks - 1;
+        if (!last && encoded_data[begin + size - 1] == pad) {
+            valid = false;
+            return;
         }
-        encoded_data[ndx_out++] = pad;
+        size_t size_out;
+        if (!decode(encoded_data + begin, size, decoded_data + 3 * (begin / 4), size_out, variant))
+            valid = false;
+        else if (last)
+            last_size = size_out;
+    });
+    if (!valid)
+        return false;
+    decoded_size = 3 * ((num_chunks - 1) * chunk_size / 4) + last_size;
+    return true;
+}
+
+size_t base64::Encoder::max_update_size(size_t size)
+{
+    return 4 * ((size + 2) / 3);
+}
+
+size_t base64::Encoder::update(const char* decoded_data, size_t decoded_size,
+                               char* encoded_data)
+{
+    size_t ndx_in = 0;
+    size_t ndx_out = 0;
+    if (m_carry_size != 0) {
+        while (m_carry_size < 3 && ndx_in < decoded_size)
+            m_carry[m_carry_size++] = decoded_data[ndx_in++];
+        if (m_carry_size < 3)
+            return 0;
+        ndx_out += encode(m_carry, 3, encoded_data);
+        m_carry_size = 0;
     }
+    size_t rem = (decoded_size - ndx_in) % 3;
+    size_t size = decoded_size - ndx_in - rem;
+    ndx_out += encode(decoded_data + ndx_in, size, encoded_data + ndx_out);
+    ndx_in += size;
+    for (size_t i = 0; i < rem; ++i)
+        m_carry[m_carry_size++] = decoded_data[ndx_in++];
     ASSERT(ndx_in == decoded_size);
-    ASSERT(ndx_out == 4 * quot + (rem != 0 ? 4 : 0));
+    ASSERT(ndx_out <= max_update_size(decoded_size));
     return ndx_out;
 }
 
-bool base64::decode(const char* encoded_data, size_t encoded_size,
-                    char* decoded_data, size_t& decoded_size)
+size_t base64::Encoder::finish(char* encoded_data)
 {
-    ASSERT(CHAR_BIT == 8);
-    if (encoded_size == 0) {
-        decoded_size = 0;
+    size_t size = encode(m_carry, m_carry_size, encoded_data);
+    m_carry_size = 0;
+    return size;
+}
+
+size_t base64::Decoder::max_update_size(size_t size)
+{
+    return 3 * ((size + 3) / 4);
+}
+
+bool base64::Decoder::update(const char* encoded_data, size_t encoded_size,
+                             char* decoded_data, size_t& decoded_size)
+{
+    decoded_size = 0;
+    if (!m_valid)
+        return false;
+    if (encoded_size == 0)
         return true;
-    }
-    if (encoded_size % 4 != 0)
+    // Nothing may follow a padded group.
+    if (m_padded) {
+        m_valid = false;
         return false;
-    bool has_pad = encoded_data[encoded_size - 1] == pad;
-    size_t triplets = encoded_size / 4 - (has_pad ? 1 : 0);
+    }
+
     size_t ndx_in = 0;
-    size_t ndx_out = 0;
-    for (size_t i = 0; i < triplets; ++i) {
-        unsigned char ndx_0 = character_to_index(encoded_data[ndx_in++]);
-        unsigned char ndx_1 = character_to_index(encoded_data[ndx_in++]);
-        unsigned char ndx_2 = character_to_index(encoded_data[ndx_in++]);
-        unsigned char ndx_3 = character_to_index(encoded_data[ndx_in++]);
-        if (ndx_0 == 255 || ndx_1 == 255 || ndx_2 == 255 || ndx_3 == 255)
+    if (m_carry_size != 0) {
+        while (m_carry_size < 4 && ndx_in < encoded_size)
+            m_carry[m_carry_size++] = encoded_data[ndx_in++];
+        if (m_carry_size < 4)
+            return true;
+        m_carry_size = 0;
+        m_padded = m_carry[3] == pad;
+        if (!decode(m_carry, 4, decoded_data, decoded_size) ||
+            (m_padded && ndx_in != encoded_size)) {
+            m_valid = false;
             return false;
-        unsigned char byte_0 = (ndx_0 << 2) | (ndx_1 >> 4);
-        unsigned char byte_1 = ((ndx_1 & 0x0f) << 4) | (ndx_2 >> 2);
-        unsigned char byte_2 = ((ndx_2 & 0x03) << 6) | ndx_3;
-        decoded_data[ndx_out++] = byte_0;
-        decoded_data[ndx_out++] = byte_1;
-        decoded_data[ndx_out++] = byte_2;
-    }
-    if (has_pad) {
-        unsigned char ndx_0 = character_to_index(encoded_data[ndx_in++]);
-        unsigned char ndx_1 = character_to_index(encoded_data[ndx_in++]);
-        if (ndx_0 == 255 || ndx_1 == 255)
-            return false;
-        unsigned char byte_0 = (ndx_0 << 2) | (ndx_1 >> 4);
-        decoded_data[ndx_out++] = byte_0;
-        char ch_2 = encoded_data[ndx_in++];
-        ASSERT(encoded_data[ndx_in++] == pad);
-        if (ch_2 != pad) {
-            char ndx_2 = character_to_index(ch_2);
-            if ((ndx_2 & 0x03) != 0)
-                return false;
-            unsigned char byte_1 = ((ndx_1 & 0x0f) << 4) | (ndx_2 >> 2);
-            decoded_data[ndx_out++] = byte_1;
         }
-        else {
-            if ((ndx_1 & 0x0f) != 0)
-                return false;
+    }
+
+    size_t rem = (encoded_size - ndx_in) % 4;
+    size_t size = encoded_size - ndx_in - rem;
+    if (size != 0) {
+        size_t size_out;
+        m_padded = encoded_data[ndx_in + size - 1] == pad;
+        if (!decode(encoded_data + ndx_in, size, decoded_data + decoded_size, size_out) ||
+            (m_padded && rem != 0)) {
+            m_valid = false;
+            return false;
         }
+        decoded_size += size_out;
+        ndx_in += size;
     }
+    for (size_t i = 0; i < rem; ++i)
+        m_carry[m_carry_size++] = encoded_data[ndx_in++];
     ASSERT(ndx_in == encoded_size);
-    ASSERT(ndx_out == base64::decoded_size(encoded_data, encoded_size));
-    decoded_size = ndx_out;
+    ASSERT(decoded_size <= max_update_size(encoded_size));
     return true;
 }
+
+bool base64::Decoder::finish()
+{
+    bool valid = m_valid && m_carry_size == 0;
+    m_carry_size = 0;
+    m_padded = false;
+    m_valid = true;
+    return valid;
+}
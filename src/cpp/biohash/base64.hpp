@@ -3,21 +3,76 @@
 #include <cstddef>
 
 namespace biohash {
+
+class ThreadPool;
+
 namespace base64 {
 
+// The variants of base64 from RFC 4648 and RFC 2045.
+enum class Variant {
+    // The standard alphabet with padding. This is the default.
+    standard,
+    // The standard alphabet without padding.
+    standard_unpadded,
+    // The URL and filename safe alphabet, where '-' and '_' replace '+' and
+    // '/', with padding.
+    url,
+    // The URL and filename safe alphabet without padding, as used by JWTs.
+    url_unpadded,
+    // The standard alphabet with padding, encoded in lines of 76 characters
+    // separated by CRLF. Decoding skips whitespace (SP, HTAB, CR and LF)
+    // anywhere in the input.
+    mime
+};
+
+// The instruction set used for the bulk of encode() and decode(). The best
+// one supported by the CPU is selected once at startup. The scalar code is
+// always available and handles the tail of the data for the other ones.
+enum class Isa {
+    scalar,
+    sse41,
+    avx2,
+    avx512vbmi
+};
+
+// Returns true if 'isa' can be used on this CPU.
+bool isa_supported(Isa isa);
+
+// The instruction set selected at startup.
+Isa default_isa();
+
 // Calculates the size of the base64 encoded data given the size of the decoded
 // data.
 size_t encoded_size(size_t decoded_size);
 
+// Calculates the size of the encoded data for a given variant.
+size_t encoded_size(size_t decoded_size, Variant variant);
+
 // Calculates the size of the decoded data given the data and size of the
 // encoded data.
 size_t decoded_size(const char* encoded_data,  size_t encoded_size);
 
+// Calculates an upper bound of the size of the decoded data, for any variant,
+// given the size of the encoded data.
+size_t max_decoded_size(size_t encoded_size);
+
 // Encodes 'decoded_data' and places the result in 'encoded_data'.
 // The return value is the size of the encoded data. 'encoded_data' must be
 // large enough to hold the result.
 size_t encode(const char* decoded_data,  size_t decoded_size, char* encoded_data);
 
+// As encode() but with an explicit instruction set which must be supported.
+// The result is identical for all instruction sets.
+size_t encode(const char* decoded_data,  size_t decoded_size, char* encoded_data,
+              Isa isa);
+
+// As encode() but for another variant. The size of the encoded data is
+// encoded_size(decoded_size, variant).
+size_t encode(const char* decoded_data,  size_t decoded_size, char* encoded_data,
+              Variant variant);
+size_t encode(const char* decoded_data,  size_t decoded_size, char* encoded_data,
+              Variant variant, Isa isa);
+
 // Decodes 'encoded_data' of size 'encoded_size' and places the result in
 // 'decoded_data'. 'decoded_data' must be large enough to hold the result.
 // 'decoded_size' is set to the size of the decoded data.
@@ -25,5 +80,92 @@ size_t encode(const char* decoded_data,  size_t decoded_size, char* encoded_data
 // invalid, the output should not be used.
 bool decode(const char* encoded_data, size_t encoded_size,
             char* decoded_data, size_t& decoded_size);
+
+// As decode() but with an explicit instruction set which must be supported.
+// The result is identical for all instruction sets.
+bool decode(const char* encoded_data, size_t encoded_size,
+            char* decoded_data, size_t& decoded_size, Isa isa);
+
+// As decode() but for another variant. 'decoded_data' must have room for
+// max_decoded_size(encoded_size) bytes.
+bool decode(const char* encoded_data, size_t encoded_size,
+            char* decoded_data, size_t& decoded_size, Variant variant);
+bool decode(const char* encoded_data, size_t encoded_size,
+            char* decoded_data, size_t& decoded_size, Variant variant, Isa isa);
+
+// The default minimum number of bytes or characters given to each thread by
+// parallel_encode() and parallel_decode(). Smaller data is processed on the
+// calling thread alone.
+constexpr size_t parallel_chunk_size = 256 * 1024;
+
+// As encode(), but large data is split into chunks on group (and for MIME,
+// line) boundaries that are encoded in parallel by 'pool' and the calling
+// thread. The output is identical to that of encode().
+size_t parallel_encode(ThreadPool& pool, const char* decoded_data, size_t decoded_size,
+                       char* encoded_data, Variant variant,
+                       size_t min_chunk_size = parallel_chunk_size);
+
+// As decode(), but large data is split into chunks on group boundaries that
+// are decoded in parallel by 'pool' and the calling thread. The output and
+// the validation are identical to those of decode(). MIME data is always
+// decoded on the calling thread since the position of the groups depends on
+// the whitespace.
+bool parallel_decode(ThreadPool& pool, const char* encoded_data, size_t encoded_size,
+                     char* decoded_data, size_t& decoded_size, Variant variant,
+                     size_t min_chunk_size = parallel_chunk_size);
+
+// An Encoder encodes data that arrives in chunks of arbitrary size. Up to 2
+// bytes are carried between calls to update(). The concatenated output of
+// update() and finish() equals the output of encode() for the concatenated
+// input.
+class Encoder {
+public:
+
+    // The maximum size of the output of update() for a chunk of size 'size'.
+    static size_t max_update_size(size_t size);
+
+    // Encodes 'decoded_data' and places the result in 'encoded_data' which
+    // must have room for max_update_size(decoded_size) characters. The
+    // return value is the size of the encoded data.
+    size_t update(const char* decoded_data, size_t decoded_size, char* encoded_data);
+
+    // Encodes the carried bytes, if any, including padding. 'encoded_data'
+    // must have room for 4 characters. The return value is the size of the
+    // encoded data. The Encoder can be reused after finish().
+    size_t finish(char* encoded_data);
+
+private:
+    char m_carry[3];
+    size_t m_carry_size = 0;
+};
+
+// A Decoder decodes data that arrives in chunks of arbitrary size. Up to 3
+// characters are carried between calls to update(). The concatenated input is
+// valid if and only if it is valid for decode(), in which case the
+// concatenated output equals the output of decode().
+class Decoder {
+public:
+
+    // The maximum size of the output of update() for a chunk of size 'size'.
+    static size_t max_update_size(size_t size);
+
+    // Decodes 'encoded_data' and places the result in 'decoded_data' which
+    // must have room for max_update_size(encoded_size) bytes. 'decoded_size'
+    // is set to the size of the decoded data. The return value is false if
+    // the input seen so far is invalid, in which case the Decoder stays
+    // invalid until finish().
+    bool update(const char* encoded_data, size_t encoded_size,
+                char* decoded_data, size_t& decoded_size);
+
+    // Ends the input. The return value is true if and only if the whole input
+    // was valid. The Decoder can be reused after finish().
+    bool finish();
+
+private:
+    char m_carry[4];
+    size_t m_carry_size = 0;
+    bool m_padded = false;
+    bool m_valid = true;
+};
 }
 }
@@ -0,0 +1,433 @@
+#include <errno.h>
+#include <limits.h>
+#include <strings.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+
+#include "compression.hpp"
+#include "assert.hpp"
+
+using namespace biohash;
+
+struct http::Compressor::Variant {
+    std::string key;
+    std::string data;
+};
+
+namespace {
+
+// A deflate stream that is initialized once and reset for each body.
+class Deflater {
+public:
+
+    // 'window_bits' selects the format, 15 + 16 for gzip and 15 for zlib.
+    Deflater(int window_bits)
+    {
+        m_initialized = deflateInit2(&m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits,
+                                     8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Deflater()
+    {
+        if (m_initialized)
+            deflateEnd(&m_stream);
+    }
+
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    bool compress(int level, const char* data, size_t size, std::string& out)
+    {
+        if (!m_initialized || deflateReset(&m_stream) != Z_OK)
+            return false;
+        // The parameters can be changed without flushing before any input.
+        if (level != m_level) {
+            if (deflateParams(&m_stream, level, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            m_level = level;
+        }
+        uLong bound = deflateBound(&m_stream, static_cast<uLong>(size));
+        if (size > UINT_MAX || bound > UINT_MAX)
+            return false;
+
+        // One call suffices with room for the bound.
+        size_t offset = out.size();
+        out.resize(offset + bound);
+        m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        m_stream.avail_in = static_cast<uInt>(size);
+        m_stream.next_out = reinterpret_cast<Bytef*>(&out[offset]);
+        m_stream.avail_out = static_cast<uInt>(bound);
+        int rc = deflate(&m_stream, Z_FINISH);
+        out.resize(offset + (bound - m_stream.avail_out));
+        if (rc != Z_STREAM_END) {
+            out.resize(offset);
+            return false;
+        }
+        return true;
+    }
+
+private:
+
+    z_stream m_stream {};
+    bool m_initialized;
+    int m_level = Z_DEFAULT_COMPRESSION;
+};
+
+// Responses with a larger header are passed on without looking further.
+constexpr size_t max_header_size = 64 * 1024;
+
+// Returns true for the media types of text, which compress well.
+bool is_compressible(std::string_view content_type)
+{
+    std::string_view type = content_type.substr(0, content_type.find(';'));
+    while (!type.empty() && (type.back() == ' ' || type.back() == '\t'))
+        type.remove_suffix(1);
+
+    auto equal_nocase = [](std::string_view a, std::string_view b) {
+        return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    };
+    if (type.size() > 5 && equal_nocase(type.substr(0, 5), "text/"))
+        return true;
+    for (std::string_view suffix: {"+json", "+xml"}) {
+        if (type.size() > suffix.size() &&
+            equal_nocase(type.substr(type.size() - suffix.size()), suffix))
+            return true;
+    }
+    const char* types[] = {
+        "application/javascript", "application/json", "application/wasm", "application/xml",
+        "image/vnd.microsoft.icon",
+    };
+    for (const char* compressible: types) {
+        if (equal_nocase(type, compressible))
+            return true;
+    }
+    return false;
+}
+
+// Reads 'size' bytes at 'offset' of 'fd' into 'out'.
+bool read_file(int fd, uint_least64_t offset, size_t size, std::string& out)
+{
+    out.resize(size);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rc = pread(fd, &out[done], size - done, static_cast<off_t>(offset + done));
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return false;
+        done += static_cast<size_t>(rc);
+    }
+    return true;
+}
+
+bool ends_with_empty_line(const std::string& data)
+{
+    return data.size() >= 4 && data.compare(data.size() - 4, 4, "\r\n\r\n") == 0;
+}
+
+// Returns true if the entity tags of If-None-Match 'list' include 'etag'.
+bool lists_etag(std::string_view list, std::string_view etag)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view element = list.substr(0, comma);
+        while (!element.empty() && (element.front() == ' ' || element.front() == '\t'))
+            element.remove_prefix(1);
+        while (!element.empty() && (element.back() == ' ' || element.back() == '\t'))
+            element.remove_suffix(1);
+        if (element == etag)
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// Copies the header fields of 'msg' with Accept-Encoding added to Vary. If
+// 'coded', the fields that only apply to the identity coding are left out.
+// If 'weak', the entity tag is made weak, RFC 9110 section 8.8.3, since the
+// bytes of a coded representation differ.
+std::string rewrite_header(const http::Message& msg, bool coded, bool weak)
+{
+    using http::Header;
+    std::string header;
+    std::string vary;
+    for (size_t i = 0; i < msg.num_header_fields; ++i) {
+        const http::HeaderField& field = msg.header_fields[i];
+        if (coded && (field.header == Header::ContentLength ||
+                      field.header == Header::AcceptRanges))
+            continue;
+        if (field.header == Header::Vary) {
+            if (!vary.empty())
+                vary += ", ";
+            vary += field.value;
+            continue;
+        }
+        header += field.name;
+        header += ": ";
+        if (weak && field.header == Header::ETag && field.value.substr(0, 2) != "W/")
+            header += "W/";
+        header += field.value;
+        header += "\r\n";
+    }
+    if (!http::has_token(vary, "*") && !http::has_token(vary, "Accept-Encoding"))
+        vary += vary.empty() ? "Accept-Encoding" : ", Accept-Encoding";
+    header += "Vary: ";
+    header += vary;
+    header += "\r\n";
+    return header;
+}
+
+// Replaces the header of a response, which takes its first 'num_segments'
+// segments, with 'header' and keeps the body.
+void replace_header(const http::Message& msg, std::string header, int num_segments,
+                    http::Response& response)
+{
+    // The header is kept alive along with the owner of the body.
+    struct Owner {
+        std::string header;
+        std::shared_ptr<const void> owner;
+    };
+    std::shared_ptr<Owner> owner = std::make_shared<Owner>();
+    owner->header = std::move(header);
+    owner->owner = std::move(response.owner);
+
+    http::ResponseBuilder& builder = response.builder;
+    iovec body[http::ResponseBuilder::max_segments];
+    int num_body_segments = builder.num_segments() - num_segments;
+    std::copy_n(builder.segments() + num_segments, num_body_segments, body);
+    builder.reset();
+    builder.status(msg.status_code);
+    builder.header_block(owner->header);
+    builder.end_header();
+    for (int i = 0; i < num_body_segments; ++i)
+        builder.body(static_cast<const char*>(body[i].iov_base), body[i].iov_len);
+    response.owner = std::move(owner);
+}
+
+// The key of a compressed variant in the cache.
+std::string variant_key(const http::Message& request, std::string_view etag,
+                        http::ContentCoding coding)
+{
+    std::string key = http::content_coding_name(coding);
+    key += ' ';
+    key += request.request_target;
+    key += ' ';
+    key += etag;
+    return key;
+}
+
+} // anonymous namespace
+
+bool http::compress(ContentCoding coding, int level, const char* data, size_t size,
+                    std::string& out)
+{
+    ASSERT(level == -1 || (level >= 1 && level <= 9));
+    thread_local Deflater gzip_deflater {15 + 16};
+    thread_local Deflater zlib_deflater {15};
+    switch (coding) {
+        case ContentCoding::gzip:
+            return gzip_deflater.compress(level, data, size, out);
+        case ContentCoding::deflate:
+            return zlib_deflater.compress(level, data, size, out);
+        case ContentCoding::identity:
+            break;
+    }
+    ASSERT(false);
+    return false;
+}
+
+http::Compressor::Compressor(Server::Handler handler, const CompressorConfig& config):
+    m_handler {std::move(handler)},
+    m_config {config}
+{
+    ASSERT(m_config.level == -1 || (m_config.level >= 1 && m_config.level <= 9));
+}
+
+http::Compressor::~Compressor()
+{
+}
+
+void http::Compressor::handle(const Message& request, std::string_view body,
+                              Response& response)
+{
+    m_handler(request, body, response);
+    bool head = request.method == Method::HEAD;
+    if ((request.method != Method::GET && !head) || response.splice_size > 0)
+        return;
+
+    // The header, which ends with the empty line at the end of a segment.
+    ResponseBuilder& builder = response.builder;
+    std::string header_data;
+    int num_segments = 0;
+    while (num_segments < builder.num_segments() && !ends_with_empty_line(header_data)) {
+        const iovec& segment = builder.segments()[num_segments++];
+        header_data.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+        if (header_data.size() > max_header_size)
+            return;
+    }
+    Message msg {Message::Kind::Response, header_data.data(), header_data.size()};
+    if (!ends_with_empty_line(header_data) || !msg.valid || !msg.header_complete)
+        return;
+    ContentCoding coding = negotiate_content_coding(request.header(Header::AcceptEncoding));
+
+    // RFC 9110 section 15.4.5. The type of the body is unknown, so each 304
+    // varies on Accept-Encoding, and that of a compressed variant, which was
+    // validated with the weak ETag, carries the weak ETag.
+    if (msg.status_code == 304) {
+        std::string_view etag = msg.header(Header::ETag);
+        bool weak = coding != ContentCoding::identity && !etag.empty() && etag[0] == '"' &&
+            lists_etag(request.header(Header::IfNoneMatch), "W/" + std::string {etag});
+        return replace_header(msg, rewrite_header(msg, false, weak), num_segments, response);
+    }
+
+    if (msg.status_code != 200 || msg.chunked ||
+        msg.header(Header::ContentEncoding).data() || msg.header(Header::ContentRange).data() ||
+        !is_compressible(msg.header(Header::ContentType)) ||
+        has_token(msg.header(Header::CacheControl), "no-transform"))
+        return;
+    uint_least64_t identity_size = response.file_size;
+    for (int i = num_segments; i < builder.num_segments(); ++i)
+        identity_size += builder.segments()[i].iov_len;
+    // The response to HEAD has the header of the response to GET, RFC 9110
+    // section 9.3.2, without the body.
+    if (head && identity_size == 0)
+        identity_size = msg.content_length;
+    if (identity_size < m_config.min_size || identity_size > m_config.max_size ||
+        identity_size != msg.content_length ||
+        (response.file_size > 0 && num_segments != builder.num_segments()))
+        return;
+
+    // From here on, the response depends on Accept-Encoding. The size of the
+    // compressed body is only known for HEAD if the variant is cached.
+    std::shared_ptr<const Variant> variant;
+    if (coding != ContentCoding::identity && head)
+        variant = cached_variant(request, msg, coding);
+    else if (coding != ContentCoding::identity)
+        variant = compressed_variant(request, msg, coding, num_segments, response);
+    if (!variant)
+        return replace_header(msg, rewrite_header(msg, false, false), num_segments, response);
+
+    std::string header = rewrite_header(msg, true, true);
+    response.reset();
+    response.body = std::move(header);
+    builder.status(200);
+    builder.header_block(response.body);
+    builder.header(Header::ContentEncoding, content_coding_name(coding));
+    builder.content_length(variant->data.size());
+    builder.end_header();
+    if (head)
+        return;
+    builder.body(variant->data.data(), variant->data.size());
+    response.owner = std::move(variant);
+}
+
+// Returns the cached body of the response compressed with 'coding', or null.
+std::shared_ptr<const http::Compressor::Variant>
+http::Compressor::cached_variant(const Message& request, const Message& msg,
+                                 ContentCoding coding)
+{
+    std::string_view etag = msg.header(Header::ETag);
+    if (!etag.data())
+        return nullptr;
+    std::shared_ptr<const Variant> variant = get(variant_key(request, etag, coding));
+    if (variant)
+        ++m_num_cache_hits;
+    return variant;
+}
+
+// Returns the body of the response compressed with 'coding', from the cache
+// if possible, or null if compression fails or does not make it smaller.
+std::shared_ptr<const http::Compressor::Variant>
+http::Compressor::compressed_variant(const Message& request, const Message& msg,
+                                     ContentCoding coding, int num_segments,
+                                     const Response& response)
+{
+    std::shared_ptr<const Variant> variant = cached_variant(request, msg, coding);
+    if (variant)
+        return variant;
+    std::string_view etag = msg.header(Header::ETag);
+    std::string key;
+    if (etag.data())
+        key = variant_key(request, etag, coding);
+
+    // The body is only copied when its compressed version is not cached.
+    std::string identity;
+    if (response.file_size > 0) {
+        if (!read_file(response.file_fd, response.file_offset,
+                       static_cast<size_t>(response.file_size), identity))
+            return nullptr;
+    }
+    else {
+        const ResponseBuilder& builder = response.builder;
+        identity.reserve(static_cast<size_t>(msg.content_length));
+        for (int i = num_segments; i < builder.num_segments(); ++i) {
+            const iovec& segment = builder.segments()[i];
+            identity.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+        }
+    }
+    std::shared_ptr<Variant> compressed = std::make_shared<Variant>();
+    compressed->data.reserve(identity.size() / 2);
+    if (!compress(coding, m_config.level, identity.data(), identity.size(), compressed->data))
+        return nullptr;
+    ++m_num_compressed;
+    if (compressed->data.size() >= identity.size())
+        return nullptr;
+    compressed->data.shrink_to_fit();
+    compressed->key = std::move(key);
+    if (!compressed->key.empty())
+        insert(compressed);
+    return compressed;
+}
+
+size_t http::Compressor::num_cached()
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_variants.size();
+}
+
+uint_least64_t http::Compressor::num_compressed() const
+{
+    return m_num_compressed.load();
+}
+
+uint_least64_t http::Compressor::num_cache_hits() const
+{
+    return m_num_cache_hits.load();
+}
+
+std::shared_ptr<const http::Compressor::Variant> http::Compressor::get(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+        return nullptr;
+    m_variants.splice(m_variants.begin(), m_variants, it->second);
+    return *it->second;
+}
+
+// Adds a variant to the front of the LRU list and evicts the least recently
+// used variants beyond max_cache_size. Responses that are being written keep
+// their variant.
+void http::Compressor::insert(std::shared_ptr<const Variant> variant)
+{
+    size_t variant_size = variant->key.size() + variant->data.size();
+    if (variant_size > m_config.max_cache_size)
+        return;
+
+    std::lock_guard<std::mutex> lock {m_mutex};
+    // Another request may have compressed the same body meanwhile.
+    if (m_index.count(variant->key))
+        return;
+    while (m_cache_size + variant_size > m_config.max_cache_size) {
+        const Variant& last = *m_variants.back();
+        m_cache_size -= last.key.size() + last.data.size();
+        m_index.erase(last.key);
+        m_variants.pop_back();
+    }
+    m_variants.push_front(std::move(variant));
+    m_index.emplace(m_variants.front()->key, m_variants.begin());
+    m_cache_size += variant_size;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "http.hpp"
+#include "http_server.hpp"
+
+namespace biohash {
+namespace http {
+
+// Compresses 'size' bytes of 'data' with 'coding', which must be gzip or
+// deflate (the zlib format, RFC 9110 section 8.4.1.2), at the zlib 'level',
+// from 1 to 9 or -1 for the default, and appends the result to 'out'. Each
+// thread keeps a stream per coding that is reset between calls, so that
+// compressing does not allocate zlib state. Returns false on failure.
+bool compress(ContentCoding coding, int level, const char* data, size_t size,
+              std::string& out);
+
+struct CompressorConfig {
+    // The zlib compression level.
+    int level = 6;
+    // Smaller bodies are sent as they are.
+    size_t min_size = 256;
+    // Larger bodies, including file bodies, are sent as they are.
+    size_t max_size = 8 * 1024 * 1024;
+    // The total size of the cached compressed bodies.
+    size_t max_cache_size = 32 * 1024 * 1024;
+};
+
+// A Compressor sits in front of a handler and compresses the bodies of its
+// responses to GET requests with the coding negotiated from Accept-Encoding.
+// A 200 response is compressed if its Content-Type is textual, such as
+// text/*, JSON, JavaScript or XML, it has no Content-Encoding and no
+// Cache-Control no-transform, and its body, which may be sent from a file as
+// by StaticFiles, is within the size limits. The compressed response gets a
+// Content-Encoding and a weak version of its ETag, and loses Accept-Ranges,
+// since ranges are served of the identity coding only. It is sent as it is if
+// compression does not make it smaller. All responses that could have been
+// compressed, and all 304 responses, get Vary: Accept-Encoding. A 304
+// response to a request that validates a compressed response with its weak
+// ETag carries the weak ETag.
+//
+// A response to HEAD gets the header of the compressed response to GET if
+// the compressed body is cached, see below, and only Vary otherwise.
+//
+// The compressed bodies of responses with an ETag are kept in a bounded LRU
+// cache, keyed by the coding, the request target and the ETag, such that a
+// static file or another validated representation is compressed once per
+// coding. Other responses are compressed per request, unless a ResponseCache
+// with "Accept-Encoding" among its vary headers is placed in front.
+//
+// handle() may be called concurrently, such as from the reactors of a
+// MultiServer.
+class Compressor {
+public:
+
+    Compressor(Server::Handler handler, const CompressorConfig& config = CompressorConfig {});
+    ~Compressor();
+
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    // A Server::Handler.
+    void handle(const Message& request, std::string_view body, Response& response);
+
+    size_t num_cached();
+
+    // The bodies that have been compressed, and those taken from the cache.
+    uint_least64_t num_compressed() const;
+    uint_least64_t num_cache_hits() const;
+
+private:
+
+    struct Variant;
+
+    const Server::Handler m_handler;
+    const CompressorConfig m_config;
+
+    std::mutex m_mutex;
+    // Most recently used first.
+    std::list<std::shared_ptr<const Variant>> m_variants;
+    // Variants by their key, which the key of the map refers to.
+    std::unordered_map<std::string_view, std::list<std::shared_ptr<const Variant>>::iterator>
+        m_index;
+    size_t m_cache_size = 0;
+
+    std::atomic<uint_least64_t> m_num_compressed {0};
+    std::atomic<uint_least64_t> m_num_cache_hits {0};
+
+    std::shared_ptr<const Variant> cached_variant(const Message& request, const Message& msg,
+                                                  ContentCoding coding);
+    std::shared_ptr<const Variant> compressed_variant(const Message& request, const Message& msg,
+                                                      ContentCoding coding, int num_segments,
+                                                      const Response& response);
+    std::shared_ptr<const Variant> get(const std::string& key);
+    void insert(std::shared_ptr<const Variant> variant);
+};
+
+}
+}
@@ -0,0 +1,795 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "event_loop.hpp"
+#include "assert.hpp"
+#include "time.hpp"
+
+using namespace biohash;
+
+// A Poller waits for the readiness of the registered descriptors. The wake
+// descriptor is registered with a null handler.
+class EventLoop::Poller {
+public:
+    virtual ~Poller() = default;
+    virtual bool add(int fd, uint32_t events, Handler* handler, Mode mode) = 0;
+    virtual bool modify(int fd, uint32_t events, Handler* handler) = 0;
+    virtual void remove(int fd) = 0;
+    // Waits for events and calls 'dispatch(handler, events)' for each.
+    virtual void wait(int timeout_ms, EventLoop& loop) = 0;
+
+    virtual ssize_t read(int fd, char* buf, size_t size)
+    {
+        return ::read(fd, buf, size);
+    }
+
+    virtual int accept(int fd)
+    {
+        return accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    }
+};
+
+class EventLoop::EpollPoller final: public EventLoop::Poller {
+public:
+
+    EpollPoller()
+    {
+        m_fd = epoll_create1(EPOLL_CLOEXEC);
+        ASSERT(m_fd >= 0);
+    }
+
+    ~EpollPoller()
+    {
+        close(m_fd);
+    }
+
+    bool add(int fd, uint32_t events, Handler* handler, Mode) override
+    {
+        return control(EPOLL_CTL_ADD, fd, events, handler);
+    }
+
+    bool modify(int fd, uint32_t events, Handler* handler) override
+    {
+        return control(EPOLL_CTL_MOD, fd, events, handler);
+    }
+
+    void remove(int fd) override
+    {
+        epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void wait(int timeout_ms, EventLoop& loop) override
+    {
+        constexpr int max_events = 256;
+        struct epoll_event events[max_events];
+
+        int n = epoll_wait(m_fd, events, max_events, timeout_ms);
+        loop.m_now = time::monotonic_now();
+        for (int i = 0; i < n; ++i)
+            loop.dispatch(static_cast<Handler*>(events[i].data.ptr), events[i].events);
+    }
+
+private:
+
+    int m_fd;
+
+    bool control(int op, int fd, uint32_t events, Handler* handler)
+    {
+        struct epoll_event event {};
+        event.events = events;
+        event.data.ptr = handler;
+        return epoll_ctl(m_fd, op, fd, &event) == 0;
+    }
+};
+
+// The UringPoller keeps a multishot poll request per descriptor. The requests
+// are identified by their Registration, which lives until the request's last
+// completion has been seen, so completions of removed descriptors are
+// recognized and dropped.
+//
+// A stream socket also has a multishot recv request that selects buffers from
+// a ring registered with the kernel. The received bytes are copied out of the
+// buffer, which is returned to the ring at once, and are kept until read()
+// takes them, so that a slow reader cannot exhaust the ring. The recv request
+// is cancelled while more than max_received_size bytes are kept, and renewed
+// when they have been read. A listening socket has a multishot accept request
+// whose descriptors are kept until accept() takes them. The user_data of these
+// requests is the address of the Registration with the lowest bit set.
+class EventLoop::UringPoller final: public EventLoop::Poller {
+public:
+
+    // Returns null if io_uring or a feature it needs is not available.
+    static UringPoller* create()
+    {
+        std::unique_ptr<UringPoller> poller {new UringPoller};
+        if (!poller->setup())
+            return nullptr;
+        return poller.release();
+    }
+
+    ~UringPoller()
+    {
+        for (auto& entry: m_registrations) {
+            for (int accepted: entry.second->accepted)
+                close(accepted);
+            delete entry.second;
+        }
+        for (Registration* registration: m_removed)
+            delete registration;
+        for (Registration* registration: m_finished)
+            delete registration;
+        if (m_sqes)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring && m_cq_ring != m_sq_ring)
+            munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring)
+            munmap(m_sq_ring, m_sq_ring_size);
+        if (m_fd >= 0)
+            close(m_fd);
+        // The buffers are released after the requests that may fill them.
+        if (m_buffers) {
+            munmap(m_buffers, num_buffers * buffer_size);
+            munmap(m_buffer_ring, m_buffer_ring_size);
+        }
+    }
+
+    bool add(int fd, uint32_t events, Handler* handler, Mode mode) override
+    {
+        if (m_registrations.count(fd) != 0) {
+            errno = EEXIST;
+            return false;
+        }
+        Registration* registration = new Registration;
+        registration->fd = fd;
+        registration->events = events;
+        registration->handler = handler;
+        registration->mode = m_buffers ? mode : Mode::poll;
+        m_registrations.emplace(fd, registration);
+        submit_poll(registration);
+        if (registration->mode != Mode::poll)
+            submit_receive(registration);
+        return true;
+    }
+
+    bool modify(int fd, uint32_t events, Handler* handler) override
+    {
+        auto i = m_registrations.find(fd);
+        if (i == m_registrations.end()) {
+            errno = ENOENT;
+            return false;
+        }
+        Registration* registration = i->second;
+        registration->events = events;
+        registration->handler = handler;
+        if (!registration->armed) {
+            submit_poll(registration);
+            return true;
+        }
+        // The poll request is updated in place. If it has just ended, its
+        // last completion renews it with the new events.
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(registration);
+        sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = poll_events(*registration);
+        sqe->user_data = 0;
+        return true;
+    }
+
+    void remove(int fd) override
+    {
+        auto i = m_registrations.find(fd);
+        if (i == m_registrations.end())
+            return;
+        Registration* registration = i->second;
+        m_registrations.erase(i);
+        registration->active = false;
+        for (int accepted: registration->accepted)
+            close(accepted);
+        registration->accepted.clear();
+        if (registration->armed) {
+            struct io_uring_sqe* sqe = next_sqe();
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<uint64_t>(registration);
+            sqe->user_data = 0;
+        }
+        if (registration->receiving)
+            cancel_receive(registration);
+        if (registration->armed || registration->receiving)
+            m_removed.push_back(registration);
+        else
+            m_finished.push_back(registration);
+    }
+
+    ssize_t read(int fd, char* buf, size_t size) override
+    {
+        auto i = m_registrations.find(fd);
+        if (i == m_registrations.end() || i->second->mode != Mode::stream)
+            return ::read(fd, buf, size);
+        Registration& registration = *i->second;
+
+        std::string& received = registration.received;
+        size_t available = received.size() - registration.offset;
+        if (available > 0) {
+            size_t n = std::min(size, available);
+            memcpy(buf, received.data() + registration.offset, n);
+            registration.offset += n;
+            if (registration.offset == received.size()) {
+                registration.offset = 0;
+                if (received.capacity() > max_received_size)
+                    std::string {}.swap(received);
+                else
+                    received.clear();
+                resume(registration);
+            }
+            return static_cast<ssize_t>(n);
+        }
+        if (registration.eof)
+            return 0;
+        if (registration.error != 0) {
+            errno = registration.error;
+            return -1;
+        }
+        resume(registration);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int accept(int fd) override
+    {
+        auto i = m_registrations.find(fd);
+        if (i == m_registrations.end() || i->second->mode != Mode::listener)
+            return Poller::accept(fd);
+        Registration& registration = *i->second;
+
+        if (!registration.accepted.empty()) {
+            int accepted = registration.accepted.front();
+            registration.accepted.pop_front();
+            return accepted;
+        }
+        if (registration.error != 0) {
+            errno = registration.error;
+            registration.error = 0;
+            return -1;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    void wait(int timeout_ms, EventLoop& loop) override
+    {
+        struct __kernel_timespec ts {};
+        struct io_uring_getevents_arg arg {};
+        unsigned flags = IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+        if (cq_ready() == 0)
+            enter(m_to_submit, 1, flags, timeout_ms >= 0 ? &arg : nullptr);
+        else if (m_to_submit > 0)
+            enter(m_to_submit, 0, 0, nullptr);
+        loop.m_now = time::monotonic_now();
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe cqe = m_cqes[head & *m_cq_mask];
+            // Release the entry before dispatching, since handlers may queue
+            // new requests.
+            __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+            complete(cqe, loop);
+        }
+
+        // Registrations whose requests are known to have ended.
+        if (!m_finished.empty()) {
+            for (Registration* registration: m_finished)
+                delete registration;
+            m_finished.clear();
+        }
+    }
+
+private:
+
+    struct Registration {
+        int fd;
+        uint32_t events;
+        Handler* handler;
+        Mode mode;
+        bool active = true;
+        // Whether a poll request of this registration is in flight, and
+        // whether a recv or accept request, or the timeout before the accept
+        // request is renewed, is in flight.
+        bool armed = false;
+        bool receiving = false;
+        bool retrying = false;
+        // The recv request has been cancelled because too many bytes are
+        // kept.
+        bool paused = false;
+        // The received bytes from 'offset' on, followed by the end of the
+        // stream or an error.
+        std::string received;
+        size_t offset = 0;
+        bool eof = false;
+        int error = 0;
+        std::deque<int> accepted;
+    };
+
+    // The buffers of multishot recv requests.
+    static constexpr unsigned num_buffers = 32;
+    static constexpr size_t buffer_size = 16 * 1024;
+    static constexpr uint16_t buffer_group = 0;
+    // The received bytes kept per stream before its recv request is paused.
+    static constexpr size_t max_received_size = 256 * 1024;
+    // The delay before an accept request that failed, for instance for lack
+    // of descriptors, is renewed.
+    static constexpr long accept_retry_ns = 100 * 1000000L;
+
+    int m_fd = -1;
+    unsigned m_to_submit = 0;
+
+    // The ring of provided buffers, and the buffers, or null if the kernel
+    // does not support them.
+    struct io_uring_buf_ring* m_buffer_ring = nullptr;
+    size_t m_buffer_ring_size = 0;
+    char* m_buffers = nullptr;
+    uint16_t m_buffer_tail = 0;
+
+    void* m_sq_ring = nullptr;
+    size_t m_sq_ring_size = 0;
+    void* m_cq_ring = nullptr;
+    size_t m_cq_ring_size = 0;
+    struct io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqes_size = 0;
+
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned* m_sq_mask;
+    unsigned* m_sq_entries;
+    unsigned* m_sq_array;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned* m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+
+    std::unordered_map<int, Registration*> m_registrations;
+    // Removed registrations whose poll requests may still complete.
+    std::vector<Registration*> m_removed;
+    std::vector<Registration*> m_finished;
+
+    bool setup()
+    {
+        constexpr unsigned entries = 256;
+        struct io_uring_params params {};
+        m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0)
+            return false;
+        unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+        if ((params.features & required) != required)
+            return false;
+
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        void* ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (ring == MAP_FAILED)
+            return false;
+        m_sq_ring = m_cq_ring = ring;
+        m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+        char* sq = static_cast<char*>(m_sq_ring);
+        m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sq_entries = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+        m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(m_cq_ring);
+        m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        setup_buffers();
+        return true;
+    }
+
+    // Registers the ring of provided buffers. Without it, which requires
+    // Linux 5.19, all descriptors are polled.
+    void setup_buffers()
+    {
+        m_buffer_ring_size = num_buffers * sizeof(struct io_uring_buf);
+        void* ring = mmap(nullptr, m_buffer_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED)
+            return;
+        void* buffers = mmap(nullptr, num_buffers * buffer_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffers == MAP_FAILED) {
+            munmap(ring, m_buffer_ring_size);
+            return;
+        }
+
+        struct io_uring_buf_reg reg {};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = num_buffers;
+        reg.bgid = buffer_group;
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+            munmap(buffers, num_buffers * buffer_size);
+            munmap(ring, m_buffer_ring_size);
+            return;
+        }
+        m_buffer_ring = static_cast<struct io_uring_buf_ring*>(ring);
+        m_buffers = static_cast<char*>(buffers);
+        for (uint16_t id = 0; id < num_buffers; ++id)
+            provide_buffer(id);
+    }
+
+    // Returns a buffer to the ring.
+    void provide_buffer(uint16_t id)
+    {
+        // The entries start at the ring, which the 'bufs' member of the
+        // kernel header does not in C++, where its empty struct has a size.
+        struct io_uring_buf* bufs = reinterpret_cast<struct io_uring_buf*>(m_buffer_ring);
+        struct io_uring_buf& buf = bufs[m_buffer_tail & (num_buffers - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(m_buffers + id * buffer_size);
+        buf.len = buffer_size;
+        buf.bid = id;
+        ++m_buffer_tail;
+        __atomic_store_n(&m_buffer_ring->tail, m_buffer_tail, __ATOMIC_RELEASE);
+    }
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+              struct io_uring_getevents_arg* arg)
+    {
+        int rc;
+        do {
+            rc = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete,
+                                          flags, arg, arg ? sizeof *arg : 0));
+        } while (rc < 0 && errno == EINTR);
+        if (rc > 0)
+            m_to_submit -= std::min(m_to_submit, static_cast<unsigned>(rc));
+        return rc;
+    }
+
+    unsigned cq_ready() const
+    {
+        return __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) - *m_cq_head;
+    }
+
+    struct io_uring_sqe* next_sqe()
+    {
+        unsigned tail = *m_sq_tail;
+        if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == *m_sq_entries) {
+            enter(m_to_submit, 0, 0, nullptr);
+            ASSERT(*m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) < *m_sq_entries);
+        }
+        unsigned index = tail & *m_sq_mask;
+        struct io_uring_sqe* sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof *sqe);
+        m_sq_array[index] = index;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++m_to_submit;
+        return sqe;
+    }
+
+    // The events of the poll request. Those of received bytes are reported
+    // by the recv request.
+    static uint32_t poll_events(const Registration& registration)
+    {
+        if (registration.mode == Mode::stream)
+            return registration.events & ~uint32_t(EPOLLIN | EPOLLRDHUP);
+        if (registration.mode == Mode::listener)
+            return registration.events & ~uint32_t(EPOLLIN);
+        return registration.events;
+    }
+
+    void submit_poll(Registration* registration)
+    {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = registration->fd;
+        sqe->poll32_events = poll_events(*registration);
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = reinterpret_cast<uint64_t>(registration);
+        registration->armed = true;
+    }
+
+    void submit_receive(Registration* registration)
+    {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->fd = registration->fd;
+        if (registration->mode == Mode::stream) {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = buffer_group;
+        }
+        else {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        }
+        sqe->user_data = reinterpret_cast<uint64_t>(registration) | 1;
+        registration->receiving = true;
+    }
+
+    void cancel_receive(Registration* registration)
+    {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(registration) | 1;
+        sqe->user_data = 0;
+    }
+
+    // Renews the recv request of a paused stream once its bytes have been
+    // read.
+    void resume(Registration& registration)
+    {
+        if (!registration.paused)
+            return;
+        registration.paused = false;
+        if (!registration.receiving && !registration.eof && registration.error == 0)
+            submit_receive(&registration);
+    }
+
+    void complete(const struct io_uring_cqe& cqe, EventLoop& loop)
+    {
+        // The completions of POLL_REMOVE and ASYNC_CANCEL carry no
+        // registration.
+        if (cqe.user_data == 0)
+            return;
+        if (cqe.user_data & 1)
+            return complete_receive(cqe, loop);
+        Registration* registration = reinterpret_cast<Registration*>(cqe.user_data);
+        bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+        if (!more)
+            registration->armed = false;
+
+        if (!registration->active) {
+            if (!registration->armed && !registration->receiving)
+                finish(registration);
+            return;
+        }
+        if (!more) {
+            // The multishot request has ended, for instance because the
+            // completion queue was full, and is renewed.
+            if (cqe.res < 0 && cqe.res != -ECANCELED && cqe.res != -ENOBUFS) {
+                loop.dispatch(registration->handler, EPOLLERR);
+                return;
+            }
+            submit_poll(registration);
+        }
+        if (cqe.res > 0)
+            loop.dispatch(registration->handler, static_cast<uint32_t>(cqe.res));
+    }
+
+    void complete_receive(const struct io_uring_cqe& cqe, EventLoop& loop)
+    {
+        Registration* registration = reinterpret_cast<Registration*>(cqe.user_data & ~uint64_t(1));
+        bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+        if (!more)
+            registration->receiving = false;
+
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (registration->active && cqe.res > 0)
+                registration->received.append(m_buffers + id * buffer_size,
+                                              static_cast<size_t>(cqe.res));
+            provide_buffer(id);
+        }
+        if (!registration->active) {
+            if (cqe.res >= 0 && registration->mode == Mode::listener)
+                close(cqe.res);
+            if (!registration->armed && !registration->receiving)
+                finish(registration);
+            return;
+        }
+
+        if (registration->retrying) {
+            registration->retrying = false;
+            submit_receive(registration);
+            return;
+        }
+        if (cqe.res == -EINVAL && registration->received.empty() &&
+            registration->accepted.empty()) {
+            // The kernel does not support the multishot request, and the
+            // descriptor is polled instead.
+            registration->mode = Mode::poll;
+            modify(registration->fd, registration->events, registration->handler);
+            return;
+        }
+
+        bool report = true;
+        if (registration->mode == Mode::listener) {
+            if (cqe.res >= 0) {
+                registration->accepted.push_back(cqe.res);
+                if (!more)
+                    submit_receive(registration);
+            }
+            else if (!more) {
+                registration->error = -cqe.res;
+                // The timeout renews the accept request.
+                static const struct __kernel_timespec delay {0, accept_retry_ns};
+                struct io_uring_sqe* sqe = next_sqe();
+                sqe->opcode = IORING_OP_TIMEOUT;
+                sqe->fd = -1;
+                sqe->addr = reinterpret_cast<uint64_t>(&delay);
+                sqe->len = 1;
+                sqe->user_data = cqe.user_data;
+                registration->receiving = true;
+                registration->retrying = true;
+            }
+        }
+        else {
+            if (cqe.res == 0)
+                registration->eof = true;
+            else if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED)
+                report = false;
+            else if (cqe.res < 0)
+                registration->error = -cqe.res;
+
+            size_t kept = registration->received.size() - registration->offset;
+            if (kept > max_received_size && !registration->paused) {
+                registration->paused = true;
+                if (more)
+                    cancel_receive(registration);
+            }
+            else if (!more && !registration->paused && !registration->eof &&
+                     registration->error == 0) {
+                // The request has ended, for instance because the ring ran
+                // out of buffers, and is renewed.
+                submit_receive(registration);
+            }
+        }
+        if (report)
+            loop.dispatch(registration->handler, EPOLLIN);
+    }
+
+    void finish(Registration* registration)
+    {
+        for (size_t i = 0; i < m_removed.size(); ++i) {
+            if (m_removed[i] == registration) {
+                m_removed[i] = m_removed.back();
+                m_removed.pop_back();
+                break;
+            }
+        }
+        m_finished.push_back(registration);
+    }
+};
+
+EventLoop::EventLoop(Backend backend)
+{
+    if (backend == Backend::io_uring)
+        m_poller.reset(UringPoller::create());
+    m_backend = m_poller ? Backend::io_uring : Backend::epoll;
+    if (!m_poller)
+        m_poller.reset(new EpollPoller);
+
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ASSERT(m_wake_fd >= 0);
+    bool rc = m_poller->add(m_wake_fd, EPOLLIN | EPOLLET, nullptr, Mode::poll);
+    ASSERT(rc);
+
+    m_now = time::monotonic_now();
+}
+
+EventLoop::~EventLoop()
+{
+    m_poller.reset();
+    close(m_wake_fd);
+}
+
+EventLoop::Backend EventLoop::backend() const
+{
+    return m_backend;
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler& handler, Mode mode)
+{
+    return m_poller->add(fd, events, &handler, mode);
+}
+
+bool EventLoop::modify(int fd, uint32_t events, Handler& handler)
+{
+    return m_poller->modify(fd, events, &handler);
+}
+
+void EventLoop::remove(int fd)
+{
+    m_poller->remove(fd);
+}
+
+ssize_t EventLoop::read(int fd, char* buf, size_t size)
+{
+    return m_poller->read(fd, buf, size);
+}
+
+int EventLoop::accept(int fd)
+{
+    return m_poller->accept(fd);
+}
+
+void EventLoop::run()
+{
+    while (!m_stop.load(std::memory_order_acquire))
+        run_once(-1);
+    m_stop.store(false, std::memory_order_relaxed);
+}
+
+void EventLoop::run_once(int timeout_ms)
+{
+    m_poller->wait(timeout_ms, *this);
+    run_posted();
+}
+
+void EventLoop::stop()
+{
+    m_stop.store(true, std::memory_order_release);
+    wake();
+}
+
+void EventLoop::post(std::function<void()> func)
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_posted.push_back(std::move(func));
+    }
+    wake();
+}
+
+int_fast64_t EventLoop::now() const
+{
+    return m_now;
+}
+
+void EventLoop::dispatch(Handler* handler, uint32_t events)
+{
+    if (handler) {
+        handler->on_event(events);
+        return;
+    }
+    // The posted functions are called after the other events.
+    uint64_t count;
+    ssize_t rc = ::read(m_wake_fd, &count, sizeof count);
+    static_cast<void>(rc);
+}
+
+void EventLoop::wake()
+{
+    uint64_t one = 1;
+    ssize_t rc = write(m_wake_fd, &one, sizeof one);
+    static_cast<void>(rc);
+}
+
+void EventLoop::run_posted()
+{
+    std::vector<std::function<void()>> posted;
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        posted.swap(m_posted);
+    }
+    for (auto& func: posted)
+        func();
+}
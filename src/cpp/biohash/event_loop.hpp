@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace biohash {
+
+// An EventLoop is a reactor around epoll or io_uring. File descriptors are
+// added with a Handler whose on_event() is called with the epoll events when
+// the descriptor is ready. Handlers are meant for edge-triggered registrations
+// (EPOLLET), for which epoll reports a descriptor at most once per wakeup. A
+// handler may therefore remove and destroy itself in on_event(), but not other
+// handlers of the same loop.
+//
+// The loop runs on one thread. Only stop() and post() may be called from
+// other threads.
+//
+// With the io_uring backend, every descriptor has a multishot poll request
+// whose completions are dispatched like epoll events. Stream sockets and
+// listening sockets added with Mode::stream and Mode::listener are read and
+// accepted by multishot recv and accept requests instead, and their handlers
+// take the results with read() and accept(). Registrations and waiting are
+// batched into one io_uring_enter() per iteration. If io_uring is not
+// available, the loop falls back to epoll.
+class EventLoop {
+public:
+
+    enum class Backend {
+        epoll,
+        io_uring
+    };
+
+    // How a descriptor is read. EPOLLIN of a stream or listening socket is
+    // reported when read() or accept() have something to return.
+    enum class Mode {
+        poll,
+        stream,
+        listener
+    };
+
+    class Handler {
+    public:
+        virtual void on_event(uint32_t events) = 0;
+
+    protected:
+        ~Handler() = default;
+    };
+
+    EventLoop(Backend backend = Backend::epoll);
+    ~EventLoop();
+
+    // The backend in use, which is epoll if io_uring was requested but is
+    // not supported.
+    Backend backend() const;
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // The functions return false, with errno set, if the registration fails.
+    bool add(int fd, uint32_t events, Handler& handler, Mode mode = Mode::poll);
+    bool modify(int fd, uint32_t events, Handler& handler);
+    void remove(int fd);
+
+    // Like read() and accept4() with SOCK_NONBLOCK | SOCK_CLOEXEC, for
+    // descriptors added with Mode::stream and Mode::listener. They fail with
+    // EAGAIN if nothing has been received or accepted yet.
+    ssize_t read(int fd, char* buf, size_t size);
+    int accept(int fd);
+
+    // Runs the loop until stop() is called.
+    void run();
+
+    // Waits at most 'timeout_ms' milliseconds, or indefinitely if negative,
+    // for events and dispatches them.
+    void run_once(int timeout_ms);
+
+    // Makes run() return after the current iteration.
+    void stop();
+
+    // Calls 'func' on the loop's thread after the events of an iteration
+    // have been dispatched, of the current iteration if called by a handler.
+    // Handlers may thus defer the destruction of other handlers with post().
+    void post(std::function<void()> func);
+
+    // The time of time::monotonic_now() when the loop last woke up.
+    int_fast64_t now() const;
+
+private:
+
+    class Poller;
+    class EpollPoller;
+    class UringPoller;
+
+    std::unique_ptr<Poller> m_poller;
+    Backend m_backend;
+    // An eventfd that wakes the loop for stop() and post().
+    int m_wake_fd;
+    std::atomic<bool> m_stop {false};
+    int_fast64_t m_now;
+
+    std::mutex m_mutex;
+    std::vector<std::function<void()>> m_posted;
+
+    void dispatch(Handler* handler, uint32_t events);
+    void wake();
+    void run_posted();
+};
+
+}
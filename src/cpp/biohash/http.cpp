@@ -2,12 +2,87 @@
 #include <strings.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <algorithm>
+#include <sys/uio.h>
 
 #include "http.hpp"
 #include "assert.hpp"
+#include "time.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BIOHASH_HTTP_X86 1
+#include <immintrin.h>
+#endif
 
 using namespace biohash;
 
+namespace {
+
+// The delimiter scanners return a pointer to the first byte in [begin, end)
+// that equals 'a' or 'b', or end if there is none. The vector versions
+// compare 16 or 32 bytes at a time and leave the tail to the scalar loop.
+
+const char* find_delimiter_scalar(const char* begin, const char* end, char a, char b)
+{
+    while (begin != end && *begin != a && *begin != b)
+        ++begin;
+    return begin;
+}
+
+#ifdef BIOHASH_HTTP_X86
+
+// SSE2 is part of x86-64.
+const char* find_delimiter_sse2(const char* begin, const char* end, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    while (end - begin >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq));
+        if (mask)
+            return begin + __builtin_ctz(mask);
+        begin += 16;
+    }
+    return find_delimiter_scalar(begin, end, a, b);
+}
+
+__attribute__((target("avx2")))
+const char* find_delimiter_avx2(const char* begin, const char* end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    while (end - begin >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+        if (mask)
+            return begin + __builtin_ctz(mask);
+        begin += 32;
+    }
+    return find_delimiter_sse2(begin, end, a, b);
+}
+
+#endif // BIOHASH_HTTP_X86
+
+using FindDelimiter = const char* (*)(const char*, const char*, char, char);
+
+FindDelimiter select_find_delimiter()
+{
+#ifdef BIOHASH_HTTP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return find_delimiter_avx2;
+    return find_delimiter_sse2;
+#else
+    return find_delimiter_scalar;
+#endif
+}
+
+const FindDelimiter find_delimiter = select_find_delimiter();
+
+} // anonymous namespace
+
 const char* http::method_str(Method method)
 {
     switch (method) {
@@ -30,57 +105,539 @@ const char* http::method_str(Method method)
     }
 }
 
+namespace {
+
+constexpr const char* header_names[http::num_known_headers] = {
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Ranges",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Cookie",
+    "Date",
+    "ETag",
+    "Expect",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Keep-Alive",
+    "Last-Modified",
+    "Location",
+    "Origin",
+    "Range",
+    "Sec-WebSocket-Accept",
+    "Sec-WebSocket-Key",
+    "Sec-WebSocket-Protocol",
+    "Sec-WebSocket-Version",
+    "Server",
+    "Set-Cookie",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+    "Vary",
+    "X-Forwarded-For",
+    "X-Request-Id",
+};
+
+constexpr size_t header_table_size = 128;
+
+constexpr char fold_case(char ch)
+{
+    return (ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch;
+}
+
+// The multipliers are chosen such that the known header names do not
+// collide, which is checked at compile time below.
+constexpr size_t header_hash(const char* name, size_t size)
+{
+    return (size + 2 * size_t(fold_case(name[0])) + 31 * size_t(fold_case(name[size - 1])) +
+            size_t(fold_case(name[size / 2]))) % header_table_size;
+}
+
+constexpr size_t const_strlen(const char* str)
+{
+    size_t size = 0;
+    while (str[size])
+        ++size;
+    return size;
+}
+
+struct HeaderTable {
+    // One plus the Header of each slot, or zero.
+    uint_least8_t slots[header_table_size] = {};
+    bool perfect = true;
+};
+
+constexpr HeaderTable make_header_table()
+{
+    HeaderTable table;
+    for (size_t i = 0; i < http::num_known_headers; ++i) {
+        const char* name = header_names[i];
+        size_t slot = header_hash(name, const_strlen(name));
+        if (table.slots[slot] != 0)
+            table.perfect = false;
+        table.slots[slot] = static_cast<uint_least8_t>(i + 1);
+    }
+    return table;
+}
+
+constexpr HeaderTable header_table = make_header_table();
+static_assert(header_table.perfect, "header_hash() must not collide on the known headers");
+
+} // anonymous namespace
+
+bool http::has_token(std::string_view list, std::string_view token)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view element = list.substr(0, comma);
+        while (!element.empty() && (element.front() == ' ' || element.front() == '\t'))
+            element.remove_prefix(1);
+        while (!element.empty() && (element.back() == ' ' || element.back() == '\t'))
+            element.remove_suffix(1);
+        if (element.size() == token.size() &&
+            strncasecmp(element.data(), token.data(), token.size()) == 0)
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+http::RequestTarget http::split_request_target(std::string_view target)
+{
+    if (!target.empty() && target[0] != '/' && target[0] != '*') {
+        // absolute-form = scheme "://" authority path-abempty [ "?" query ]
+        size_t scheme_end = target.find("://");
+        if (scheme_end != std::string_view::npos && target.find('/') > scheme_end) {
+            size_t path = target.find_first_of("/?#", scheme_end + 3);
+            target.remove_prefix(path == std::string_view::npos ? target.size() : path);
+        }
+    }
+
+    RequestTarget parts;
+    const char* begin = target.data();
+    const char* end = begin + target.size();
+    const char* delimiter = find_delimiter(begin, end, '?', '#');
+    parts.path = std::string_view {begin, size_t(delimiter - begin)};
+    if (delimiter != end && *delimiter == '?') {
+        const char* query = delimiter + 1;
+        delimiter = find_delimiter(query, end, '#', '#');
+        parts.query = std::string_view {query, size_t(delimiter - query)};
+    }
+    if (delimiter != end)
+        parts.fragment = std::string_view {delimiter + 1, size_t(end - delimiter - 1)};
+    return parts;
+}
+
+http::QueryIterator::QueryIterator(std::string_view query):
+    m_rest {query}
+{
+}
+
+bool http::QueryIterator::next(std::string_view& name, std::string_view& value)
+{
+    while (!m_rest.empty()) {
+        size_t amp = m_rest.find('&');
+        std::string_view pair = m_rest.substr(0, amp);
+        m_rest.remove_prefix(amp == std::string_view::npos ? m_rest.size() : amp + 1);
+        if (pair.empty())
+            continue;
+        size_t equals = pair.find('=');
+        name = pair.substr(0, equals);
+        value = equals == std::string_view::npos ? pair.substr(pair.size()) :
+            pair.substr(equals + 1);
+        return true;
+    }
+    return false;
+}
+
+std::string_view http::query_param(std::string_view query, std::string_view name)
+{
+    QueryIterator it {query};
+    std::string_view pair_name, pair_value;
+    while (it.next(pair_name, pair_value)) {
+        if (pair_name == name)
+            return pair_value;
+    }
+    return {};
+}
+
+bool http::percent_decode(const char* data, size_t size, char* out, size_t& out_size,
+                          bool plus_as_space)
+{
+    auto hex_value = [](char ch) {
+        if (ch >= '0' && ch <= '9')
+            return ch - '0';
+        if (ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F')
+            return ch - 'A' + 10;
+        return -1;
+    };
+
+    const char* end = data + size;
+    char* dst = out;
+    const char plus = plus_as_space ? '+' : '%';
+    for (;;) {
+        const char* special = find_delimiter(data, end, '%', plus);
+        size_t run = size_t(special - data);
+        // Nothing moves in place before the first escape.
+        if (dst != data)
+            memmove(dst, data, run);
+        dst += run;
+        data = special;
+        if (data == end)
+            break;
+
+        if (*data == '+') {
+            *dst++ = ' ';
+            ++data;
+            continue;
+        }
+        int high = end - data >= 3 ? hex_value(data[1]) : -1;
+        int low = end - data >= 3 ? hex_value(data[2]) : -1;
+        if (high < 0 || low < 0)
+            return false;
+        *dst++ = static_cast<char>(high << 4 | low);
+        data += 3;
+    }
+    out_size = size_t(dst - out);
+    return true;
+}
+
+http::RangeStatus http::parse_range(std::string_view value, uint_least64_t size,
+                                    ByteRange* ranges, size_t& num_ranges)
+{
+    num_ranges = 0;
+    if (value.size() < 6 || strncasecmp(value.data(), "bytes=", 6) != 0)
+        return RangeStatus::Invalid;
+    value.remove_prefix(6);
+
+    // Parses the digits at the start of 'spec'.
+    auto parse_number = [](std::string_view& spec, uint_least64_t& number) {
+        size_t i = 0;
+        number = 0;
+        while (i < spec.size() && spec[i] >= '0' && spec[i] <= '9') {
+            uint_least64_t digit = uint_least64_t(spec[i] - '0');
+            if (number > (UINT_LEAST64_MAX - digit) / 10)
+                return false;
+            number = 10 * number + digit;
+            ++i;
+        }
+        spec.remove_prefix(i);
+        return i > 0;
+    };
+
+    size_t num_specs = 0;
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view spec = value.substr(0, comma);
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+        while (!spec.empty() && (spec.front() == ' ' || spec.front() == '\t'))
+            spec.remove_prefix(1);
+        while (!spec.empty() && (spec.back() == ' ' || spec.back() == '\t'))
+            spec.remove_suffix(1);
+        // Empty list elements are allowed.
+        if (spec.empty())
+            continue;
+        if (++num_specs > max_byte_ranges)
+            return RangeStatus::Invalid;
+
+        ByteRange range;
+        if (spec[0] == '-') {
+            // suffix-range = "-" suffix-length
+            uint_least64_t suffix;
+            spec.remove_prefix(1);
+            if (!parse_number(spec, suffix) || !spec.empty())
+                return RangeStatus::Invalid;
+            if (suffix == 0 || size == 0)
+                continue;
+            range.first = suffix < size ? size - suffix : 0;
+            range.last = size - 1;
+        }
+        else {
+            // int-range = first-pos "-" [ last-pos ]
+            if (!parse_number(spec, range.first) || spec.empty() || spec[0] != '-')
+                return RangeStatus::Invalid;
+            spec.remove_prefix(1);
+            if (spec.empty())
+                range.last = UINT_LEAST64_MAX;
+            else if (!parse_number(spec, range.last) || !spec.empty() || range.last < range.first)
+                return RangeStatus::Invalid;
+            if (range.first >= size)
+                continue;
+            range.last = std::min(range.last, size - 1);
+        }
+        ranges[num_ranges++] = range;
+    }
+
+    if (num_specs == 0)
+        return RangeStatus::Invalid;
+    return num_ranges == 0 ? RangeStatus::Unsatisfiable : RangeStatus::Satisfiable;
+}
+
+const char* http::content_coding_name(ContentCoding coding)
+{
+    switch (coding) {
+        case ContentCoding::identity:
+            return "identity";
+        case ContentCoding::gzip:
+            return "gzip";
+        case ContentCoding::deflate:
+            return "deflate";
+    }
+    ASSERT(false);
+    return nullptr;
+}
+
+namespace {
+
+// Parses a weight, OWS "q=" qvalue, into thousandths.
+bool parse_weight(std::string_view weight, int& q)
+{
+    while (!weight.empty() && (weight.front() == ' ' || weight.front() == '\t'))
+        weight.remove_prefix(1);
+    if (weight.size() < 3 || (weight[0] != 'q' && weight[0] != 'Q') || weight[1] != '=' ||
+        (weight[2] != '0' && weight[2] != '1'))
+        return false;
+    q = 1000 * (weight[2] - '0');
+    weight.remove_prefix(3);
+    if (weight.empty())
+        return true;
+    if (weight[0] != '.' || weight.size() > 4)
+        return false;
+    int scale = 100;
+    for (char ch: weight.substr(1)) {
+        if (ch < '0' || ch > '9')
+            return false;
+        q += scale * (ch - '0');
+        scale /= 10;
+    }
+    return q <= 1000;
+}
+
+} // anonymous namespace
+
+http::ContentCoding http::negotiate_content_coding(std::string_view accept_encoding)
+{
+    // The qvalues in thousandths, or -1 if not listed.
+    int gzip = -1;
+    int deflate = -1;
+    int any = -1;
+    while (!accept_encoding.empty()) {
+        size_t comma = accept_encoding.find(',');
+        std::string_view element = accept_encoding.substr(0, comma);
+        accept_encoding.remove_prefix(comma == std::string_view::npos ?
+                                      accept_encoding.size() : comma + 1);
+        size_t semicolon = element.find(';');
+        std::string_view coding = element.substr(0, semicolon);
+        while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t'))
+            coding.remove_prefix(1);
+        while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t'))
+            coding.remove_suffix(1);
+        int q = 1000;
+        // Elements with an invalid weight are ignored.
+        if (semicolon != std::string_view::npos &&
+            !parse_weight(element.substr(semicolon + 1), q))
+            continue;
+        if (has_token(coding, "gzip") || has_token(coding, "x-gzip"))
+            gzip = q;
+        else if (has_token(coding, "deflate"))
+            deflate = q;
+        else if (coding == "*")
+            any = q;
+    }
+    if (gzip < 0)
+        gzip = any;
+    if (deflate < 0)
+        deflate = any;
+    if (gzip > 0 && gzip >= deflate)
+        return ContentCoding::gzip;
+    if (deflate > 0)
+        return ContentCoding::deflate;
+    return ContentCoding::identity;
+}
+
+const char* http::header_name(Header header)
+{
+    ASSERT(header != Header::Unknown);
+    return header_names[static_cast<size_t>(header)];
+}
+
+http::Header http::header_from_name(std::string_view name)
+{
+    if (name.empty())
+        return Header::Unknown;
+    uint_least8_t slot = header_table.slots[header_hash(name.data(), name.size())];
+    if (slot == 0)
+        return Header::Unknown;
+    const char* candidate = header_names[slot - 1];
+    if (strlen(candidate) != name.size() ||
+        strncasecmp(candidate, name.data(), name.size()) != 0)
+        return Header::Unknown;
+    return static_cast<Header>(slot - 1);
+}
+
+// The standard status codes of the IANA HTTP Status Code Registry.
+#define BIOHASH_HTTP_STATUS_CODES(X) \
+    X(100, "Continue") \
+    X(101, "Switching Protocols") \
+    X(102, "Processing") \
+    X(103, "Early Hints") \
+    X(200, "OK") \
+    X(201, "Created") \
+    X(202, "Accepted") \
+    X(203, "Non-Authoritative Information") \
+    X(204, "No Content") \
+    X(205, "Reset Content") \
+    X(206, "Partial Content") \
+    X(207, "Multi-Status") \
+    X(208, "Already Reported") \
+    X(226, "IM Used") \
+    X(300, "Multiple Choices") \
+    X(301, "Moved Permanently") \
+    X(302, "Found") \
+    X(303, "See Other") \
+    X(304, "Not Modified") \
+    X(305, "Use Proxy") \
+    X(307, "Temporary Redirect") \
+    X(308, "Permanent Redirect") \
+    X(400, "Bad Request") \
+    X(401, "Unauthorized") \
+    X(402, "Payment Required") \
+    X(403, "Forbidden") \
+    X(404, "Not Found") \
+    X(405, "Method Not Allowed") \
+    X(406, "Not Acceptable") \
+    X(407, "Proxy Authentication Required") \
+    X(408, "Request Timeout") \
+    X(409, "Conflict") \
+    X(410, "Gone") \
+    X(411, "Length Required") \
+    X(412, "Precondition Failed") \
+    X(413, "Content Too Large") \
+    X(414, "URI Too Long") \
+    X(415, "Unsupported Media Type") \
+    X(416, "Range Not Satisfiable") \
+    X(417, "Expectation Failed") \
+    X(421, "Misdirected Request") \
+    X(422, "Unprocessable Content") \
+    X(423, "Locked") \
+    X(424, "Failed Dependency") \
+    X(425, "Too Early") \
+    X(426, "Upgrade Required") \
+    X(428, "Precondition Required") \
+    X(429, "Too Many Requests") \
+    X(431, "Request Header Fields Too Large") \
+    X(451, "Unavailable For Legal Reasons") \
+    X(500, "Internal Server Error") \
+    X(501, "Not Implemented") \
+    X(502, "Bad Gateway") \
+    X(503, "Service Unavailable") \
+    X(504, "Gateway Timeout") \
+    X(505, "HTTP Version Not Supported") \
+    X(506, "Variant Also Negotiates") \
+    X(507, "Insufficient Storage") \
+    X(508, "Loop Detected") \
+    X(510, "Not Extended") \
+    X(511, "Network Authentication Required")
+
 const char* http::reason_phrase(int status_code)
 {
     switch(status_code) {
-        case 101:
-            return "Switching Protocols";
-        case 200:
-            return "OK";
-        case 400:
-            return "Bad Request";
-        case 401:
-            return "Unauthorized";
-        case 404:
-            return "Not Found";
-        case 503:
-            return "Service Unavailable";
+#define X(code, reason) case code: return reason;
+        BIOHASH_HTTP_STATUS_CODES(X)
+#undef X
         default:
-            ASSERT(false);
-            return nullptr;
+            return "";
+    }
+}
+
+std::string_view http::status_line(int status_code)
+{
+    ASSERT(status_code >= 100 && status_code <= 999);
+    switch(status_code) {
+#define X(code, reason) case code: return "HTTP/1.1 " #code " " reason "\r\n";
+        BIOHASH_HTTP_STATUS_CODES(X)
+#undef X
+        default:
+            return std::string_view {};
     }
 }
 
 size_t http::write_request_line(char* buf, size_t size, Method method,
                                 const char* request_target)
 {
-   const char* meth = method_str(method);
+    const char* meth = method_str(method);
+    size_t meth_size = strlen(meth);
+    size_t request_target_size = strlen(request_target);
+    size_t line_size = meth_size + request_target_size + 12;
+    if (size < line_size)
+        return line_size;
 
-   size_t rc = static_cast<size_t>(snprintf(buf, size, "%s %s HTTP/1.1\r",
-                                            meth, request_target));
-   if (rc < size)
-       buf[rc] = '\n';
-   return rc + 1;
+    memcpy(buf, meth, meth_size);
+    buf += meth_size;
+    *buf++ = ' ';
+    memcpy(buf, request_target, request_target_size);
+    buf += request_target_size;
+    memcpy(buf, " HTTP/1.1\r\n", 11);
+    return line_size;
 }
 
 size_t http::write_status_line(char* buf, size_t size, int status_code)
 {
-    int status = static_cast<int>(status_code);
-    const char* reason = reason_phrase(status_code);
-    size_t rc = static_cast<size_t>(snprintf(buf, size, "HTTP/1.1 %i %s\r",
-                                             status, reason));
+    std::string_view line = status_line(status_code);
+    if (!line.empty()) {
+        if (line.size() <= size)
+            memcpy(buf, line.data(), line.size());
+        return line.size();
+    }
 
-    if (rc < size)
-        buf[rc] = '\n';
-    return rc + 1;
+    // An unregistered status code has an empty reason phrase.
+    if (size >= 15) {
+        memcpy(buf, "HTTP/1.1 ", 9);
+        buf[9] = static_cast<char>('0' + status_code / 100);
+        buf[10] = static_cast<char>('0' + status_code / 10 % 10);
+        buf[11] = static_cast<char>('0' + status_code % 10);
+        memcpy(buf + 12, " \r\n", 3);
+    }
+    return 15;
 }
 
 size_t http::write_header(char* buf, size_t size, const char* name, const char* value)
 {
-    size_t rc = static_cast<size_t>(snprintf(buf, size, "%s: %s\r", name, value));
-    if (rc < size)
-        buf[rc] = '\n';
-    return rc + 1;
+    return write_header(buf, size, std::string_view {name}, std::string_view {value});
+}
+
+size_t http::write_header(char* buf, size_t size, std::string_view name, std::string_view value)
+{
+    size_t line_size = name.size() + value.size() + 4;
+    if (size < line_size)
+        return line_size;
+
+    memcpy(buf, name.data(), name.size());
+    buf += name.size();
+    *buf++ = ':';
+    *buf++ = ' ';
+    memcpy(buf, value.data(), value.size());
+    buf += value.size();
+    *buf++ = '\r';
+    *buf = '\n';
+    return line_size;
+}
+
+size_t http::write_date_header(char* buf, size_t size)
+{
+    return write_header(buf, size, std::string_view {"Date"},
+                        std::string_view {time::cached_http_date(), time::http_date_size});
 }
 
 size_t http::write_header_end(char* buf, size_t size)
@@ -92,24 +649,274 @@ size_t http::write_header_end(char* buf, size_t size)
     return 2;
 }
 
+size_t http::write_chunk_header(char* buf, size_t size, size_t chunk_size)
+{
+    ASSERT(chunk_size > 0);
+    size_t num_digits = 0;
+    for (size_t n = chunk_size; n != 0; n >>= 4)
+        ++num_digits;
+    size_t line_size = num_digits + 2;
+    if (size < line_size)
+        return line_size;
+    const char* hex = "0123456789abcdef";
+    for (size_t i = 0; i < num_digits; ++i) {
+        buf[num_digits - 1 - i] = hex[chunk_size & 0xf];
+        chunk_size >>= 4;
+    }
+    buf[num_digits] = '\r';
+    buf[num_digits + 1] = '\n';
+    return line_size;
+}
+
+size_t http::write_chunk(char* buf, size_t size, const char* data, size_t data_size)
+{
+    size_t header_size = write_chunk_header(buf, size, data_size);
+    size_t chunk_size = header_size + data_size + 2;
+    if (size < chunk_size)
+        return chunk_size;
+    memcpy(buf + header_size, data, data_size);
+    write_header_end(buf + header_size + data_size, 2);
+    return chunk_size;
+}
+
+size_t http::write_last_chunk(char* buf, size_t size)
+{
+    if (size >= 3)
+        memcpy(buf, "0\r\n", 3);
+    return 3;
+}
+
+bool http::ResponseBuilder::status(int status_code)
+{
+    char line[64];
+    size_t line_size = write_status_line(line, sizeof line, status_code);
+    ASSERT(line_size <= sizeof line);
+    char* dst = reserve(line_size);
+    if (!dst)
+        return false;
+    memcpy(dst, line, line_size);
+    return true;
+}
+
+bool http::ResponseBuilder::header(std::string_view name, std::string_view value)
+{
+    size_t line_size = name.size() + value.size() + 4;
+    char* dst = reserve(line_size);
+    if (!dst)
+        return false;
+    write_header(dst, line_size, name, value);
+    return true;
+}
+
+bool http::ResponseBuilder::header(Header header, std::string_view value)
+{
+    return this->header(std::string_view {header_name(header)}, value);
+}
+
+bool http::ResponseBuilder::content_length(uint_least64_t content_length)
+{
+    char digits[20];
+    size_t num_digits = 0;
+    do {
+        digits[sizeof digits - 1 - num_digits++] = static_cast<char>('0' + content_length % 10);
+        content_length /= 10;
+    } while (content_length != 0);
+    std::string_view value {digits + sizeof digits - num_digits, num_digits};
+    return header(Header::ContentLength, value);
+}
+
+bool http::ResponseBuilder::date()
+{
+    return header(Header::Date, std::string_view {time::cached_http_date(), time::http_date_size});
+}
+
+bool http::ResponseBuilder::header_block(std::string_view block)
+{
+    return reference(block.data(), block.size());
+}
+
+bool http::ResponseBuilder::end_header()
+{
+    char* dst = reserve(2);
+    if (!dst)
+        return false;
+    write_header_end(dst, 2);
+    return true;
+}
+
+bool http::ResponseBuilder::body(const char* data, size_t size)
+{
+    return reference(data, size);
+}
+
+const iovec* http::ResponseBuilder::segments() const
+{
+    return m_segments + m_first_segment;
+}
+
+int http::ResponseBuilder::num_segments() const
+{
+    return static_cast<int>(m_num_segments - m_first_segment);
+}
+
+size_t http::ResponseBuilder::size() const
+{
+    size_t size = 0;
+    for (size_t i = m_first_segment; i < m_num_segments; ++i)
+        size += m_segments[i].iov_len;
+    return size;
+}
+
+ssize_t http::ResponseBuilder::write(int fd)
+{
+    if (m_first_segment == m_num_segments)
+        return 0;
+    ssize_t rc = writev(fd, segments(), num_segments());
+    if (rc > 0)
+        consume(static_cast<size_t>(rc));
+    return rc;
+}
+
+void http::ResponseBuilder::consume(size_t size)
+{
+    while (size > 0) {
+        ASSERT(m_first_segment < m_num_segments);
+        iovec& segment = m_segments[m_first_segment];
+        if (size < segment.iov_len) {
+            segment.iov_base = static_cast<char*>(segment.iov_base) + size;
+            segment.iov_len -= size;
+            return;
+        }
+        size -= segment.iov_len;
+        ++m_first_segment;
+    }
+}
+
+void http::ResponseBuilder::reset()
+{
+    m_buf_size = 0;
+    m_first_segment = 0;
+    m_num_segments = 0;
+    m_last_copied = false;
+}
+
+char* http::ResponseBuilder::reserve(size_t size)
+{
+    if (size > buffer_size - m_buf_size)
+        return nullptr;
+    char* dst = m_buf + m_buf_size;
+
+    // Copied data that follows copied data extends its segment.
+    if (m_last_copied && m_num_segments > 0) {
+        m_segments[m_num_segments - 1].iov_len += size;
+        m_buf_size += size;
+        return dst;
+    }
+    if (m_num_segments == max_segments)
+        return nullptr;
+    m_segments[m_num_segments++] = iovec {dst, size};
+    m_buf_size += size;
+    m_last_copied = true;
+    return dst;
+}
+
+bool http::ResponseBuilder::reference(const char* data, size_t size)
+{
+    if (size == 0)
+        return true;
+    if (m_num_segments == max_segments)
+        return false;
+    m_segments[m_num_segments++] = iovec {const_cast<char*>(data), size};
+    m_last_copied = false;
+    return true;
+}
+
+http::Message::Message(Kind kind):
+    kind {kind},
+    buf {nullptr},
+    buf_size {0},
+    cur {nullptr},
+    end {nullptr}
+{
+}
+
 http::Message::Message(Kind kind, const char* buf, size_t buf_size):
     kind {kind},
     buf {buf},
-    buf_size {buf_size},
+    buf_size {0},
     cur {buf},
-    end {buf + buf_size}
+    end {buf}
 {
-    if (!parse_start_line())
-        return;
+    parse(buf, buf_size);
+}
+
+void http::Message::parse(const char* new_buf, size_t new_buf_size)
+{
+    ASSERT(new_buf_size >= buf_size);
+    if (new_buf != buf)
+        rebase(new_buf);
+    buf_size = new_buf_size;
+    end = buf + buf_size;
 
-    if (!parse_headers())
+    if (complete || !valid)
         return;
 
-   if (!parse_body())
+    while (m_phase != Phase::Body) {
+        const char* lf = nullptr;
+        if (m_scanned < buf_size)
+            lf = static_cast<const char*>(memchr(buf + m_scanned, '\n', buf_size - m_scanned));
+        if (!lf) {
+            m_scanned = buf_size;
+            return;
+        }
+        m_scanned = (lf + 1) - buf;
+
+        // The line parsers see the complete line only. A line they cannot
+        // parse to the end is malformed.
+        end = lf + 1;
+        bool rc = (m_phase == Phase::StartLine) ? parse_start_line() : parse_header_line();
+        end = buf + buf_size;
+        if (!rc) {
+            valid = false;
+            return;
+        }
+        ASSERT(cur == lf + 1);
+        if (m_phase == Phase::StartLine)
+            m_phase = Phase::Headers;
+    }
+
+    if (!parse_body())
         return;
 
     complete = true;
-    return;
+}
+
+void http::Message::rebase(const char* new_buf)
+{
+    auto move = [this, new_buf](std::string_view& view) {
+        if (view.data())
+            view = std::string_view {new_buf + (view.data() - buf), view.size()};
+    };
+    move(request_target);
+    move(reason_phrase);
+    move(header_authorization);
+    move(header_user_agent);
+    move(header_host);
+    move(header_upgrade);
+    move(header_connection);
+    move(header_origin);
+    move(header_sec_websocket_protocol);
+    move(header_sec_websocket_version);
+    move(header_sec_websocket_key);
+    move(header_sec_websocket_accept);
+    for (size_t i = 0; i < num_header_fields; ++i) {
+        move(header_fields[i].name);
+        move(header_fields[i].value);
+    }
+    if (body)
+        body = new_buf + (body - buf);
+    cur = new_buf + (cur - buf);
+    buf = new_buf;
 }
 
 bool http::Message::parse_start_line()
@@ -159,8 +966,7 @@ bool http::Message::parse_request_line()
     if (cur == end)
         return false;
     const char* request_target_data = cur;
-    while (cur < end && *cur != ' ')
-        ++cur;
+    cur = find_delimiter(cur, end, ' ', ' ');
     if (cur == end)
         return false;
     size_t request_target_size = cur - request_target_data;
@@ -223,8 +1029,7 @@ bool http::Message::parse_status_line()
     if (cur == end)
         return false;
     const char* reason_phrase_data = cur;
-    while (cur < end && *cur != '\r')
-        ++cur;
+    cur = find_delimiter(cur, end, '\r', '\r');
     if (cur == end)
         return false;
     reason_phrase = std::string_view {reason_phrase_data,
@@ -240,24 +1045,18 @@ bool http::Message::parse_status_line()
     return true;
 }
 
-bool http::Message::parse_headers()
+bool http::Message::parse_header_line()
 {
-    while (cur != end && *cur != '\r') {
-        bool rc = parse_header();
-        if (!rc)
-            return false;
-    }
-    if (cur == end)
-        return false;
-    ASSERT(*cur == '\r');
+    if (*cur != '\r')
+        return parse_header();
+
+    // The empty line that ends the header.
     ++cur;
-    if (cur == end)
-        return false;
-    if (*cur != '\n') {
-        valid = false;
+    if (cur == end || *cur != '\n')
         return false;
-    }
     ++cur;
+    m_phase = Phase::Body;
+    header_complete = true;
     return true;
 }
 
@@ -274,16 +1073,14 @@ bool http::Message::parse_header()
         return false;
     }
 
-    while(cur != end && *cur != ':' && *cur != ' ')
-        ++cur;
+    cur = find_delimiter(cur, end, ':', ' ');
     if (cur == end)
         return false;
 
     size_t name_size = cur - name;
     ASSERT(name_size > 0);
 
-    while(cur != end && *cur != ':')
-        ++cur;
+    cur = find_delimiter(cur, end, ':', ':');
     if (cur == end)
         return false;
 
@@ -294,8 +1091,7 @@ bool http::Message::parse_header()
         return false;
 
     const char* value = cur;
-    while (cur != end && *cur != '\r')
-        ++cur;
+    cur = find_delimiter(cur, end, '\r', '\r');
     if (cur == end)
         return false;
     size_t value_size = cur - value;
@@ -318,72 +1114,121 @@ bool http::Message::parse_header()
     return true;
 }
 
-#include <string>
 bool http::Message::interpret_header(const char* name, size_t name_size,
-                                           const char* value, size_t value_size)
-{
-    const char* content_length_value = "Content-Length";
-    const char* authorization_value = "Authorization";
-    const char* user_agent_value = "User-Agent";
-    const char* host_value = "Host";
-    const char* upgrade_value = "Upgrade";
-    const char* connection_value = "Connection";
-    const char* origin_value = "Origin";
-    const char* sec_websocket_protocol_value = "Sec-WebSocket-Protocol";
-    const char* sec_websocket_version_value = "Sec-WebSocket-Version";
-    const char* sec_websocket_key_value = "Sec-WebSocket-Key";
-    const char* sec_websocket_accept_value = "Sec-WebSocket-Accept";
-    const char* transfer_encoding_value = "Transfer-Encoding";
-
-    if (name_size == 14 && strncasecmp(content_length_value, name, 14) == 0) {
-        ASSERT('\0' == 0);
-        ASSERT(sizeof(size_t) >= 8);
-        char buf[17] = { };
-        if (value_size > 16)
-            return false;
-        memcpy(buf, value, value_size);
-        ASSERT(buf[value_size] == '\0');
-        char *endptr = nullptr;
-        intmax_t cl = strtoimax(buf, &endptr, 10);
-        if (!endptr || *endptr != '\0' || cl < 0) {
-            valid = false;
-            return false;
-        }
-        content_length = static_cast<size_t>(cl); // overflow impossible
-        ASSERT(static_cast<intmax_t>(content_length) == cl);
-    }
-    else if (name_size == 13 && strncasecmp(authorization_value, name, 13) == 0)
-        header_authorization = std::string_view {value, value_size};
-    else if (name_size == 10 && strncasecmp(user_agent_value, name, 10) == 0)
-        header_user_agent = std::string_view {value, value_size};
-    else if (name_size == 4 && strncasecmp(host_value, name, 4) == 0)
-        header_host = std::string_view {value, value_size};
-    else if (name_size == 7 && strncasecmp(upgrade_value, name, 7) == 0)
-        header_upgrade = std::string_view {value, value_size};
-    else if (name_size == 10 && strncasecmp(connection_value, name, 10) == 0)
-        header_connection = std::string_view {value, value_size};
-    else if (name_size == 6 && strncasecmp(origin_value, name, 6) == 0)
-        header_origin = std::string_view {value, value_size};
-    else if (name_size == 22 && strncasecmp(sec_websocket_protocol_value, name, 22) == 0)
-        header_sec_websocket_protocol = std::string_view {value, value_size};
-    else if (name_size == 21 && strncasecmp(sec_websocket_version_value, name, 21) == 0)
-        header_sec_websocket_version = std::string_view {value, value_size};
-    else if (name_size == 17 && strncasecmp(sec_websocket_key_value, name, 17) == 0)
-        header_sec_websocket_key = std::string_view {value, value_size};
-    else if (name_size == 20 && strncasecmp(sec_websocket_accept_value, name, 20) == 0)
-        header_sec_websocket_accept = std::string_view {value, value_size};
-    else if (name_size == 17 && strncasecmp(transfer_encoding_value, name, 17) == 0) {
-        // Don't handle at the moment.
+                                     const char* value, size_t value_size)
+{
+    if (num_header_fields == max_header_fields) {
         valid = false;
         return false;
     }
+    std::string_view value_view {value, value_size};
+    Header id = header_from_name(std::string_view {name, name_size});
+    header_fields[num_header_fields++] = HeaderField {id, std::string_view {name, name_size},
+        value_view};
+    if (id == Header::Unknown)
+        return true;
+    m_known_fields[static_cast<size_t>(id)] = static_cast<uint_least8_t>(num_header_fields);
+
+    switch (id) {
+        case Header::ContentLength: {
+            ASSERT('\0' == 0);
+            ASSERT(sizeof(size_t) >= 8);
+            char buf[17] = { };
+            if (value_size > 16)
+                return false;
+            memcpy(buf, value, value_size);
+            ASSERT(buf[value_size] == '\0');
+            char *endptr = nullptr;
+            intmax_t cl = strtoimax(buf, &endptr, 10);
+            if (!endptr || *endptr != '\0' || cl < 0) {
+                valid = false;
+                return false;
+            }
+            content_length = static_cast<size_t>(cl); // overflow impossible
+            ASSERT(static_cast<intmax_t>(content_length) == cl);
+            break;
+        }
+        case Header::Authorization:
+            header_authorization = value_view;
+            break;
+        case Header::UserAgent:
+            header_user_agent = value_view;
+            break;
+        case Header::Host:
+            header_host = value_view;
+            break;
+        case Header::Upgrade:
+            header_upgrade = value_view;
+            break;
+        case Header::Connection:
+            header_connection = value_view;
+            break;
+        case Header::Origin:
+            header_origin = value_view;
+            break;
+        case Header::SecWebSocketProtocol:
+            header_sec_websocket_protocol = value_view;
+            break;
+        case Header::SecWebSocketVersion:
+            header_sec_websocket_version = value_view;
+            break;
+        case Header::SecWebSocketKey:
+            header_sec_websocket_key = value_view;
+            break;
+        case Header::SecWebSocketAccept:
+            header_sec_websocket_accept = value_view;
+            break;
+        case Header::TransferEncoding:
+            // Only the chunked transfer coding by itself is supported.
+            if (value_size != 7 || strncasecmp(value, "chunked", 7) != 0 || chunked) {
+                valid = false;
+                return false;
+            }
+            chunked = true;
+            break;
+        default:
+            break;
+    }
 
     return true;
 }
 
+std::string_view http::Message::header(Header header) const
+{
+    ASSERT(header != Header::Unknown);
+    uint_least8_t index = m_known_fields[static_cast<size_t>(header)];
+    if (index == 0)
+        return std::string_view {};
+    return header_fields[index - 1].value;
+}
+
+std::string_view http::Message::header(std::string_view name) const
+{
+    Header id = header_from_name(name);
+    if (id != Header::Unknown)
+        return header(id);
+    for (size_t i = num_header_fields; i > 0; --i) {
+        const HeaderField& field = header_fields[i - 1];
+        if (field.name.size() == name.size() &&
+            strncasecmp(field.name.data(), name.data(), name.size()) == 0)
+            return field.value;
+    }
+    return std::string_view {};
+}
+
 bool http::Message::parse_body()
 {
     body = cur;
+    if (chunked) {
+        // A length in addition to the chunked coding would allow a message
+        // to be framed differently by different parsers.
+        if (m_known_fields[static_cast<size_t>(Header::ContentLength)] != 0) {
+            valid = false;
+            return false;
+        }
+        message_size = cur - buf;
+        return true;
+    }
     message_size = (cur - buf) + content_length;
     if (message_size > buf_size)
         return false;
@@ -391,3 +1236,161 @@ bool http::Message::parse_body()
     ASSERT(valid);
     return true;
 }
+
+size_t http::parse_pipeline(Message::Kind kind, const char* buf, size_t buf_size,
+                            std::vector<Message>& messages, bool& valid)
+{
+    size_t offset = 0;
+    valid = true;
+    while (offset < buf_size) {
+        Message& msg = messages.emplace_back(kind, buf + offset, buf_size - offset);
+        if (!msg.complete) {
+            valid = msg.valid;
+            messages.pop_back();
+            break;
+        }
+        offset += msg.message_size;
+        if (msg.chunked)
+            break;
+    }
+    return offset;
+}
+
+size_t http::ChunkedDecoder::decode(const char* data, size_t size, std::string_view& fragment)
+{
+    fragment = std::string_view {};
+    const char* cur = data;
+    const char* end = data + size;
+
+    while (cur != end && !done && valid) {
+        char ch = *cur;
+        switch (m_state) {
+            case State::Size: {
+                int digit = -1;
+                if (ch >= '0' && ch <= '9')
+                    digit = ch - '0';
+                else if (ch >= 'a' && ch <= 'f')
+                    digit = ch - 'a' + 10;
+                else if (ch >= 'A' && ch <= 'F')
+                    digit = ch - 'A' + 10;
+                if (digit >= 0 && m_num_digits < 16) {
+                    m_chunk_size = 16 * m_chunk_size + digit;
+                    ++m_num_digits;
+                }
+                else if (m_num_digits > 0 && (ch == ';' || ch == ' ' || ch == '\t'))
+                    m_state = State::Extension;
+                else if (m_num_digits > 0 && ch == '\r')
+                    m_state = State::SizeLf;
+                else
+                    valid = false;
+                ++cur;
+                break;
+            }
+            case State::Extension:
+                // Chunk extensions are ignored.
+                if (ch == '\r')
+                    m_state = State::SizeLf;
+                else if (ch == '\n')
+                    valid = false;
+                ++cur;
+                break;
+            case State::SizeLf:
+                if (ch != '\n') {
+                    valid = false;
+                    break;
+                }
+                ++cur;
+                m_state = (m_chunk_size == 0) ? State::TrailerLine : State::Data;
+                break;
+            case State::Data: {
+                size_t n = static_cast<size_t>(std::min<uint_least64_t>(m_chunk_size, end - cur));
+                fragment = std::string_view {cur, n};
+                cur += n;
+                m_chunk_size -= n;
+                body_size += n;
+                if (m_chunk_size == 0)
+                    m_state = State::DataCr;
+                return cur - data;
+            }
+            case State::DataCr:
+                if (ch != '\r') {
+                    valid = false;
+                    break;
+                }
+                ++cur;
+                m_state = State::DataLf;
+                break;
+            case State::DataLf:
+                if (ch != '\n') {
+                    valid = false;
+                    break;
+                }
+                ++cur;
+                m_num_digits = 0;
+                m_state = State::Size;
+                break;
+            case State::TrailerLine:
+                if (ch == '\r') {
+                    ++cur;
+                    m_state = State::TrailerLf;
+                }
+                else
+                    m_state = State::TrailerField;
+                break;
+            case State::TrailerField: {
+                const char* lf = static_cast<const char*>(memchr(cur, '\n', end - cur));
+                const char* line_end = lf ? lf + 1 : end;
+                if (m_trailer.size() + (line_end - cur) > max_trailer_size) {
+                    valid = false;
+                    break;
+                }
+                m_trailer.append(cur, line_end);
+                cur = line_end;
+                if (lf)
+                    m_state = State::TrailerLine;
+                break;
+            }
+            case State::TrailerLf:
+                if (ch != '\n') {
+                    valid = false;
+                    break;
+                }
+                ++cur;
+                if (parse_trailer())
+                    done = true;
+                else
+                    valid = false;
+                break;
+        }
+    }
+
+    return cur - data;
+}
+
+bool http::ChunkedDecoder::parse_trailer()
+{
+    std::string_view trailer {m_trailer};
+    while (!trailer.empty()) {
+        size_t line_size = trailer.find('\n');
+        ASSERT(line_size != std::string_view::npos);
+        std::string_view line = trailer.substr(0, line_size);
+        trailer.remove_prefix(line_size + 1);
+        if (line.empty() || line.back() != '\r')
+            return false;
+        line.remove_suffix(1);
+
+        size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos)
+            return false;
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        if (name.find(' ') != std::string_view::npos || name.find('\t') != std::string_view::npos)
+            return false;
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+        trailer_fields.push_back(HeaderField {header_from_name(name), name, value});
+    }
+    return true;
+}
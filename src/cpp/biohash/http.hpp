@@ -1,7 +1,12 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
 #include <string_view>
+#include <vector>
 
 namespace biohash {
 namespace http {
@@ -21,8 +26,162 @@ enum class Method {
 
 const char* method_str(Method method);
 
+// The header fields known to the parser. Their names are resolved in
+// constant time by a perfect hash.
+enum class Header : uint_least8_t {
+    Accept,
+    AcceptEncoding,
+    AcceptRanges,
+    Authorization,
+    CacheControl,
+    Connection,
+    ContentEncoding,
+    ContentLength,
+    ContentRange,
+    ContentType,
+    Cookie,
+    Date,
+    ETag,
+    Expect,
+    Host,
+    IfModifiedSince,
+    IfNoneMatch,
+    IfRange,
+    KeepAlive,
+    LastModified,
+    Location,
+    Origin,
+    Range,
+    SecWebSocketAccept,
+    SecWebSocketKey,
+    SecWebSocketProtocol,
+    SecWebSocketVersion,
+    Server,
+    SetCookie,
+    TransferEncoding,
+    Upgrade,
+    UserAgent,
+    Vary,
+    XForwardedFor,
+    XRequestId,
+    Unknown
+};
+
+constexpr size_t num_known_headers = static_cast<size_t>(Header::Unknown);
+
+// Returns true if the comma separated list of a header value such as
+// Connection contains 'token', compared case insensitively.
+bool has_token(std::string_view list, std::string_view token);
+
+// The canonical name of a known header.
+const char* header_name(Header header);
+
+// Returns the known header whose name equals 'name' case insensitively, or
+// Header::Unknown.
+Header header_from_name(std::string_view name);
+
+struct HeaderField {
+    Header header;
+    std::string_view name;
+    std::string_view value;
+};
+
+// A message with more header fields is invalid.
+constexpr size_t max_header_fields = 64;
+
+// Request targets, RFC 9112 section 3.2
+
+// The components of a request target, which refer to the target. The query
+// and the fragment exclude their '?' and '#', and their data() is null if
+// there is none. The path of an absolute-form target starts after the
+// authority, and is empty if the target has no path.
+struct RequestTarget {
+    std::string_view path;
+    std::string_view query;
+    std::string_view fragment;
+};
+
+RequestTarget split_request_target(std::string_view target);
+
+// Iterates over the name=value pairs of a query, which are separated by '&'.
+// A pair without '=' has an empty value, and empty pairs are skipped. The
+// names and values are views into the query and still percent-encoded.
+class QueryIterator {
+public:
+
+    QueryIterator(std::string_view query);
+
+    // Returns false after the last pair.
+    bool next(std::string_view& name, std::string_view& value);
+
+private:
+
+    std::string_view m_rest;
+};
+
+// The value of the first pair of the query named 'name', compared without
+// decoding. The data() of the returned view is null if there is none.
+std::string_view query_param(std::string_view query, std::string_view name);
+
+// Decodes the %XX escapes of 'data' into 'out', and '+' to a space if
+// 'plus_as_space' is true, as in form-encoded queries. 'out' must have room
+// for 'size' bytes, and may equal 'data' to decode in place. Runs of bytes
+// without escapes are skipped with the vector scanner of the parser. Returns
+// false if an escape is malformed.
+bool percent_decode(const char* data, size_t size, char* out, size_t& out_size,
+                    bool plus_as_space = false);
+
+// Byte ranges, RFC 9110 section 14
+
+// The offsets of the first and the last byte of a range.
+struct ByteRange {
+    uint_least64_t first;
+    uint_least64_t last;
+};
+
+constexpr size_t max_byte_ranges = 16;
+
+enum class RangeStatus {
+    // The value is not a bytes range set, or has more than max_byte_ranges
+    // ranges, and the Range header is ignored.
+    Invalid,
+    // No range overlaps the representation.
+    Unsatisfiable,
+    Satisfiable
+};
+
+// Parses the value of a Range header for a representation of 'size' bytes.
+// The satisfiable ranges are stored in 'ranges', which must have room for
+// max_byte_ranges, in the order of the header and limited to the
+// representation.
+RangeStatus parse_range(std::string_view value, uint_least64_t size, ByteRange* ranges,
+                        size_t& num_ranges);
+
+// Content codings, RFC 9110 section 8.4.1
+
+enum class ContentCoding : uint_least8_t {
+    identity,
+    gzip,
+    deflate
+};
+
+// The name of a coding, as in Content-Encoding.
+const char* content_coding_name(ContentCoding coding);
+
+// Selects the coding of a response from the value of an Accept-Encoding
+// header, RFC 9110 section 12.5.3. gzip or deflate is selected if acceptable,
+// the one with the higher qvalue and gzip on a tie, where "*" stands for the
+// codings that are not listed and "x-gzip" for gzip. Otherwise, and if the
+// header is absent, identity is selected, even if the client refused it.
+ContentCoding negotiate_content_coding(std::string_view accept_encoding);
+
+// The reason phrase of a registered status code, or an empty string.
 const char* reason_phrase(int status_code);
 
+// The complete status line of a registered status code, such as
+// "HTTP/1.1 200 OK\r\n", or an empty view.
+std::string_view status_line(int status_code);
+
 // Functions to make HTTP messages
 //
 // The functions take a buffer 'buf' of size 'size' and inserts the HTTP line
@@ -37,10 +196,91 @@ size_t write_status_line(char* buf, size_t size, int status_code);
 
 // name: SP value CRLF
 size_t write_header(char* buf, size_t size, const char* name, const char* value);
+size_t write_header(char* buf, size_t size, std::string_view name, std::string_view value);
+
+// Date: SP IMF-fixdate CRLF, with the current date from
+// time::cached_http_date().
+size_t write_date_header(char* buf, size_t size);
 
 // writes "\r\n" to end the header and returns 2.
 size_t write_header_end(char* buf, size_t size);
 
+// Functions to write a body with the chunked transfer coding. A chunked body
+// is a sequence of chunks followed by the last chunk, optional trailer fields
+// written with write_header() and the end written with write_header_end().
+
+// chunk-size CRLF, the line that precedes 'chunk_size' bytes of data. The data
+// must be followed by CRLF. 'chunk_size' must be positive.
+size_t write_chunk_header(char* buf, size_t size, size_t chunk_size);
+
+// chunk-size CRLF data CRLF
+size_t write_chunk(char* buf, size_t size, const char* data, size_t data_size);
+
+// "0\r\n"
+size_t write_last_chunk(char* buf, size_t size);
+
+// A ResponseBuilder assembles a response for writev() without formatting.
+// The status line is taken from a precomputed table and header fields are
+// copied into an inline buffer, whereas header blocks and bodies are
+// referenced as segments of their own. Referenced memory must stay valid until
+// the response has been written. The functions that add to the response
+// return false, and add nothing, if the inline buffer or the segments are
+// exhausted.
+class ResponseBuilder {
+public:
+
+    static constexpr size_t buffer_size = 1024;
+    // Enough for a multipart/byteranges body of max_byte_ranges parts.
+    static constexpr size_t max_segments = 2 * max_byte_ranges + 8;
+
+    ResponseBuilder() = default;
+    ResponseBuilder(const ResponseBuilder&) = delete;
+    ResponseBuilder& operator=(const ResponseBuilder&) = delete;
+
+    bool status(int status_code);
+    bool header(std::string_view name, std::string_view value);
+    bool header(Header header, std::string_view value);
+    bool content_length(uint_least64_t content_length);
+    // The Date header of the current second.
+    bool date();
+
+    // A block of complete header fields, each ending in CRLF, such as a
+    // static "Server: biohash\r\n" block.
+    bool header_block(std::string_view block);
+
+    bool end_header();
+    bool body(const char* data, size_t size);
+
+    // The segments that have not been written yet.
+    const iovec* segments() const;
+    int num_segments() const;
+    size_t size() const;
+
+    // Writes the remaining segments to 'fd' with writev() and consumes the
+    // written bytes. The return value is that of writev(). After a partial
+    // write, write() can be called again.
+    ssize_t write(int fd);
+
+    // Marks 'size' bytes as written.
+    void consume(size_t size);
+
+    // Starts a new response.
+    void reset();
+
+private:
+
+    char m_buf[buffer_size];
+    size_t m_buf_size = 0;
+    iovec m_segments[max_segments];
+    size_t m_first_segment = 0;
+    size_t m_num_segments = 0;
+    // Whether the last segment is in m_buf and can be extended.
+    bool m_last_copied = false;
+
+    char* reserve(size_t size);
+    bool reference(const char* data, size_t size);
+};
+
 // A Message object is constructed from a (serialized) HTTP message in a
 // buffer. Ownership of the buffer is not transferred to Message. Message
 // parses the buffer and determines whether a complete HTTP message is
@@ -48,6 +288,15 @@ size_t write_header_end(char* buf, size_t size);
 // its public member variables. The properties of the message should only be
 // used when complete and valid are true. If valid is false, the HTTP message
 // did not conform to the specification.
+//
+// If the message has the chunked transfer coding, complete means that the
+// header is complete. message_size is then the size of the header and the body
+// must be decoded with a ChunkedDecoder starting at 'body'.
+//
+// Parsing is resumable. A Message constructed without a buffer, or from an
+// incomplete one, keeps its state and parse() only consumes the bytes
+// appended since the previous call. The start line and each header line are
+// parsed once, when their terminating LF has arrived.
 class Message {
 public:
 
@@ -56,21 +305,32 @@ public:
         Response
     };
 
+    Message(Kind kind);
     Message(Kind kind, const char* buf, size_t buf_size);
 
+    // Continues parsing. 'buf' must start with the 'buf_size' bytes of the
+    // previous call, followed by the newly received ones. The buffer may have
+    // been moved, in which case the string views and pointers of the message
+    // are moved along.
+    void parse(const char* buf, size_t buf_size);
+
     Kind kind;
-    const char* const buf;
+    const char* buf;
     size_t buf_size;
 
     const char* cur;
-    const char* const end;
+    const char* end;
 
     // Common to all messages.
     bool complete = false;
+    // The header has been parsed, and the body may still be incomplete.
+    bool header_complete = false;
     bool valid = true;
     size_t message_size = 0;
-    const char* body;
+    const char* body = nullptr;
     uint_least64_t content_length = 0;
+    // Transfer-Encoding: chunked
+    bool chunked = false;
 
     // Request specific
     Method method;
@@ -92,18 +352,97 @@ public:
     std::string_view header_sec_websocket_key;
     std::string_view header_sec_websocket_accept;
 
+    // All header fields in the order of the message.
+    HeaderField header_fields[max_header_fields];
+    size_t num_header_fields = 0;
+
+    // Return the value of the last field with the given header or name. The
+    // data() of the returned view is null if there is no such field.
+    std::string_view header(Header header) const;
+    std::string_view header(std::string_view name) const;
+
 private:
 
+    enum class Phase {
+        StartLine,
+        Headers,
+        Body
+    };
+
+    Phase m_phase = Phase::StartLine;
+    // The offset up to which the buffer has been searched for LF.
+    size_t m_scanned = 0;
+    // One plus the index in header_fields of the last field of each known
+    // header, or zero.
+    uint_least8_t m_known_fields[num_known_headers] = {};
+
+    void rebase(const char* new_buf);
+
     bool parse_start_line();
     bool parse_request_line();
     bool parse_status_line();
 
-    bool parse_headers();
+    bool parse_header_line();
     bool parse_header();
     bool interpret_header(const char* name, size_t name_size,
                           const char* value, size_t value_size);
     bool parse_body();
 };
 
+// Parses the complete messages that follow each other at the start of a
+// buffer, as left by a client that pipelines requests, and appends them to
+// 'messages'. Parsing stops at an incomplete or invalid message, or after a
+// chunked message whose body must be decoded separately. The return value is
+// the offset in 'buf' where parsing stopped. 'valid' is set to false if the
+// message at that offset is invalid.
+size_t parse_pipeline(Message::Kind kind, const char* buf, size_t buf_size,
+                      std::vector<Message>& messages, bool& valid);
+
+// A ChunkedDecoder decodes a body with the chunked transfer coding as it
+// arrives, without buffering the data. decode() consumes bytes and reports
+// the body data among them as a view into the input. It is called until all
+// input is consumed or done is true. Bytes after the end of the body are not
+// consumed. Trailer fields are collected and available when done is true.
+class ChunkedDecoder {
+public:
+
+    // A body whose trailer section is larger is invalid.
+    static constexpr size_t max_trailer_size = 8192;
+
+    // Returns the number of bytes consumed from 'data'. 'fragment' is set to
+    // the body data within the consumed bytes, which is empty if there was
+    // none.
+    size_t decode(const char* data, size_t size, std::string_view& fragment);
+
+    bool done = false;
+    bool valid = true;
+    // The number of body bytes decoded so far.
+    uint_least64_t body_size = 0;
+
+    // The trailer fields refer to memory owned by the decoder.
+    std::vector<HeaderField> trailer_fields;
+
+private:
+
+    enum class State {
+        Size,
+        Extension,
+        SizeLf,
+        Data,
+        DataCr,
+        DataLf,
+        TrailerLine,
+        TrailerField,
+        TrailerLf
+    };
+
+    State m_state = State::Size;
+    size_t m_num_digits = 0;
+    uint_least64_t m_chunk_size = 0;
+    std::string m_trailer;
+
+    bool parse_trailer();
+};
+
 }
 }
@@ -0,0 +1,826 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+
+#include "http_client.hpp"
+#include "assert.hpp"
+#include "buffer.hpp"
+#include "time.hpp"
+
+using namespace biohash;
+
+namespace {
+
+constexpr size_t initial_buffer_size = 4096;
+
+// RFC 9110, section 9.2.2.
+bool is_idempotent(http::Method method)
+{
+    return method != http::Method::POST && method != http::Method::CONNECT;
+}
+
+// Appends the output of a write_* function, which returns the size it needs.
+template <class Write>
+void append(std::string& out, Write write)
+{
+    constexpr size_t guess = 256;
+    size_t offset = out.size();
+    out.resize(offset + guess);
+    size_t size = write(&out[offset], guess);
+    if (size > guess) {
+        out.resize(offset + size);
+        write(&out[offset], size);
+    }
+    out.resize(offset + size);
+}
+
+// The response passed to failed requests.
+const http::Message& no_response()
+{
+    static const http::Message message = [] {
+        http::Message message {http::Message::Kind::Response};
+        message.status_code = 0;
+        return message;
+    }();
+    return message;
+}
+
+} // anonymous namespace
+
+struct http::Client::Pending {
+    Method method;
+    // The serialized request.
+    std::string data;
+    StreamCallback callback;
+    // Whether the body of the response may be left in the socket.
+    bool stream_body;
+    int_fast64_t deadline;
+    bool retried = false;
+};
+
+struct http::Client::Pool {
+    // The value of the Host header.
+    std::string host;
+    struct sockaddr_storage addr;
+    socklen_t addr_size;
+    std::deque<std::unique_ptr<Pending>> queue;
+    std::vector<Connection*> connections;
+};
+
+// A Connection writes the requests assigned to it and reads their responses
+// in order. It destroys itself when the connection ends.
+class http::Client::Connection final: public EventLoop::Handler {
+public:
+
+    Connection(Client& client, Pool& pool, int fd);
+    ~Connection();
+
+    void on_event(uint32_t events) override;
+
+    // Whether requests may be sent.
+    bool usable() const;
+    bool idle() const;
+    // Whether 'pending' may be pipelined after the outstanding requests.
+    bool can_pipeline(const Pending& pending) const;
+    bool connecting() const;
+
+    void send(std::unique_ptr<Pending> pending);
+
+    // Removes the connection from the loop and the pool and deletes it.
+    void destroy();
+
+    // Ends the connection. The first outstanding request fails with 'error'
+    // and the others are retried or fail with Error::Closed.
+    void fail(Error error);
+
+    void connect_failed();
+
+    // Called when the stream of a body ends.
+    void end_stream(bool finished);
+
+    std::deque<std::unique_ptr<Pending>> in_flight;
+    int_fast64_t connect_deadline;
+    int_fast64_t last_active;
+
+private:
+
+    Client& m_client;
+    Pool& m_pool;
+    const int m_fd;
+    bool m_connected = false;
+    // The last response asked for the connection to be closed.
+    bool m_closing = false;
+    size_t m_num_responses = 0;
+
+    // The stream of the current body, and whether a stream has ended before
+    // its body, which leaves the connection unusable.
+    BodyStream* m_stream = nullptr;
+    bool m_stream_broken = false;
+
+    std::string m_out;
+    size_t m_out_offset = 0;
+
+    // The received bytes are [m_in_begin, m_in_end) of m_in, where
+    // m_in_begin is the start of the current response.
+    Buffer m_in {initial_buffer_size};
+    size_t m_in_begin = 0;
+    size_t m_in_end = 0;
+    bool m_read_blocked = false;
+    bool m_eof = false;
+
+    Message m_response {Message::Kind::Response};
+    ChunkedDecoder m_chunked;
+    // The bytes after the header consumed by m_chunked.
+    size_t m_chunked_consumed = 0;
+    std::string m_body;
+
+    bool read_input();
+    bool process(Error& error);
+    bool handle_chunked_body(const char* data, size_t size, Error& error);
+    void reset_response();
+    bool flush();
+};
+
+http::Client::Connection::Connection(Client& client, Pool& pool, int fd):
+    connect_deadline {client.m_loop.now() +
+        int_fast64_t(client.m_config.connect_timeout_ms) * 1000000},
+    last_active {client.m_loop.now()},
+    m_client {client},
+    m_pool {pool},
+    m_fd {fd}
+{
+}
+
+http::Client::Connection::~Connection()
+{
+    if (m_stream)
+        m_stream->m_connection = nullptr;
+    close(m_fd);
+}
+
+bool http::Client::Connection::usable() const
+{
+    return m_connected && !m_closing && !m_stream && !m_stream_broken;
+}
+
+bool http::Client::Connection::idle() const
+{
+    return usable() && in_flight.empty();
+}
+
+bool http::Client::Connection::can_pipeline(const Pending& pending) const
+{
+    if (!usable() || !is_idempotent(pending.method) ||
+        in_flight.size() >= m_client.m_config.max_pipelined_requests)
+        return false;
+    for (const auto& outstanding: in_flight) {
+        if (!is_idempotent(outstanding->method))
+            return false;
+    }
+    return true;
+}
+
+bool http::Client::Connection::connecting() const
+{
+    return !m_connected;
+}
+
+void http::Client::Connection::send(std::unique_ptr<Pending> pending)
+{
+    ASSERT(usable());
+    if (m_out_offset == m_out.size()) {
+        m_out.clear();
+        m_out_offset = 0;
+    }
+    m_out += pending->data;
+    in_flight.push_back(std::move(pending));
+    // On an error, modifying the registration reports the state of the socket
+    // again, and the connection fails in on_event().
+    if (!flush())
+        m_client.m_loop.modify(m_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, *this);
+}
+
+void http::Client::Connection::destroy()
+{
+    m_client.m_loop.remove(m_fd);
+    auto& connections = m_pool.connections;
+    connections.erase(std::find(connections.begin(), connections.end(), this));
+    delete this;
+}
+
+void http::Client::Connection::fail(Error error)
+{
+    Client& client = m_client;
+    Pool& pool = m_pool;
+    // A request on a reused connection may have crossed the server closing
+    // it. A request pipelined after the first one was not answered.
+    bool retry_first = error == Error::Closed && m_num_responses > 0 &&
+        m_in_begin == m_in_end;
+    std::deque<std::unique_ptr<Pending>> failed = std::move(in_flight);
+    destroy();
+
+    for (size_t i = failed.size(); i-- > 0;) {
+        Pending& pending = *failed[i];
+        if (is_idempotent(pending.method) && !pending.retried && (i > 0 || retry_first)) {
+            pending.retried = true;
+            pool.queue.push_front(std::move(failed[i]));
+        }
+    }
+
+    for (size_t i = 0; i < failed.size(); ++i) {
+        if (failed[i])
+            failed[i]->callback(i == 0 ? error : Error::Closed, no_response(), {}, nullptr);
+    }
+    client.schedule(pool);
+}
+
+void http::Client::Connection::connect_failed()
+{
+    Client& client = m_client;
+    Pool& pool = m_pool;
+    destroy();
+
+    // The queued requests fail unless another connection to the host works.
+    bool connected = false;
+    for (Connection* connection: pool.connections) {
+        if (!connection->connecting())
+            connected = true;
+    }
+    if (!connected)
+        client.fail_queue(pool, Error::Connect);
+    client.schedule(pool);
+}
+
+// The stream may end in another handler, so the connection only has the loop
+// report it again. Modifying the registration reports the state of the
+// socket, which is writable unless requests are being written.
+void http::Client::Connection::end_stream(bool finished)
+{
+    m_stream = nullptr;
+    m_stream_broken = !finished;
+    m_client.m_loop.modify(m_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, *this);
+}
+
+void http::Client::Connection::on_event(uint32_t events)
+{
+    if (!m_connected) {
+        int error = 0;
+        socklen_t error_size = sizeof error;
+        if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &error_size) != 0 || error != 0 ||
+            (events & (EPOLLERR | EPOLLHUP)))
+            return connect_failed();
+        if (!(events & EPOLLOUT))
+            return;
+        m_connected = true;
+        last_active = m_client.m_loop.now();
+        return m_client.schedule(m_pool);
+    }
+
+    last_active = m_client.m_loop.now();
+    if (events & EPOLLERR)
+        return fail(Error::Closed);
+    if ((events & EPOLLOUT) && !flush())
+        return fail(Error::Closed);
+
+    // The rest of a streamed body is read through the stream, and the
+    // responses after it once the stream has ended.
+    for (bool read = (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0;; read = m_read_blocked) {
+        if (m_stream_broken)
+            return fail(Error::Closed);
+        if (m_stream)
+            break;
+        if (read && !read_input())
+            return fail(Error::Closed);
+        Error error = Error::None;
+        bool progress = process(error);
+        if (error != Error::None)
+            return fail(error);
+        if (!progress)
+            break;
+    }
+
+    if (m_eof || (m_closing && in_flight.empty()))
+        return fail(Error::Closed);
+    m_client.schedule(m_pool);
+}
+
+bool http::Client::Connection::read_input()
+{
+    size_t max_size = m_client.m_config.max_response_size;
+    m_read_blocked = false;
+    for (;;) {
+        if (m_in_end == m_in.size) {
+            if (m_in_begin > 0) {
+                // The response moves to the start of the buffer and is rebased
+                // when it is parsed next.
+                memmove(m_in.data, m_in.data + m_in_begin, m_in_end - m_in_begin);
+                m_in_end -= m_in_begin;
+                m_in_begin = 0;
+            }
+            else if (m_in.size < max_size)
+                m_in.resize(std::min(2 * m_in.size, max_size));
+            else {
+                m_read_blocked = true;
+                return true;
+            }
+        }
+
+        ssize_t rc = read(m_fd, m_in.data + m_in_end, m_in.size - m_in_end);
+        if (rc > 0) {
+            m_in_end += static_cast<size_t>(rc);
+            continue;
+        }
+        if (rc == 0) {
+            m_eof = true;
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+// Passes the complete responses in the buffer to their callbacks. Returns true
+// if any response was complete. 'error' is set if the connection must fail.
+bool http::Client::Connection::process(Error& error)
+{
+    size_t max_size = m_client.m_config.max_response_size;
+    bool progress = false;
+
+    while (!in_flight.empty() && m_in_begin != m_in_end && !m_stream && !m_stream_broken) {
+        const char* data = m_in.data + m_in_begin;
+        size_t size = m_in_end - m_in_begin;
+        m_response.parse(data, size);
+
+        if (!m_response.valid) {
+            error = Error::InvalidResponse;
+            return progress;
+        }
+        if (!m_response.header_complete) {
+            if (size >= max_size)
+                error = Error::TooLarge;
+            return progress;
+        }
+
+        size_t header_size = static_cast<size_t>(m_response.body - data);
+        int status_code = m_response.status_code;
+        if (status_code >= 100 && status_code < 200 && status_code != 101) {
+            // An interim response precedes the final one.
+            m_in_begin += header_size;
+            reset_response();
+            continue;
+        }
+
+        // RFC 9112, section 6.3.
+        std::string_view body;
+        size_t response_size;
+        uint_least64_t stream_size = 0;
+        if (in_flight.front()->method == Method::HEAD || status_code < 200 ||
+            status_code == 204 || status_code == 304) {
+            response_size = header_size;
+        }
+        else if (m_response.chunked) {
+            if (!handle_chunked_body(data + header_size + m_chunked_consumed,
+                                     size - header_size - m_chunked_consumed, error))
+                return progress;
+            if (!m_chunked.done) {
+                if (size >= max_size)
+                    error = Error::TooLarge;
+                return progress;
+            }
+            body = m_body;
+            response_size = header_size + m_chunked_consumed;
+        }
+        else if (m_response.header(Header::ContentLength).data() &&
+                 in_flight.front()->stream_body && !m_response.complete) {
+            // The rest of the body is left in the socket for the stream.
+            body = std::string_view {m_response.body, size - header_size};
+            response_size = size;
+            stream_size = m_response.content_length - body.size();
+        }
+        else if (m_response.header(Header::ContentLength).data()) {
+            if (m_response.content_length > max_size - header_size) {
+                error = Error::TooLarge;
+                return progress;
+            }
+            if (!m_response.complete)
+                return progress;
+            body = std::string_view {m_response.body, m_response.content_length};
+            response_size = m_response.message_size;
+        }
+        else {
+            // The body ends when the connection is closed.
+            if (!m_eof) {
+                if (size >= max_size)
+                    error = Error::TooLarge;
+                return progress;
+            }
+            body = std::string_view {m_response.body, size - header_size};
+            response_size = size;
+            m_closing = true;
+        }
+
+        if (has_token(m_response.header_connection, "close"))
+            m_closing = true;
+        std::unique_ptr<Pending> pending = std::move(in_flight.front());
+        in_flight.pop_front();
+        ++m_num_responses;
+        m_in_begin += response_size;
+        progress = true;
+
+        std::unique_ptr<BodyStream> stream;
+        if (stream_size > 0) {
+            // The stream reads from a duplicate, which stays valid if the
+            // connection ends.
+            int fd = fcntl(m_fd, F_DUPFD_CLOEXEC, 0);
+            if (fd < 0) {
+                error = Error::Closed;
+                return progress;
+            }
+            stream.reset(new BodyStream {this, fd, stream_size});
+            m_stream = stream.get();
+        }
+
+        // The callback may send requests on this connection, which only
+        // appends to the output.
+        pending->callback(Error::None, m_response, body, std::move(stream));
+        reset_response();
+    }
+
+    if (in_flight.empty() && m_in_begin != m_in_end) {
+        // Bytes that no request asked for.
+        error = Error::InvalidResponse;
+        return progress;
+    }
+    if (m_in_begin == m_in_end)
+        m_in_begin = m_in_end = 0;
+    return progress;
+}
+
+// Decodes the newly received part of a chunked body. Returns false if 'error'
+// has been set.
+bool http::Client::Connection::handle_chunked_body(const char* data, size_t size, Error& error)
+{
+    while (size > 0 && !m_chunked.done && m_chunked.valid) {
+        std::string_view fragment;
+        size_t consumed = m_chunked.decode(data, size, fragment);
+        data += consumed;
+        size -= consumed;
+        m_chunked_consumed += consumed;
+        m_body.append(fragment);
+    }
+    if (!m_chunked.valid) {
+        error = Error::InvalidResponse;
+        return false;
+    }
+    return true;
+}
+
+void http::Client::Connection::reset_response()
+{
+    m_response = Message {Message::Kind::Response};
+    m_chunked = ChunkedDecoder {};
+    m_chunked_consumed = 0;
+    m_body.clear();
+}
+
+// Writes the output until it is written or the socket is full. Returns false
+// on a write error.
+bool http::Client::Connection::flush()
+{
+    while (m_out_offset < m_out.size()) {
+        ssize_t rc = ::send(m_fd, m_out.data() + m_out_offset, m_out.size() - m_out_offset,
+                            MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        m_out_offset += static_cast<size_t>(rc);
+    }
+    m_out.clear();
+    m_out_offset = 0;
+    return true;
+}
+
+// A Timer checks the timeouts every timer_interval_ms. Since handlers must not
+// destroy other handlers, the timeouts are checked after the events of the
+// iteration have been dispatched.
+class http::Client::Timer final: public EventLoop::Handler {
+public:
+
+    Timer(Client& client):
+        m_client {client}
+    {
+        m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ASSERT(m_fd >= 0);
+        int interval_ms = m_client.m_config.timer_interval_ms;
+        struct itimerspec spec {};
+        spec.it_interval.tv_sec = interval_ms / 1000;
+        spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+        spec.it_value = spec.it_interval;
+        timerfd_settime(m_fd, 0, &spec, nullptr);
+        bool rc = m_client.m_loop.add(m_fd, EPOLLIN | EPOLLET, *this);
+        ASSERT(rc);
+    }
+
+    ~Timer()
+    {
+        m_client.m_loop.remove(m_fd);
+        close(m_fd);
+    }
+
+    void on_event(uint32_t) override
+    {
+        uint64_t expirations;
+        ssize_t rc = read(m_fd, &expirations, sizeof expirations);
+        static_cast<void>(rc);
+        Client& client = m_client;
+        m_client.m_loop.post([&client] { client.check_timeouts(); });
+    }
+
+private:
+
+    Client& m_client;
+    int m_fd;
+};
+
+http::Client::Client(EventLoop& loop, const ClientConfig& config):
+    m_loop {loop},
+    m_config {config}
+{
+    ASSERT(m_config.max_connections_per_host > 0);
+    ASSERT(m_config.max_pipelined_requests > 0);
+    ASSERT(m_config.timer_interval_ms > 0);
+    m_timer.reset(new Timer {*this});
+}
+
+http::Client::~Client()
+{
+    for (auto& entry: m_pools) {
+        Pool& pool = *entry.second;
+        while (!pool.connections.empty())
+            pool.connections.back()->destroy();
+    }
+}
+
+bool http::Client::request(const char* address, uint16_t port, ClientRequest request,
+                           Callback callback)
+{
+    return queue(address, port, std::move(request),
+                 [callback = std::move(callback)](Error error, const Message& response,
+                                                  std::string_view body,
+                                                  std::unique_ptr<BodyStream>) {
+                     callback(error, response, body);
+                 },
+                 false);
+}
+
+bool http::Client::stream(const char* address, uint16_t port, ClientRequest request,
+                          StreamCallback callback)
+{
+    return queue(address, port, std::move(request), std::move(callback), true);
+}
+
+bool http::Client::queue(const char* address, uint16_t port, ClientRequest request,
+                         StreamCallback callback, bool stream_body)
+{
+    std::string key = std::string {address} + ' ' + std::to_string(port);
+    auto it = m_pools.find(key);
+    if (it == m_pools.end()) {
+        std::unique_ptr<Pool> pool {new Pool};
+        struct sockaddr_storage& addr = pool->addr;
+        addr = {};
+        auto* addr4 = reinterpret_cast<struct sockaddr_in*>(&addr);
+        auto* addr6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        if (inet_pton(AF_INET, address, &addr4->sin_addr) == 1) {
+            addr4->sin_family = AF_INET;
+            addr4->sin_port = htons(port);
+            pool->addr_size = sizeof *addr4;
+            pool->host = std::string {address} + ':' + std::to_string(port);
+        }
+        else if (inet_pton(AF_INET6, address, &addr6->sin6_addr) == 1) {
+            addr6->sin6_family = AF_INET6;
+            addr6->sin6_port = htons(port);
+            pool->addr_size = sizeof *addr6;
+            pool->host = '[' + std::string {address} + "]:" + std::to_string(port);
+        }
+        else {
+            errno = EINVAL;
+            return false;
+        }
+        it = m_pools.emplace(std::move(key), std::move(pool)).first;
+    }
+    Pool& pool = *it->second;
+
+    std::unique_ptr<Pending> pending {new Pending};
+    pending->method = request.method;
+    pending->callback = std::move(callback);
+    pending->stream_body = stream_body;
+    pending->deadline = time::monotonic_now() +
+        int_fast64_t(m_config.request_timeout_ms) * 1000000;
+
+    std::string& data = pending->data;
+    const char* target = request.request_target.c_str();
+    append(data, [&](char* buf, size_t size) {
+        return write_request_line(buf, size, request.method, target);
+    });
+    bool has_host = false;
+    bool has_length = false;
+    for (const auto& field: request.headers) {
+        Header header = header_from_name(field.first);
+        has_host = has_host || header == Header::Host;
+        has_length = has_length || header == Header::ContentLength ||
+            header == Header::TransferEncoding;
+        append(data, [&](char* buf, size_t size) {
+            return write_header(buf, size, std::string_view {field.first}, field.second);
+        });
+    }
+    if (!has_host) {
+        append(data, [&](char* buf, size_t size) {
+            return write_header(buf, size, header_name(Header::Host), pool.host);
+        });
+    }
+    if (!has_length && (!request.body.empty() || request.method == Method::POST ||
+                        request.method == Method::PUT)) {
+        std::string length = std::to_string(request.body.size());
+        append(data, [&](char* buf, size_t size) {
+            return write_header(buf, size, header_name(Header::ContentLength), length);
+        });
+    }
+    append(data, write_header_end);
+    data += request.body;
+
+    pool.queue.push_back(std::move(pending));
+    schedule(pool);
+    return true;
+}
+
+http::Client::BodyStream::BodyStream(Connection* connection, int fd, uint_least64_t size):
+    m_connection {connection},
+    m_fd {fd},
+    m_size {size}
+{
+}
+
+http::Client::BodyStream::~BodyStream()
+{
+    close(m_fd);
+    if (m_connection)
+        m_connection->end_stream(m_finished);
+}
+
+int http::Client::BodyStream::fd() const
+{
+    return m_fd;
+}
+
+uint_least64_t http::Client::BodyStream::size() const
+{
+    return m_size;
+}
+
+void http::Client::BodyStream::finish()
+{
+    m_finished = true;
+}
+
+size_t http::Client::num_connections() const
+{
+    size_t num = 0;
+    for (const auto& entry: m_pools)
+        num += entry.second->connections.size();
+    return num;
+}
+
+size_t http::Client::num_idle_connections() const
+{
+    size_t num = 0;
+    for (const auto& entry: m_pools) {
+        for (const Connection* connection: entry.second->connections)
+            num += connection->idle();
+    }
+    return num;
+}
+
+void http::Client::schedule(Pool& pool)
+{
+    while (!pool.queue.empty()) {
+        Connection* target = nullptr;
+        size_t num_connecting = 0;
+        for (Connection* connection: pool.connections) {
+            if (connection->connecting())
+                ++num_connecting;
+            else if (connection->idle()) {
+                target = connection;
+                break;
+            }
+        }
+
+        if (!target && num_connecting < pool.queue.size() &&
+            pool.connections.size() < m_config.max_connections_per_host) {
+            if (start_connection(pool))
+                continue;
+            if (pool.connections.empty())
+                return fail_queue(pool, Error::Connect);
+        }
+        if (!target && num_connecting >= pool.queue.size())
+            return;
+
+        if (!target) {
+            // At the limit, the connection with the fewest outstanding
+            // requests takes the request if it can be pipelined.
+            for (Connection* connection: pool.connections) {
+                if (connection->can_pipeline(*pool.queue.front()) &&
+                    (!target || connection->in_flight.size() < target->in_flight.size()))
+                    target = connection;
+            }
+            if (!target)
+                return;
+        }
+
+        std::unique_ptr<Pending> pending = std::move(pool.queue.front());
+        pool.queue.pop_front();
+        target->send(std::move(pending));
+    }
+}
+
+bool http::Client::start_connection(Pool& pool)
+{
+    int fd = socket(pool.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&pool.addr), pool.addr_size) != 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        return false;
+    }
+
+    // EPOLLOUT reports that the connection is established.
+    Connection* connection = new Connection {*this, pool, fd};
+    if (!m_loop.add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, *connection)) {
+        delete connection;
+        return false;
+    }
+    pool.connections.push_back(connection);
+    return true;
+}
+
+void http::Client::fail_queue(Pool& pool, Error error)
+{
+    std::deque<std::unique_ptr<Pending>> failed = std::move(pool.queue);
+    pool.queue.clear();
+    for (auto& pending: failed)
+        pending->callback(error, no_response(), {}, nullptr);
+}
+
+void http::Client::check_timeouts()
+{
+    int_fast64_t now = time::monotonic_now();
+    int_fast64_t idle_deadline = now - int_fast64_t(m_config.idle_timeout_ms) * 1000000;
+
+    for (auto& entry: m_pools) {
+        Pool& pool = *entry.second;
+
+        // The callbacks of failed connections may close others, so each
+        // connection is looked up before it is checked.
+        std::vector<Connection*> connections = pool.connections;
+        for (Connection* connection: connections) {
+            auto& current = pool.connections;
+            if (std::find(current.begin(), current.end(), connection) == current.end())
+                continue;
+            if (connection->idle() && connection->last_active < idle_deadline)
+                connection->destroy();
+            else if (connection->connecting() && connection->connect_deadline < now)
+                connection->connect_failed();
+            else if (!connection->in_flight.empty() &&
+                     connection->in_flight.front()->deadline < now)
+                connection->fail(Error::Timeout);
+        }
+
+        std::deque<std::unique_ptr<Pending>> expired;
+        for (auto it = pool.queue.begin(); it != pool.queue.end();) {
+            if ((*it)->deadline < now) {
+                expired.push_back(std::move(*it));
+                it = pool.queue.erase(it);
+            }
+            else
+                ++it;
+        }
+        for (auto& pending: expired)
+            pending->callback(Error::Timeout, no_response(), {}, nullptr);
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "http.hpp"
+#include "event_loop.hpp"
+
+namespace biohash {
+namespace http {
+
+struct ClientRequest {
+    Method method = Method::GET;
+    std::string request_target = "/";
+    // A Host header is added if there is none.
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+struct ClientConfig {
+    size_t max_connections_per_host = 8;
+    // The number of idempotent requests that may be outstanding on one
+    // connection once the connection limit of the host has been reached.
+    size_t max_pipelined_requests = 8;
+    int connect_timeout_ms = 5000;
+    // The time from queuing a request until its response has arrived.
+    int request_timeout_ms = 30000;
+    int idle_timeout_ms = 60000;
+    size_t max_response_size = 16 * 1024 * 1024;
+    // The resolution of the timeouts.
+    int timer_interval_ms = 100;
+};
+
+// A Client sends HTTP/1.1 requests on an EventLoop without blocking. Hosts
+// are given as IP addresses and ports, and each host has a pool of
+// connections that are kept alive and reused. Requests queue per host and
+// go to an idle connection, or a new one as long as the host is below its
+// connection limit. At the limit, idempotent requests are pipelined on
+// connections that only have idempotent requests outstanding.
+//
+// An idempotent request that was sent on a reused connection which then
+// closes without a response is retried once on another connection.
+//
+// With stream(), the body of a response with a Content-Length is left in the
+// socket, except for the bytes received along with the header, to be moved
+// elsewhere with splice(), see BodyStream.
+//
+// The Client must only be used on the loop's thread. Callbacks may send new
+// requests, but must not destroy the Client.
+class Client {
+public:
+
+    enum class Error {
+        None,
+        Connect,
+        Timeout,
+        Closed,
+        InvalidResponse,
+        TooLarge
+    };
+
+    // The response and the body refer to memory that is only valid during the
+    // callback. If error is not None, the response is empty.
+    using Callback = std::function<void(Error error, const Message& response,
+                                        std::string_view body)>;
+
+    class BodyStream;
+
+    // Like a Callback, where 'body' is the part of the body that has been
+    // received, and 'stream' the rest of it, or null if there is none.
+    using StreamCallback = std::function<void(Error error, const Message& response,
+                                              std::string_view body,
+                                              std::unique_ptr<BodyStream> stream)>;
+
+    Client(EventLoop& loop, const ClientConfig& config = ClientConfig {});
+    // Closes all connections. Outstanding callbacks are not called.
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    // 'address' is an IPv4 or IPv6 address. Returns false if it is not.
+    bool request(const char* address, uint16_t port, ClientRequest request, Callback callback);
+
+    // Like request(), but the body of a response with a Content-Length is not
+    // read beyond what has been received with the header.
+    bool stream(const char* address, uint16_t port, ClientRequest request,
+                StreamCallback callback);
+
+    size_t num_connections() const;
+    size_t num_idle_connections() const;
+
+private:
+
+    struct Pending;
+    struct Pool;
+    class Connection;
+    class Timer;
+    friend class Connection;
+
+    EventLoop& m_loop;
+    const ClientConfig m_config;
+    std::map<std::string, std::unique_ptr<Pool>> m_pools;
+    std::unique_ptr<Timer> m_timer;
+
+    bool queue(const char* address, uint16_t port, ClientRequest request,
+               StreamCallback callback, bool stream_body);
+    // Assigns queued requests to connections, opening new ones as needed.
+    void schedule(Pool& pool);
+    bool start_connection(Pool& pool);
+    void fail_queue(Pool& pool, Error error);
+    void check_timeouts();
+};
+
+// A BodyStream is the rest of a response body in the socket of its
+// connection. While it exists, the connection takes no further requests. The
+// connection is reused if the stream is destroyed after finish(), and closed
+// otherwise.
+class Client::BodyStream {
+public:
+
+    ~BodyStream();
+
+    BodyStream(const BodyStream&) = delete;
+    BodyStream& operator=(const BodyStream&) = delete;
+
+    // A non-blocking duplicate of the connection's socket, which is not
+    // registered with the loop.
+    int fd() const;
+
+    // The bytes of the body in the socket.
+    uint_least64_t size() const;
+
+    // Tells that the body has been read from the socket completely.
+    void finish();
+
+private:
+
+    friend class Client;
+
+    BodyStream(Connection* connection, int fd, uint_least64_t size);
+
+    // Null once the connection has ended.
+    Connection* m_connection;
+    const int m_fd;
+    const uint_least64_t m_size;
+    bool m_finished = false;
+};
+
+}
+}
@@ -0,0 +1,1090 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <vector>
+
+#include "http_server.hpp"
+#include "assert.hpp"
+#include "buffer.hpp"
+
+using namespace biohash;
+
+namespace {
+
+const char response_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+const char response_400[] =
+    "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char response_413[] =
+    "HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char response_431[] =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char response_500[] =
+    "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+
+constexpr size_t initial_buffer_size = 4096;
+
+// Answers with 500 if the handler built no response.
+void ensure_response(http::Response& response)
+{
+    if (response.builder.size() == 0 && response.file_size == 0 && response.splice_size == 0) {
+        response.reset();
+        response.builder.header_block(std::string_view {response_500, sizeof response_500 - 1});
+    }
+}
+
+} // anonymous namespace
+
+bool http::Response::send(int status_code, std::string_view content_type,
+                          std::string_view content)
+{
+    body.assign(content.data(), content.size());
+    return builder.status(status_code) && builder.date() &&
+        (content_type.empty() || builder.header(Header::ContentType, content_type)) &&
+        builder.content_length(body.size()) && builder.end_header() &&
+        builder.body(body.data(), body.size());
+}
+
+void http::Response::reset()
+{
+    builder.reset();
+    body.clear();
+    owner.reset();
+    file_fd = -1;
+    file_offset = 0;
+    file_size = 0;
+    splice_fd = -1;
+    splice_size = 0;
+    on_sent = nullptr;
+    deferred.reset();
+}
+
+std::shared_ptr<http::DeferredResponse> http::Response::defer()
+{
+    ASSERT(!deferred);
+    deferred = std::make_shared<DeferredResponse>();
+    deferred->m_response = this;
+    return deferred;
+}
+
+http::Response* http::DeferredResponse::response() const
+{
+    return m_response;
+}
+
+void http::DeferredResponse::complete()
+{
+    if (!m_response)
+        return;
+    ensure_response(*m_response);
+    m_response = nullptr;
+    m_completed = true;
+    if (m_on_complete) {
+        std::function<void()> on_complete = std::move(m_on_complete);
+        m_on_complete = nullptr;
+        on_complete();
+    }
+}
+
+http::BodySink::~BodySink()
+{
+}
+
+http::MemorySink::MemorySink(size_t max_size, Handler handler):
+    m_max_size {max_size},
+    m_handler {std::move(handler)}
+{
+}
+
+bool http::MemorySink::write(const char* data, size_t size)
+{
+    if (size > m_max_size - m_data.size())
+        return false;
+    m_data.append(data, size);
+    return true;
+}
+
+void http::MemorySink::finish(const Message& request, bool complete, Response& response)
+{
+    if (complete)
+        m_handler(request, m_data, response);
+    else
+        response.builder.header_block(std::string_view {response_413, sizeof response_413 - 1});
+}
+
+http::FileSink::FileSink(int fd, uint_least64_t offset, Handler handler):
+    m_fd {fd},
+    m_offset {offset},
+    m_handler {std::move(handler)}
+{
+}
+
+bool http::FileSink::write(const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t rc = pwrite(m_fd, data, size, static_cast<off_t>(m_offset + m_size));
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += rc;
+        size -= static_cast<size_t>(rc);
+        m_size += static_cast<uint_least64_t>(rc);
+    }
+    return true;
+}
+
+void http::FileSink::finish(const Message& request, bool complete, Response& response)
+{
+    if (complete)
+        m_handler(request, m_size, response);
+}
+
+http::HashSink::HashSink(Algorithm algorithm, Handler handler, std::unique_ptr<BodySink> next):
+    m_algorithm {algorithm},
+    m_handler {std::move(handler)},
+    m_next {std::move(next)}
+{
+}
+
+bool http::HashSink::write(const char* data, size_t size)
+{
+    if (m_algorithm == Algorithm::sha1)
+        m_sha1.update(data, size);
+    else
+        m_sha256.update(data, size);
+    m_size += size;
+    return !m_next || m_next->write(data, size);
+}
+
+void http::HashSink::finish(const Message& request, bool complete, Response& response)
+{
+    if (!complete) {
+        if (m_next)
+            m_next->finish(request, false, response);
+        return;
+    }
+
+    char digest[sha::Sha256::digest_size];
+    size_t digest_size;
+    if (m_algorithm == Algorithm::sha1) {
+        m_sha1.finish(digest);
+        digest_size = sha::Sha1::digest_size;
+    }
+    else {
+        m_sha256.finish(digest);
+        digest_size = sha::Sha256::digest_size;
+    }
+    const char hex_digits[] = "0123456789abcdef";
+    char hex[2 * sha::Sha256::digest_size];
+    for (size_t i = 0; i < digest_size; ++i) {
+        unsigned char byte = static_cast<unsigned char>(digest[i]);
+        hex[2 * i] = hex_digits[byte >> 4];
+        hex[2 * i + 1] = hex_digits[byte & 0xf];
+    }
+
+    m_handler(request, std::string_view {hex, 2 * digest_size}, m_size, response);
+    if (m_next && response.builder.size() == 0 && response.file_size == 0 &&
+        response.splice_size == 0)
+        m_next->finish(request, true, response);
+}
+
+// A Connection reads requests into its buffer, passes them to the handler and
+// writes the queued responses. It destroys itself when the connection ends.
+class http::Server::Connection final: public EventLoop::Handler {
+public:
+
+    Connection(Server& server, int fd);
+    ~Connection();
+
+    void on_event(uint32_t events) override;
+
+    // Removes the connection from the loop and the server and deletes it.
+    void destroy();
+
+    int_fast64_t last_active;
+
+private:
+
+    Server& m_server;
+    const int m_fd;
+
+    // The received bytes are [m_in_begin, m_in_end) of m_in, where
+    // m_in_begin is the start of the current request. While a body is
+    // streamed, the header is at the start of the buffer and followed by the
+    // body bytes not yet passed to the sink.
+    Buffer m_in {initial_buffer_size};
+    size_t m_in_begin = 0;
+    size_t m_in_end = 0;
+    bool m_read_blocked = false;
+    bool m_eof = false;
+
+    Message m_request {Message::Kind::Request};
+    ChunkedDecoder m_chunked;
+    // The bytes after the header consumed by m_chunked.
+    size_t m_chunked_consumed = 0;
+    std::string m_body;
+    bool m_header_handled = false;
+
+    std::unique_ptr<BodySink> m_sink;
+    size_t m_header_size = 0;
+    // The bytes of a body with a Content-Length still to be streamed.
+    uint_least64_t m_body_remaining = 0;
+
+    // The responses [m_first_response, m_num_responses) are being written.
+    std::vector<std::unique_ptr<Response>> m_responses;
+    size_t m_first_response = 0;
+    size_t m_num_responses = 0;
+    bool m_close_after_write = false;
+
+    // The deferred response that the requests after it wait for.
+    std::shared_ptr<DeferredResponse> m_deferred;
+
+    // The pipe of spliced bodies, created when first needed, and the number
+    // of bytes in it.
+    int m_pipe[2] = {-1, -1};
+    size_t m_pipe_size = 0;
+
+    class SpliceWaiter;
+    // Waits for the socket of the spliced body while it has no data.
+    std::shared_ptr<SpliceWaiter> m_splice_waiter;
+
+    size_t max_buffer_size() const;
+    bool read_input();
+    bool process();
+    bool handle_header(size_t header_size);
+    bool stream_body(bool& done);
+    bool handle_chunked_body();
+    void reset_request();
+    Response& next_response();
+    void handled(Response& response);
+    void complete_deferred();
+    void queue_error(const char* response, size_t size);
+    bool flush();
+    bool wait_for_splice(int fd);
+    void stop_splice_wait();
+    void complete_response();
+    void rearm();
+};
+
+// A SpliceWaiter is registered for the socket of a spliced body that has no
+// data. Handlers must not destroy other handlers, so it does not call its
+// connection but has the loop report it again, and it outlives its removal
+// until the events of the iteration have been dispatched.
+class http::Server::Connection::SpliceWaiter final: public EventLoop::Handler {
+public:
+
+    SpliceWaiter(Connection& connection, int fd):
+        connection {&connection},
+        fd {fd}
+    {
+    }
+
+    void on_event(uint32_t) override
+    {
+        if (connection)
+            connection->rearm();
+    }
+
+    // Null once the waiter has been removed.
+    Connection* connection;
+    const int fd;
+};
+
+http::Server::Connection::Connection(Server& server, int fd):
+    last_active {server.m_loop.now()},
+    m_server {server},
+    m_fd {fd}
+{
+}
+
+http::Server::Connection::~Connection()
+{
+    stop_splice_wait();
+    if (m_deferred) {
+        m_deferred->m_response = nullptr;
+        m_deferred->m_on_complete = nullptr;
+    }
+    close(m_fd);
+    if (m_pipe[0] >= 0) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+    }
+}
+
+void http::Server::Connection::destroy()
+{
+    m_server.m_loop.remove(m_fd);
+    m_server.m_connections.erase(this);
+    delete this;
+}
+
+void http::Server::Connection::on_event(uint32_t events)
+{
+    last_active = m_server.m_loop.now();
+    if (events & EPOLLERR)
+        return destroy();
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !read_input())
+        return destroy();
+
+    for (;;) {
+        if (m_read_blocked && !read_input())
+            return destroy();
+        if (m_first_response != m_num_responses) {
+            if (!flush())
+                return destroy();
+            // The rest is written on EPOLLOUT.
+            if (m_first_response != m_num_responses)
+                return;
+        }
+        if (m_close_after_write)
+            return destroy();
+        if (!process())
+            break;
+    }
+
+    if (m_eof)
+        destroy();
+}
+
+size_t http::Server::Connection::max_buffer_size() const
+{
+    // A streamed body is passed on before more of it is read.
+    if (m_sink)
+        return m_header_size + m_server.m_config.body_window;
+    return m_server.m_config.max_header_size + m_server.m_config.max_body_size;
+}
+
+bool http::Server::Connection::read_input()
+{
+    m_read_blocked = false;
+    for (;;) {
+        // The buffer may be larger than the window of a streamed body.
+        size_t capacity = std::min(m_in.size, max_buffer_size());
+        if (m_in_end == capacity) {
+            if (m_in_begin > 0) {
+                // The request moves to the start of the buffer and is rebased
+                // when it is parsed next.
+                memmove(m_in.data, m_in.data + m_in_begin, m_in_end - m_in_begin);
+                m_in_end -= m_in_begin;
+                m_in_begin = 0;
+                continue;
+            }
+            if (m_in.size < max_buffer_size()) {
+                m_in.resize(std::min(2 * m_in.size, max_buffer_size()));
+                continue;
+            }
+            m_read_blocked = true;
+            return true;
+        }
+
+        ssize_t rc = m_server.m_loop.read(m_fd, m_in.data + m_in_end, capacity - m_in_end);
+        if (rc > 0) {
+            m_in_end += static_cast<size_t>(rc);
+            continue;
+        }
+        if (rc == 0) {
+            m_eof = true;
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+// Handles up to max_pipelined_requests complete requests from the buffer.
+// Returns true if any response was queued or body bytes were streamed.
+bool http::Server::Connection::process()
+{
+    const ServerConfig& config = m_server.m_config;
+    size_t num_handled = 0;
+    bool progress = false;
+
+    while (num_handled < config.max_pipelined_requests && !m_close_after_write &&
+           !m_deferred && m_in_begin != m_in_end) {
+        if (m_sink) {
+            size_t in_end = m_in_end;
+            bool done;
+            if (!stream_body(done))
+                return true;
+            progress = progress || m_in_end != in_end;
+            if (!done)
+                break;
+
+            Response& response = next_response();
+            m_sink->finish(m_request, true, response);
+            handled(response);
+            if (has_token(m_request.header_connection, "close"))
+                m_close_after_write = true;
+
+            // The bytes after the body have been moved to the end of the
+            // header.
+            m_in_begin += m_header_size;
+            reset_request();
+            ++num_handled;
+            continue;
+        }
+
+        const char* data = m_in.data + m_in_begin;
+        size_t size = m_in_end - m_in_begin;
+        m_request.parse(data, size);
+
+        if (!m_request.valid) {
+            queue_error(response_400, sizeof response_400 - 1);
+            return true;
+        }
+        if (!m_request.header_complete) {
+            if (size > config.max_header_size) {
+                queue_error(response_431, sizeof response_431 - 1);
+                return true;
+            }
+            break;
+        }
+        size_t header_size = static_cast<size_t>(m_request.body - data);
+        if (header_size > config.max_header_size) {
+            queue_error(response_431, sizeof response_431 - 1);
+            return true;
+        }
+        if (!m_header_handled) {
+            size_t num_responses = m_num_responses;
+            if (!handle_header(header_size))
+                return true;
+            progress = progress || m_num_responses != num_responses;
+            if (m_sink)
+                continue;
+        }
+        if (!m_request.complete)
+            break;
+
+        std::string_view body {m_request.body, m_request.content_length};
+        size_t request_size = m_request.message_size;
+        if (m_request.chunked) {
+            if (!handle_chunked_body())
+                return true;
+            if (!m_chunked.done) {
+                if (size == max_buffer_size()) {
+                    queue_error(response_413, sizeof response_413 - 1);
+                    return true;
+                }
+                break;
+            }
+            body = m_body;
+            request_size += m_chunked_consumed;
+        }
+
+        Response& response = next_response();
+        m_server.m_handler(m_request, body, response);
+        handled(response);
+        if (has_token(m_request.header_connection, "close"))
+            m_close_after_write = true;
+
+        m_in_begin += request_size;
+        reset_request();
+        ++num_handled;
+    }
+
+    if (m_in_begin == m_in_end)
+        m_in_begin = m_in_end = 0;
+    return num_handled > 0 || progress;
+}
+
+// Called once the header of the current request is complete. Starts to
+// stream the body if the body handler returns a sink, and answers "Expect:
+// 100-continue". Returns false if a response that ends the connection has
+// been queued.
+bool http::Server::Connection::handle_header(size_t header_size)
+{
+    const ServerConfig& config = m_server.m_config;
+    m_header_handled = true;
+    bool has_body = m_request.chunked || m_request.content_length > 0;
+
+    if (has_body && m_server.m_body_handler) {
+        Response& response = next_response();
+        m_sink = m_server.m_body_handler(m_request, response);
+        if (response.builder.size() > 0 || response.file_size > 0 || response.splice_size > 0) {
+            m_sink.reset();
+            m_close_after_write = true;
+            return false;
+        }
+        --m_num_responses;
+
+        if (m_sink) {
+            // The header moves to the start of the buffer, which is made
+            // large enough for it and the window of the body.
+            if (m_in_begin > 0) {
+                memmove(m_in.data, m_in.data + m_in_begin, m_in_end - m_in_begin);
+                m_in_end -= m_in_begin;
+                m_in_begin = 0;
+            }
+            if (m_in.size < header_size + config.body_window)
+                m_in.resize(header_size + config.body_window);
+            m_request.parse(m_in.data, m_request.buf_size);
+            m_header_size = header_size;
+            m_body_remaining = m_request.content_length;
+        }
+    }
+    if (!m_sink && m_request.content_length > config.max_body_size) {
+        queue_error(response_413, sizeof response_413 - 1);
+        return false;
+    }
+
+    if (has_body && m_in_end - m_in_begin == header_size &&
+        has_token(m_request.header(Header::Expect), "100-continue")) {
+        next_response().builder.header_block(std::string_view {response_100,
+            sizeof response_100 - 1});
+    }
+    return true;
+}
+
+// Passes the received body bytes to the sink and moves the bytes that follow
+// the body to the end of the header. 'done' is set when the body is
+// complete. Returns false if an error response has been queued.
+bool http::Server::Connection::stream_body(bool& done)
+{
+    char* begin = m_in.data + m_header_size;
+    const char* data = begin;
+    size_t size = m_in_end - m_header_size;
+    bool written = true;
+
+    if (m_request.chunked) {
+        while (size > 0 && !m_chunked.done && m_chunked.valid && written) {
+            std::string_view fragment;
+            size_t consumed = m_chunked.decode(data, size, fragment);
+            data += consumed;
+            size -= consumed;
+            if (!fragment.empty())
+                written = m_sink->write(fragment.data(), fragment.size());
+        }
+        if (!m_chunked.valid) {
+            queue_error(response_400, sizeof response_400 - 1);
+            return false;
+        }
+        done = m_chunked.done;
+    }
+    else {
+        size_t n = static_cast<size_t>(std::min<uint_least64_t>(size, m_body_remaining));
+        if (n > 0)
+            written = m_sink->write(data, n);
+        data += n;
+        size -= n;
+        m_body_remaining -= n;
+        done = m_body_remaining == 0;
+    }
+
+    if (data != begin) {
+        memmove(begin, data, size);
+        m_in_end -= static_cast<size_t>(data - begin);
+    }
+    if (!written) {
+        Response& response = next_response();
+        m_sink->finish(m_request, false, response);
+        handled(response);
+        m_close_after_write = true;
+        return false;
+    }
+    return true;
+}
+
+// Decodes the newly received part of a chunked body. Returns false if an error
+// response has been queued.
+bool http::Server::Connection::handle_chunked_body()
+{
+    const char* data = m_request.body + m_chunked_consumed;
+    size_t size = m_in_end - m_in_begin - m_request.message_size - m_chunked_consumed;
+    while (size > 0 && !m_chunked.done && m_chunked.valid) {
+        std::string_view fragment;
+        size_t consumed = m_chunked.decode(data, size, fragment);
+        data += consumed;
+        size -= consumed;
+        m_chunked_consumed += consumed;
+        if (m_body.size() + fragment.size() > m_server.m_config.max_body_size) {
+            queue_error(response_413, sizeof response_413 - 1);
+            return false;
+        }
+        m_body.append(fragment);
+    }
+    if (!m_chunked.valid) {
+        queue_error(response_400, sizeof response_400 - 1);
+        return false;
+    }
+    return true;
+}
+
+void http::Server::Connection::reset_request()
+{
+    m_request = Message {Message::Kind::Request};
+    m_chunked = ChunkedDecoder {};
+    m_chunked_consumed = 0;
+    m_body.clear();
+    m_header_handled = false;
+    m_sink.reset();
+    m_header_size = 0;
+    m_body_remaining = 0;
+}
+
+http::Response& http::Server::Connection::next_response()
+{
+    if (m_num_responses == m_responses.size())
+        m_responses.emplace_back(new Response);
+    Response& response = *m_responses[m_num_responses++];
+    response.reset();
+    return response;
+}
+
+// Called once a handler has built a response or deferred it. No further
+// requests are handled until a deferred response is complete.
+void http::Server::Connection::handled(Response& response)
+{
+    const std::shared_ptr<DeferredResponse>& deferred = response.deferred;
+    if (deferred && deferred->m_response) {
+        m_deferred = deferred;
+        m_deferred->m_on_complete = [this] { complete_deferred(); };
+        return;
+    }
+    ensure_response(response);
+}
+
+// Called when the deferred response has been completed, possibly by another
+// handler, so the connection only has the loop report it again.
+void http::Server::Connection::complete_deferred()
+{
+    m_deferred.reset();
+    rearm();
+}
+
+// Queues a static error response after which the connection is closed.
+void http::Server::Connection::queue_error(const char* response, size_t size)
+{
+    next_response().builder.header_block(std::string_view {response, size});
+    m_close_after_write = true;
+}
+
+// Writes the queued responses until they are written or the socket is full.
+// Returns false on a write error, or if a file or socket ends before its body.
+bool http::Server::Connection::flush()
+{
+    constexpr int max_iov = 64;
+    // The largest count sendfile() transfers at once.
+    constexpr uint_least64_t max_sendfile_size = 0x7ffff000;
+    // The default capacity of a pipe.
+    constexpr uint_least64_t max_splice_size = 64 * 1024;
+
+    while (m_first_response != m_num_responses) {
+        Response& first = *m_responses[m_first_response];
+        // A deferred response is written once it is complete.
+        if (first.deferred && first.deferred->m_response)
+            return true;
+        if (first.builder.size() == 0 && first.file_size > 0) {
+            off_t offset = static_cast<off_t>(first.file_offset);
+            size_t count = static_cast<size_t>(std::min(first.file_size, max_sendfile_size));
+            ssize_t rc = sendfile(m_fd, first.file_fd, &offset, count);
+            if (rc <= 0) {
+                if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                if (rc < 0 && errno == EINTR)
+                    continue;
+                return false;
+            }
+            first.file_offset += static_cast<uint_least64_t>(rc);
+            first.file_size -= static_cast<uint_least64_t>(rc);
+            if (first.file_size == 0)
+                complete_response();
+            continue;
+        }
+        if (first.builder.size() == 0 && (first.splice_size > 0 || m_pipe_size > 0)) {
+            if (m_pipe[0] < 0 && pipe2(m_pipe, O_CLOEXEC) != 0)
+                return false;
+            // The pipe is refilled once the client has taken its content.
+            if (m_pipe_size == 0) {
+                size_t count = static_cast<size_t>(std::min(first.splice_size, max_splice_size));
+                ssize_t rc = splice(first.splice_fd, nullptr, m_pipe[1], nullptr, count,
+                                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (rc <= 0) {
+                    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return wait_for_splice(first.splice_fd);
+                    if (rc < 0 && errno == EINTR)
+                        continue;
+                    return false;
+                }
+                m_pipe_size = static_cast<size_t>(rc);
+                first.splice_size -= static_cast<uint_least64_t>(rc);
+            }
+            ssize_t rc = splice(m_pipe[0], nullptr, m_fd, nullptr, m_pipe_size,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (rc <= 0) {
+                if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                if (rc < 0 && errno == EINTR)
+                    continue;
+                return false;
+            }
+            m_pipe_size -= static_cast<size_t>(rc);
+            if (first.splice_size == 0 && m_pipe_size == 0)
+                complete_response();
+            continue;
+        }
+
+        // The segments up to the header of the next file body, which follows
+        // in the same packet if possible.
+        struct iovec iov[max_iov];
+        int num_iov = 0;
+        int flags = MSG_NOSIGNAL;
+        for (size_t i = m_first_response; i < m_num_responses && num_iov < max_iov; ++i) {
+            const Response& response = *m_responses[i];
+            if (response.deferred && response.deferred->m_response)
+                break;
+            int n = std::min(response.builder.num_segments(), max_iov - num_iov);
+            std::copy(response.builder.segments(), response.builder.segments() + n, iov + num_iov);
+            num_iov += n;
+            if (response.file_size > 0 || response.splice_size > 0) {
+                flags |= MSG_MORE;
+                break;
+            }
+        }
+
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = static_cast<size_t>(num_iov);
+        ssize_t rc = sendmsg(m_fd, &msg, flags);
+        if (rc < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        size_t written = static_cast<size_t>(rc);
+        while (m_first_response != m_num_responses) {
+            Response& response = *m_responses[m_first_response];
+            if (response.deferred && response.deferred->m_response)
+                break;
+            size_t size = response.builder.size();
+            if (written < size) {
+                response.builder.consume(written);
+                break;
+            }
+            response.builder.consume(size);
+            written -= size;
+            if (response.file_size > 0 || response.splice_size > 0)
+                break;
+            complete_response();
+        }
+    }
+
+    m_first_response = 0;
+    m_num_responses = 0;
+    return true;
+}
+
+// Registers a waiter for the socket of the spliced body, which has no data.
+// Returns false if the registration fails.
+bool http::Server::Connection::wait_for_splice(int fd)
+{
+    if (m_splice_waiter)
+        return true;
+    std::shared_ptr<SpliceWaiter> waiter = std::make_shared<SpliceWaiter>(*this, fd);
+    if (!m_server.m_loop.add(fd, EPOLLIN | EPOLLRDHUP | EPOLLET, *waiter))
+        return false;
+    m_splice_waiter = std::move(waiter);
+    return true;
+}
+
+void http::Server::Connection::stop_splice_wait()
+{
+    if (!m_splice_waiter)
+        return;
+    m_server.m_loop.remove(m_splice_waiter->fd);
+    m_splice_waiter->connection = nullptr;
+    // An event of the waiter may still be dispatched in this iteration.
+    std::shared_ptr<SpliceWaiter> waiter = std::move(m_splice_waiter);
+    m_server.m_loop.post([waiter] {});
+}
+
+// Resets the first queued response after it has been written.
+void http::Server::Connection::complete_response()
+{
+    Response& response = *m_responses[m_first_response++];
+    stop_splice_wait();
+    if (response.on_sent)
+        response.on_sent();
+    response.reset();
+}
+
+// Has the loop report the connection again, which other handlers use instead
+// of calling it. Modifying the registration reports the state of the socket,
+// and the socket is writable unless the responses before are being written,
+// which report it when they are.
+void http::Server::Connection::rearm()
+{
+    m_server.m_loop.modify(m_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, *this);
+}
+
+// A Timer closes idle connections once per second. Since handlers must not
+// destroy other handlers, the connections are closed after the events of the
+// iteration have been dispatched.
+class http::Server::Timer final: public EventLoop::Handler {
+public:
+
+    Timer(Server& server):
+        m_server {server}
+    {
+        m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ASSERT(m_fd >= 0);
+        struct itimerspec spec {};
+        spec.it_interval.tv_sec = 1;
+        spec.it_value.tv_sec = 1;
+        timerfd_settime(m_fd, 0, &spec, nullptr);
+        bool rc = m_server.m_loop.add(m_fd, EPOLLIN | EPOLLET, *this);
+        ASSERT(rc);
+    }
+
+    ~Timer()
+    {
+        m_server.m_loop.remove(m_fd);
+        close(m_fd);
+    }
+
+    void on_event(uint32_t) override
+    {
+        uint64_t expirations;
+        ssize_t rc = read(m_fd, &expirations, sizeof expirations);
+        static_cast<void>(rc);
+        Server& server = m_server;
+        m_server.m_loop.post([&server] { server.close_idle_connections(); });
+    }
+
+private:
+
+    Server& m_server;
+    int m_fd;
+};
+
+http::Server::Server(EventLoop& loop, Handler handler, const ServerConfig& config):
+    m_loop {loop},
+    m_handler {std::move(handler)},
+    m_config {config}
+{
+    ASSERT(m_config.max_pipelined_requests > 0);
+    ASSERT(m_config.body_window > 0);
+}
+
+http::Server::~Server()
+{
+    while (!m_connections.empty())
+        (*m_connections.begin())->destroy();
+    if (m_listen_fd >= 0) {
+        m_loop.remove(m_listen_fd);
+        close(m_listen_fd);
+    }
+}
+
+bool http::Server::listen(const char* address, uint16_t port)
+{
+    ASSERT(m_listen_fd < 0);
+
+    struct sockaddr_storage addr {};
+    socklen_t addr_size;
+    auto* addr4 = reinterpret_cast<struct sockaddr_in*>(&addr);
+    auto* addr6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+    if (inet_pton(AF_INET, address, &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(port);
+        addr_size = sizeof *addr4;
+    }
+    else if (inet_pton(AF_INET6, address, &addr6->sin6_addr) == 1) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(port);
+        addr_size = sizeof *addr6;
+    }
+    else {
+        errno = EINVAL;
+        return false;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (m_config.reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_size) != 0 ||
+        ::listen(fd, m_config.backlog) != 0 ||
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_size) != 0 ||
+        !m_loop.add(fd, EPOLLIN | EPOLLET, *this, EventLoop::Mode::listener)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    m_listen_fd = fd;
+    m_port = ntohs(addr.ss_family == AF_INET ? addr4->sin_port : addr6->sin6_port);
+    if (!m_timer)
+        m_timer.reset(new Timer {*this});
+    return true;
+}
+
+uint16_t http::Server::port() const
+{
+    return m_port;
+}
+
+void http::Server::set_body_handler(BodyHandler handler)
+{
+    m_body_handler = std::move(handler);
+}
+
+size_t http::Server::num_connections() const
+{
+    return m_connections.size();
+}
+
+void http::Server::on_event(uint32_t)
+{
+    for (;;) {
+        int fd = m_loop.accept(m_listen_fd);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // EAGAIN, or out of descriptors in which case the pending
+            // connections are tried again on the next connection.
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+        Connection* connection = new Connection {*this, fd};
+        if (!m_loop.add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, *connection,
+                        EventLoop::Mode::stream)) {
+            delete connection;
+            continue;
+        }
+        m_connections.insert(connection);
+    }
+}
+
+void http::Server::close_idle_connections()
+{
+    int_fast64_t deadline = m_loop.now() - int_fast64_t(m_config.idle_timeout) * 1000000000;
+    std::vector<Connection*> idle;
+    for (Connection* connection: m_connections) {
+        if (connection->last_active < deadline)
+            idle.push_back(connection);
+    }
+    for (Connection* connection: idle)
+        connection->destroy();
+}
+
+http::MultiServer::MultiServer(size_t num_reactors, Server::Handler handler,
+                               const ServerConfig& config, bool pin_threads):
+    m_num_reactors {num_reactors},
+    m_handler {std::move(handler)},
+    m_config {config},
+    m_pin_threads {pin_threads}
+{
+    ASSERT(num_reactors > 0);
+    m_config.reuse_port = true;
+}
+
+http::MultiServer::~MultiServer()
+{
+    stop();
+}
+
+bool http::MultiServer::start(const char* address, uint16_t port)
+{
+    ASSERT(m_reactors.empty());
+
+    // The first server chooses the port if it is zero.
+    for (size_t i = 0; i < m_num_reactors; ++i) {
+        std::unique_ptr<Reactor> reactor {new Reactor {m_config.backend}};
+        reactor->server.reset(new Server {reactor->loop, m_handler, m_config});
+        reactor->server->set_body_handler(m_body_handler);
+        if (!reactor->server->listen(address, port)) {
+            int error = errno;
+            m_reactors.clear();
+            errno = error;
+            return false;
+        }
+        port = reactor->server->port();
+        m_reactors.push_back(std::move(reactor));
+    }
+    m_port = port;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool pin = m_pin_threads && sched_getaffinity(0, sizeof allowed, &allowed) == 0;
+    int num_cpus = CPU_COUNT(&allowed);
+
+    for (size_t i = 0; i < m_reactors.size(); ++i) {
+        Reactor& reactor = *m_reactors[i];
+        reactor.thread = std::thread {[&reactor] { reactor.loop.run(); }};
+        if (!pin || num_cpus == 0)
+            continue;
+
+        // The i'th allowed CPU, wrapping around.
+        int nth = static_cast<int>(i % num_cpus);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed) && nth-- == 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_setaffinity_np(reactor.thread.native_handle(), sizeof set, &set);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+void http::MultiServer::stop()
+{
+    for (auto& reactor: m_reactors)
+        reactor->loop.stop();
+    for (auto& reactor: m_reactors) {
+        if (reactor->thread.joinable())
+            reactor->thread.join();
+    }
+    m_reactors.clear();
+}
+
+void http::MultiServer::set_body_handler(Server::BodyHandler handler)
+{
+    ASSERT(m_reactors.empty());
+    m_body_handler = std::move(handler);
+}
+
+uint16_t http::MultiServer::port() const
+{
+    return m_port;
+}
+
+size_t http::MultiServer::size() const
+{
+    return m_num_reactors;
+}
+
+EventLoop::Backend http::MultiServer::backend() const
+{
+    ASSERT(!m_reactors.empty());
+    return m_reactors.front()->loop.backend();
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "http.hpp"
+#include "event_loop.hpp"
+#include "sha.hpp"
+
+namespace biohash {
+namespace http {
+
+class DeferredResponse;
+
+// The response to a request. The handler adds the status line, the header
+// fields and the body to 'builder'. Memory referenced by the builder must stay
+// valid until the response has been written, which is the case for 'body' and
+// for anything kept alive by 'owner'.
+//
+// A body may also be sent from a file with sendfile(), after the builder's
+// segments. 'owner' must then keep 'file_fd' open. Alternatively, a body of
+// 'splice_size' bytes may be moved from the socket 'splice_fd' with splice(),
+// through a pipe of the connection, such that it is not copied to user space.
+// The socket must be non-blocking, and the server waits for it on the loop
+// while it has no data. It must therefore not be registered with the loop
+// otherwise, although a duplicate of it may be. 'owner' must keep it open.
+//
+// A handler that cannot answer at once, such as one that waits for a request
+// of its own on the loop, calls defer() and returns with the response empty.
+struct Response {
+
+    ResponseBuilder builder;
+    std::string body;
+    std::shared_ptr<const void> owner;
+    int file_fd = -1;
+    uint_least64_t file_offset = 0;
+    uint_least64_t file_size = 0;
+    int splice_fd = -1;
+    uint_least64_t splice_size = 0;
+    // Called once the response has been written completely, before it is
+    // reset.
+    std::function<void()> on_sent;
+    // Set by defer().
+    std::shared_ptr<DeferredResponse> deferred;
+
+    // Builds a complete response with a Date, Content-Type and Content-Length
+    // header from a copy of 'content'. An empty 'content_type' is omitted.
+    bool send(int status_code, std::string_view content_type, std::string_view content);
+
+    // Defers the response until the returned object completes it.
+    std::shared_ptr<DeferredResponse> defer();
+
+    void reset();
+};
+
+// A DeferredResponse builds and sends a response after its handler has
+// returned, on the loop's thread. The requests that follow on the connection
+// wait for it. Handlers that wrap others, such as a ResponseCache or a
+// Compressor, pass a deferred response on as it is.
+class DeferredResponse {
+public:
+
+    // The response to build, or null once it has been completed or its
+    // connection has ended.
+    Response* response() const;
+
+    // Sends the response. An empty response is answered with 500.
+    void complete();
+
+private:
+
+    friend struct Response;
+    friend class Server;
+
+    Response* m_response = nullptr;
+    bool m_completed = false;
+    // Set by the connection that waits for the response.
+    std::function<void()> m_on_complete;
+};
+
+struct ServerConfig {
+    // Requests with a larger header are answered with 431 and larger bodies
+    // with 413, after which the connection is closed.
+    size_t max_header_size = 64 * 1024;
+    size_t max_body_size = 16 * 1024 * 1024;
+    // The body bytes buffered at once for a request whose body is streamed to
+    // a BodySink. max_body_size does not apply to such bodies.
+    size_t body_window = 64 * 1024;
+    // The number of pipelined requests answered in one batch.
+    size_t max_pipelined_requests = 16;
+    // Connections without activity for this many seconds are closed.
+    int idle_timeout = 60;
+    int backlog = 1024;
+    // Sets SO_REUSEPORT on the listening socket, so that several servers can
+    // listen on the same port and the kernel spreads connections over them.
+    bool reuse_port = false;
+    // The backend of the event loops created by MultiServer.
+    EventLoop::Backend backend = EventLoop::Backend::epoll;
+};
+
+// A BodySink receives the body of a request in fragments as it arrives, see
+// Server::set_body_handler().
+class BodySink {
+public:
+
+    virtual ~BodySink();
+
+    // Called with successive fragments of the body. The data is only valid
+    // during the call. Returning false ends the request, after finish() has
+    // been called with 'complete' false, and closes the connection.
+    virtual bool write(const char* data, size_t size) = 0;
+
+    // Called when the body has been received, or after write() failed, to
+    // build the response. An empty response is answered with 500. A sink
+    // whose connection ends earlier is destroyed without finish().
+    virtual void finish(const Message& request, bool complete, Response& response) = 0;
+};
+
+// A MemorySink collects a body of up to 'max_size' bytes and then calls the
+// handler with it, like a buffered request. A larger body is answered with 413.
+class MemorySink: public BodySink {
+public:
+
+    using Handler = std::function<void(const Message& request, std::string_view body,
+                                       Response& response)>;
+
+    MemorySink(size_t max_size, Handler handler);
+
+    bool write(const char* data, size_t size) override;
+    void finish(const Message& request, bool complete, Response& response) override;
+
+private:
+
+    const size_t m_max_size;
+    const Handler m_handler;
+    std::string m_data;
+};
+
+// A FileSink writes a body to 'fd' with pwrite(), starting at 'offset', and
+// then calls the handler with the size of the body. The descriptor is not
+// closed. A failed write is answered with 500.
+class FileSink: public BodySink {
+public:
+
+    using Handler = std::function<void(const Message& request, uint_least64_t size,
+                                       Response& response)>;
+
+    FileSink(int fd, uint_least64_t offset, Handler handler);
+
+    bool write(const char* data, size_t size) override;
+    void finish(const Message& request, bool complete, Response& response) override;
+
+private:
+
+    const int m_fd;
+    const uint_least64_t m_offset;
+    const Handler m_handler;
+    uint_least64_t m_size = 0;
+};
+
+// A HashSink computes the SHA-1 or SHA-256 digest of a body as it arrives and
+// passes the fragments on to 'next', if any, such as a FileSink that stores
+// the body. When the body is complete, the handler is called with the digest
+// in lower case hex and the size of the body. If it leaves the response
+// empty, the response is built by the finish() of 'next'.
+class HashSink: public BodySink {
+public:
+
+    enum class Algorithm {
+        sha1,
+        sha256
+    };
+
+    using Handler = std::function<void(const Message& request, std::string_view digest,
+                                       uint_least64_t size, Response& response)>;
+
+    HashSink(Algorithm algorithm, Handler handler, std::unique_ptr<BodySink> next = nullptr);
+
+    bool write(const char* data, size_t size) override;
+    void finish(const Message& request, bool complete, Response& response) override;
+
+private:
+
+    const Algorithm m_algorithm;
+    const Handler m_handler;
+    const std::unique_ptr<BodySink> m_next;
+    sha::Sha1 m_sha1;
+    sha::Sha256 m_sha256;
+    uint_least64_t m_size = 0;
+};
+
+// A Server is an HTTP/1.1 server on an EventLoop. It accepts connections on
+// a listening socket and reads requests into a buffer per connection. Every
+// complete request is passed to the handler together with its body, which is
+// de-chunked if needed. The responses of pipelined requests are written
+// together with one sendmsg(), file bodies with sendfile() and socket bodies
+// with splice(). Connections are kept alive unless the client sends
+// "Connection: close".
+//
+// Alternatively, the body of a request may be streamed to a BodySink, with at
+// most ServerConfig::body_window bytes of it buffered at a time. A request
+// with "Expect: 100-continue" receives the interim 100 response once its
+// header has been accepted, unless the body has started to arrive.
+class Server: private EventLoop::Handler {
+public:
+
+    using Handler = std::function<void(const Message& request, std::string_view body,
+                                       Response& response)>;
+
+    // Called once the header of a request with a body is complete. Returning
+    // a sink streams the body to it instead of the handler being called.
+    // Building a response rejects the request without reading the body, after
+    // which the connection is closed. Returning null with an empty response
+    // buffers the body as usual.
+    using BodyHandler = std::function<std::unique_ptr<BodySink>(const Message& request,
+                                                                Response& response)>;
+
+    Server(EventLoop& loop, Handler handler, const ServerConfig& config = ServerConfig {});
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Listens on 'address', an IPv4 or IPv6 address, and 'port', where port
+    // zero selects a free port. Returns false, with errno set, on failure.
+    bool listen(const char* address, uint16_t port);
+
+    // The port listened on.
+    uint16_t port() const;
+
+    void set_body_handler(BodyHandler handler);
+
+    size_t num_connections() const;
+
+private:
+
+    class Connection;
+    class Timer;
+    friend class Connection;
+
+    EventLoop& m_loop;
+    Handler m_handler;
+    BodyHandler m_body_handler;
+    const ServerConfig m_config;
+    int m_listen_fd = -1;
+    uint16_t m_port = 0;
+    std::unordered_set<Connection*> m_connections;
+    std::unique_ptr<Timer> m_timer;
+
+    void on_event(uint32_t events) override;
+    void close_idle_connections();
+};
+
+// A MultiServer runs a number of reactors, each a thread with its own
+// EventLoop and Server listening with SO_REUSEPORT on the same port. The
+// reactors share nothing, and the handler is called concurrently from their
+// threads. Optionally, reactor i is pinned to the i'th CPU the process may
+// run on.
+class MultiServer {
+public:
+
+    MultiServer(size_t num_reactors, Server::Handler handler,
+                const ServerConfig& config = ServerConfig {}, bool pin_threads = false);
+    ~MultiServer();
+
+    MultiServer(const MultiServer&) = delete;
+    MultiServer& operator=(const MultiServer&) = delete;
+
+    // Listens on 'address' and 'port', see Server::listen(), and starts the
+    // reactor threads. Returns false, with errno set, on failure.
+    bool start(const char* address, uint16_t port);
+
+    // Sets the body handler of the servers, see Server::set_body_handler().
+    // Must be called before start().
+    void set_body_handler(Server::BodyHandler handler);
+
+    // Stops and joins the reactor threads and closes all connections.
+    void stop();
+
+    uint16_t port() const;
+    size_t size() const;
+
+    // The backend of the reactors' loops, see EventLoop::backend(). Must be
+    // called after start().
+    EventLoop::Backend backend() const;
+
+private:
+
+    struct Reactor {
+        Reactor(EventLoop::Backend backend):
+            loop {backend}
+        {
+        }
+
+        EventLoop loop;
+        std::unique_ptr<Server> server;
+        std::thread thread;
+    };
+
+    const size_t m_num_reactors;
+    const Server::Handler m_handler;
+    Server::BodyHandler m_body_handler;
+    ServerConfig m_config;
+    const bool m_pin_threads;
+    std::vector<std::unique_ptr<Reactor>> m_reactors;
+    uint16_t m_port = 0;
+};
+
+}
+}
@@ -0,0 +1,236 @@
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "proxy.hpp"
+#include "assert.hpp"
+
+using namespace biohash;
+
+struct http::Proxy::Upstream {
+    std::string address;
+    uint16_t port;
+    size_t outstanding = 0;
+};
+
+// A Lease keeps a request outstanding until its response has been written,
+// and owns the stream of a spliced body.
+struct http::Proxy::Lease {
+
+    Lease(std::shared_ptr<Upstream> upstream):
+        upstream {std::move(upstream)}
+    {
+        ++this->upstream->outstanding;
+    }
+
+    ~Lease()
+    {
+        --upstream->outstanding;
+    }
+
+    const std::shared_ptr<Upstream> upstream;
+    std::unique_ptr<Client::BodyStream> stream;
+};
+
+namespace {
+
+bool equal_nocase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// Returns false for the fields that only apply to one connection, RFC 9110
+// section 7.6.1: the hop-by-hop fields, those named by the Connection field
+// 'connection', and Expect, which the proxy answers itself.
+bool is_end_to_end(const http::HeaderField& field, std::string_view connection)
+{
+    switch (field.header) {
+        case http::Header::Connection:
+        case http::Header::Expect:
+        case http::Header::KeepAlive:
+        case http::Header::TransferEncoding:
+        case http::Header::Upgrade:
+            return false;
+        default:
+            break;
+    }
+    for (std::string_view name: {"Proxy-Connection", "TE", "Trailer"}) {
+        if (equal_nocase(field.name, name))
+            return false;
+    }
+    return !connection.data() || !http::has_token(connection, field.name);
+}
+
+void append_field(std::string& out, std::string_view name, std::string_view value)
+{
+    out += name;
+    out += ": ";
+    out += value;
+    out += "\r\n";
+}
+
+const char via[] = "1.1 biohash";
+
+void send_status(http::Response& response, int status_code)
+{
+    response.reset();
+    response.builder.status(status_code);
+    response.builder.date();
+    response.builder.content_length(0);
+    response.builder.end_header();
+}
+
+// Builds the response to the client from the upstream's response 'msg', of
+// which 'body' has been received and 'stream' holds the rest, if any. The
+// caller keeps the stream open.
+void forward(const http::Message& msg, std::string_view body, bool head,
+             http::Client::BodyStream* stream, http::Response& response)
+{
+    using namespace http;
+
+    // RFC 9112 section 6.3. The Client has decoded chunked and read
+    // close-delimited bodies, which are sent with a Content-Length.
+    bool bodiless = head || msg.status_code < 200 || msg.status_code == 204 ||
+        msg.status_code == 304;
+    bool reframed = !bodiless && (msg.chunked || !msg.header(Header::ContentLength).data());
+
+    std::string& out = response.body;
+    out = "HTTP/1.1 ";
+    out += std::to_string(msg.status_code);
+    out += ' ';
+    out += msg.reason_phrase;
+    out += "\r\n";
+    std::string_view connection = msg.header(Header::Connection);
+    for (size_t i = 0; i < msg.num_header_fields; ++i) {
+        const HeaderField& field = msg.header_fields[i];
+        if ((field.header == Header::ContentLength && reframed) ||
+            !is_end_to_end(field, connection))
+            continue;
+        append_field(out, field.name, field.value);
+    }
+    append_field(out, "Via", via);
+    if (reframed)
+        append_field(out, header_name(Header::ContentLength), std::to_string(body.size()));
+    out += "\r\n";
+    size_t header_size = out.size();
+    out += body;
+
+    ResponseBuilder& builder = response.builder;
+    builder.header_block(std::string_view {out.data(), header_size});
+    builder.body(out.data() + header_size, out.size() - header_size);
+    if (stream) {
+        response.splice_fd = stream->fd();
+        response.splice_size = stream->size();
+        // The upstream connection is only reused if the body has been spliced
+        // completely.
+        response.on_sent = [stream] { stream->finish(); };
+    }
+}
+
+} // anonymous namespace
+
+http::Proxy::Proxy(EventLoop& loop, const ProxyConfig& config):
+    m_host {config.host},
+    m_client {loop, config.client}
+{
+}
+
+bool http::Proxy::add_upstream(const char* address, uint16_t port)
+{
+    struct in6_addr addr;
+    if (inet_pton(AF_INET, address, &addr) != 1 && inet_pton(AF_INET6, address, &addr) != 1)
+        return false;
+    std::shared_ptr<Upstream> upstream = std::make_shared<Upstream>();
+    upstream->address = address;
+    upstream->port = port;
+    m_upstreams.push_back(std::move(upstream));
+    return true;
+}
+
+void http::Proxy::handle(const Message& request, std::string_view body, Response& response)
+{
+    if (request.method == Method::CONNECT)
+        return send_status(response, 501);
+    std::shared_ptr<Upstream> upstream = select();
+    if (!upstream)
+        return send_status(response, 502);
+
+    ClientRequest forwarded;
+    forwarded.method = request.method;
+    forwarded.request_target = std::string {request.request_target};
+    std::string_view connection = request.header(Header::Connection);
+    for (size_t i = 0; i < request.num_header_fields; ++i) {
+        const HeaderField& field = request.header_fields[i];
+        if (field.header == Header::ContentLength ||
+            (field.header == Header::Host && !m_host.empty()) ||
+            !is_end_to_end(field, connection))
+            continue;
+        forwarded.headers.emplace_back(field.name, field.value);
+    }
+    if (!m_host.empty())
+        forwarded.headers.emplace_back(header_name(Header::Host), m_host);
+    forwarded.headers.emplace_back("Via", via);
+    // A chunked body has been decoded by the server.
+    if (!body.empty() || request.content_length > 0 || request.chunked) {
+        forwarded.headers.emplace_back(header_name(Header::ContentLength),
+                                       std::to_string(body.size()));
+    }
+    forwarded.body = std::string {body};
+
+    std::shared_ptr<Lease> lease = std::make_shared<Lease>(upstream);
+    std::shared_ptr<DeferredResponse> deferred = response.defer();
+    bool head = request.method == Method::HEAD;
+    auto callback = [deferred, lease, head](Client::Error error, const Message& msg,
+                                             std::string_view body,
+                                             std::unique_ptr<Client::BodyStream> stream) {
+        // The client may have gone, and a stream that is dropped closes its
+        // upstream connection.
+        Response* response = deferred->response();
+        if (!response)
+            return;
+        if (error == Client::Error::None) {
+            forward(msg, body, head, stream.get(), *response);
+            lease->stream = std::move(stream);
+            response->owner = lease;
+        }
+        else
+            send_status(*response, error == Client::Error::Timeout ? 504 : 502);
+        deferred->complete();
+    };
+    bool rc = m_client.stream(upstream->address.c_str(), upstream->port, std::move(forwarded),
+                              std::move(callback));
+    ASSERT(rc);
+}
+
+size_t http::Proxy::num_upstreams() const
+{
+    return m_upstreams.size();
+}
+
+size_t http::Proxy::num_outstanding(size_t index) const
+{
+    ASSERT(index < m_upstreams.size());
+    return m_upstreams[index]->outstanding;
+}
+
+size_t http::Proxy::num_idle_connections() const
+{
+    return m_client.num_idle_connections();
+}
+
+// Returns the upstream with the least outstanding requests, or null if there
+// are no upstreams.
+std::shared_ptr<http::Proxy::Upstream> http::Proxy::select()
+{
+    size_t num_upstreams = m_upstreams.size();
+    if (num_upstreams == 0)
+        return nullptr;
+    size_t start = m_next++ % num_upstreams;
+    std::shared_ptr<Upstream> selected;
+    for (size_t i = 0; i < num_upstreams; ++i) {
+        const std::shared_ptr<Upstream>& upstream = m_upstreams[(start + i) % num_upstreams];
+        if (!selected || upstream->outstanding < selected->outstanding)
+            selected = upstream;
+    }
+    return selected;
+}
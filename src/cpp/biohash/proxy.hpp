@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http.hpp"
+#include "http_client.hpp"
+#include "http_server.hpp"
+
+namespace biohash {
+namespace http {
+
+struct ProxyConfig {
+    // The connections to the upstreams. Responses larger than
+    // client.max_response_size are answered with 502, except for bodies with
+    // a Content-Length, which are spliced.
+    ClientConfig client;
+    // Replaces the Host of the forwarded requests if not empty.
+    std::string host;
+};
+
+// A Proxy is a handler that forwards requests to a pool of upstream servers
+// and answers with their responses. Each request goes to the upstream with
+// the least outstanding requests, the first in round-robin order on a tie.
+// A request counts as outstanding until its response has been written to the
+// client. The requests are sent with a Client on the loop of the server, and
+// the responses are deferred until the upstreams answer, so the loop goes on
+// serving other connections meanwhile.
+//
+// The hop-by-hop header fields, those named by Connection and Expect are
+// removed in both directions, a Via field is added, and the body of a request
+// is sent with a Content-Length. A request without a Host is sent with that
+// of the upstream. The body of a response with a Content-Length is moved from
+// the upstream socket to the client with splice() as it arrives, so that its
+// bytes are not copied to user space, except for those read along with the
+// header. Chunked and close-delimited bodies are decoded and sent with a
+// Content-Length. Upstream connections are kept alive and reused, as
+// described for the Client.
+//
+// Unreachable upstreams are answered with 502, timeouts with 504 and CONNECT
+// requests with 501.
+//
+// handle() must only be called on the loop's thread, such as by a Server on
+// the same loop.
+class Proxy {
+public:
+
+    Proxy(EventLoop& loop, const ProxyConfig& config = ProxyConfig {});
+
+    Proxy(const Proxy&) = delete;
+    Proxy& operator=(const Proxy&) = delete;
+
+    // Adds an upstream server with an IPv4 or IPv6 address. Returns false if
+    // the address is invalid.
+    bool add_upstream(const char* address, uint16_t port);
+
+    // A Server::Handler.
+    void handle(const Message& request, std::string_view body, Response& response);
+
+    size_t num_upstreams() const;
+
+    // The outstanding requests of upstream 'index', in the order of
+    // add_upstream().
+    size_t num_outstanding(size_t index) const;
+
+    // The idle connections to all upstreams.
+    size_t num_idle_connections() const;
+
+private:
+
+    struct Upstream;
+    struct Lease;
+
+    const std::string m_host;
+    std::vector<std::shared_ptr<Upstream>> m_upstreams;
+    // The start of the round-robin search.
+    size_t m_next = 0;
+    Client m_client;
+
+    std::shared_ptr<Upstream> select();
+};
+
+}
+}
@@ -0,0 +1,366 @@
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "response_cache.hpp"
+#include "assert.hpp"
+#include "time.hpp"
+
+using namespace biohash;
+
+struct http::ResponseCache::Entry {
+    std::string key;
+    // The serialized response. The header ends at header_size, before the
+    // empty line, and the body starts at body_offset.
+    std::string data;
+    size_t header_size = 0;
+    size_t body_offset = 0;
+    int_fast64_t stored = 0;
+    int_fast64_t expires = 0;
+    // The handler is being called for the first request with the key.
+    bool pending = true;
+    // The entry is in the LRU list at 'position'.
+    bool cached = false;
+    std::list<std::shared_ptr<Entry>>::iterator position;
+};
+
+struct http::ResponseCache::Shard {
+    std::mutex mutex;
+    // Signalled when pending entries are completed.
+    std::condition_variable completed;
+    // The cached entries, most recently used first.
+    std::list<std::shared_ptr<Entry>> entries;
+    // The cached and pending entries by their key, which the key of the map
+    // refers to.
+    std::unordered_map<std::string_view, std::shared_ptr<Entry>> index;
+    size_t size = 0;
+    uint_least64_t hits = 0;
+    uint_least64_t misses = 0;
+    uint_least64_t coalesced = 0;
+};
+
+namespace {
+
+// The statuses that are cacheable by default, RFC 9110 section 15.1, except
+// for 206, whose key would have to include the range.
+bool is_cacheable_status(int status_code)
+{
+    switch (status_code) {
+        case 200:
+        case 203:
+        case 204:
+        case 300:
+        case 301:
+        case 308:
+        case 404:
+        case 405:
+        case 410:
+        case 414:
+        case 501:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::string_view trim(std::string_view str)
+{
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+        str.remove_prefix(1);
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+        str.remove_suffix(1);
+    return str;
+}
+
+bool equal_nocase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// Returns true if the Cache-Control value 'list' has the directive 'name',
+// and sets 'argument' to its argument, which is empty if there is none.
+bool find_directive(std::string_view list, std::string_view name, std::string_view& argument)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view element = list.substr(0, comma);
+        size_t equals = element.find('=');
+        if (equal_nocase(trim(element.substr(0, equals)), name)) {
+            argument = equals == std::string_view::npos ? std::string_view {} :
+                trim(element.substr(equals + 1));
+            return true;
+        }
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// Parses the delta-seconds of max-age. Returns false if it is invalid.
+bool parse_seconds(std::string_view str, int_fast64_t& seconds)
+{
+    if (str.empty())
+        return false;
+    seconds = 0;
+    for (char ch: str) {
+        if (ch < '0' || ch > '9')
+            return false;
+        // Larger values are capped, RFC 9111 section 1.2.2.
+        seconds = std::min<int_fast64_t>(10 * seconds + (ch - '0'), 2147483648);
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+http::ResponseCache::ResponseCache(Server::Handler handler, const ResponseCacheConfig& config):
+    m_handler {std::move(handler)},
+    m_config {config},
+    m_shards {new Shard[config.num_shards]}
+{
+    ASSERT(m_config.num_shards > 0);
+}
+
+http::ResponseCache::~ResponseCache()
+{
+}
+
+void http::ResponseCache::handle(const Message& request, std::string_view body,
+                                 Response& response)
+{
+    if ((request.method != Method::GET && request.method != Method::HEAD) || !body.empty() ||
+        request.chunked || request.content_length > 0 || request.header_authorization.data() ||
+        request.header(Header::Range).data())
+        return m_handler(request, body, response);
+
+    thread_local std::string key;
+    key = method_str(request.method);
+    key += ' ';
+    key += request.request_target;
+    for (const std::string& name: m_config.vary) {
+        key += '\n';
+        key += request.header(name);
+    }
+
+    Shard& shard = m_shards[std::hash<std::string_view> {}(key) % m_config.num_shards];
+    int_fast64_t now = time::monotonic_now();
+    std::shared_ptr<Entry> hit;
+    std::shared_ptr<Entry> pending;
+    {
+        std::unique_lock<std::mutex> lock {shard.mutex};
+        auto it = shard.index.find(key);
+        if (it != shard.index.end() && it->second->pending) {
+            std::shared_ptr<Entry> other = it->second;
+            // A handler that takes longer is called again without the cache.
+            shard.completed.wait_for(lock, std::chrono::milliseconds(m_config.max_wait_ms),
+                                     [&] { return !other->pending; });
+            ++shard.coalesced;
+            // A response that was not stored is not shared either.
+            if (other->cached)
+                hit = std::move(other);
+            now = time::monotonic_now();
+        }
+        else if (it != shard.index.end() && it->second->expires > now) {
+            hit = it->second;
+            shard.entries.splice(shard.entries.begin(), shard.entries, hit->position);
+        }
+        else {
+            if (it != shard.index.end())
+                erase(shard, it->second);
+            pending = std::make_shared<Entry>();
+            pending->key = key;
+            shard.index.emplace(pending->key, pending);
+        }
+        if (hit)
+            ++shard.hits;
+        else
+            ++shard.misses;
+    }
+    if (hit)
+        return serve(std::move(hit), now, response);
+
+    m_handler(request, body, response);
+    if (!pending)
+        return;
+
+    // Only this call touches the pending entry until it is completed.
+    bool stored = store(*pending, response, now);
+    {
+        std::lock_guard<std::mutex> lock {shard.mutex};
+        pending->pending = false;
+        if (stored)
+            insert(shard, pending);
+        else
+            shard.index.erase(pending->key);
+    }
+    shard.completed.notify_all();
+}
+
+// Copies the response into 'entry' if it may be cached. Returns false if not.
+bool http::ResponseCache::store(Entry& entry, const Response& response, int_fast64_t now) const
+{
+    const ResponseBuilder& builder = response.builder;
+    size_t size = builder.size();
+    if (response.file_size > 0 || response.splice_size > 0 || size == 0 ||
+        size > m_config.max_response_size)
+        return false;
+    entry.data.reserve(size);
+    for (int i = 0; i < builder.num_segments(); ++i) {
+        const iovec& segment = builder.segments()[i];
+        entry.data.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+    }
+
+    // The response to a HEAD request has no body, which the parser cannot
+    // know, so only the header is required to be complete.
+    Message msg {Message::Kind::Response, entry.data.data(), entry.data.size()};
+    if (!msg.valid || !msg.header_complete || !is_cacheable_status(msg.status_code) ||
+        msg.header(Header::SetCookie).data())
+        return false;
+
+    std::string_view cache_control = msg.header(Header::CacheControl);
+    std::string_view argument;
+    if (find_directive(cache_control, "no-store", argument) ||
+        find_directive(cache_control, "no-cache", argument) ||
+        find_directive(cache_control, "private", argument))
+        return false;
+    int_fast64_t ttl = int_fast64_t(m_config.ttl_ms) * 1000000;
+    if (find_directive(cache_control, "max-age", argument)) {
+        int_fast64_t seconds;
+        if (!parse_seconds(argument, seconds))
+            return false;
+        ttl = seconds * 1000000000;
+    }
+    if (ttl <= 0)
+        return false;
+
+    for (size_t i = 0; i < msg.num_header_fields; ++i) {
+        const HeaderField& field = msg.header_fields[i];
+        if (field.header != Header::Vary)
+            continue;
+        std::string_view list = field.value;
+        while (!list.empty()) {
+            size_t comma = list.find(',');
+            std::string_view name = trim(list.substr(0, comma));
+            bool found = name.empty();
+            for (const std::string& vary: m_config.vary)
+                found = found || equal_nocase(name, vary);
+            if (!found)
+                return false;
+            if (comma == std::string_view::npos)
+                break;
+            list.remove_prefix(comma + 1);
+        }
+    }
+
+    entry.body_offset = static_cast<size_t>(msg.body - entry.data.data());
+    if (entry.data.compare(entry.body_offset - 2, 2, "\r\n") != 0)
+        return false;
+    entry.header_size = entry.body_offset - 2;
+    entry.stored = now;
+    entry.expires = now + ttl;
+    return true;
+}
+
+// Adds a completed entry to the front of the LRU list and evicts the least
+// recently used entries beyond the size of the shard.
+void http::ResponseCache::insert(Shard& shard, std::shared_ptr<Entry> entry)
+{
+    size_t max_size = m_config.max_size / m_config.num_shards;
+    size_t entry_size = entry->key.size() + entry->data.size();
+    if (entry_size > max_size) {
+        shard.index.erase(entry->key);
+        return;
+    }
+    while (shard.size + entry_size > max_size)
+        erase(shard, shard.entries.back());
+
+    shard.entries.push_front(entry);
+    entry->position = shard.entries.begin();
+    entry->cached = true;
+    shard.size += entry_size;
+}
+
+void http::ResponseCache::erase(Shard& shard, const std::shared_ptr<Entry>& entry)
+{
+    // The entry may be the last reference to itself.
+    std::shared_ptr<Entry> erased = entry;
+    ASSERT(erased->cached);
+    shard.size -= erased->key.size() + erased->data.size();
+    shard.index.erase(erased->key);
+    shard.entries.erase(erased->position);
+    erased->cached = false;
+}
+
+void http::ResponseCache::serve(std::shared_ptr<const Entry> entry, int_fast64_t now,
+                                Response& response)
+{
+    // The age in seconds, RFC 9111 section 5.1.
+    // The response may have been stored by another thread after 'now'.
+    int_fast64_t elapsed = std::max<int_fast64_t>(now - entry->stored, 0);
+    uint_least64_t age = static_cast<uint_least64_t>(elapsed) / 1000000000;
+    char digits[20];
+    size_t num_digits = 0;
+    do {
+        digits[sizeof digits - 1 - num_digits++] = static_cast<char>('0' + age % 10);
+        age /= 10;
+    } while (age != 0);
+
+    ResponseBuilder& builder = response.builder;
+    const std::string& data = entry->data;
+    builder.header_block(std::string_view {data.data(), entry->header_size});
+    builder.header("Age", std::string_view {digits + sizeof digits - num_digits, num_digits});
+    builder.end_header();
+    builder.body(data.data() + entry->body_offset, data.size() - entry->body_offset);
+    response.owner = std::move(entry);
+}
+
+void http::ResponseCache::clear()
+{
+    for (size_t i = 0; i < m_config.num_shards; ++i) {
+        Shard& shard = m_shards[i];
+        std::lock_guard<std::mutex> lock {shard.mutex};
+        while (!shard.entries.empty())
+            erase(shard, shard.entries.back());
+    }
+}
+
+size_t http::ResponseCache::num_cached()
+{
+    size_t num_cached = 0;
+    for (size_t i = 0; i < m_config.num_shards; ++i) {
+        std::lock_guard<std::mutex> lock {m_shards[i].mutex};
+        num_cached += m_shards[i].entries.size();
+    }
+    return num_cached;
+}
+
+uint_least64_t http::ResponseCache::num_hits()
+{
+    return sum(&Shard::hits);
+}
+
+uint_least64_t http::ResponseCache::num_misses()
+{
+    return sum(&Shard::misses);
+}
+
+uint_least64_t http::ResponseCache::num_coalesced()
+{
+    return sum(&Shard::coalesced);
+}
+
+uint_least64_t http::ResponseCache::sum(uint_least64_t Shard::* counter)
+{
+    uint_least64_t sum = 0;
+    for (size_t i = 0; i < m_config.num_shards; ++i) {
+        std::lock_guard<std::mutex> lock {m_shards[i].mutex};
+        sum += m_shards[i].*counter;
+    }
+    return sum;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http.hpp"
+#include "http_server.hpp"
+
+namespace biohash {
+namespace http {
+
+struct ResponseCacheConfig {
+    // The number of shards, each with its own lock and LRU list.
+    size_t num_shards = 16;
+    // The total size of the cached responses, divided evenly among the shards.
+    size_t max_size = 64 * 1024 * 1024;
+    // Larger responses are not cached.
+    size_t max_response_size = 1024 * 1024;
+    // How long a response is served from the cache, unless its Cache-Control
+    // has a max-age.
+    int ttl_ms = 1000;
+    // How long a request waits for the response of a coalesced request before
+    // it calls the handler itself.
+    int max_wait_ms = 5000;
+    // The request headers whose values are part of the key, such as
+    // Accept-Encoding. A response that varies on other headers is not cached.
+    std::vector<std::string> vary;
+};
+
+// A ResponseCache sits in front of a handler and answers repeated GET and
+// HEAD requests with copies of its serialized responses. The key of a
+// response is the method, the request target and the values of the
+// configured Vary headers. A hit does not call the handler. The response
+// refers to the stored status line and header, an Age field and the stored
+// body, which the server writes with one sendmsg().
+//
+// A response is stored if its status is cacheable by default, it has no file
+// or socket body and no Set-Cookie, and its Cache-Control has no no-store,
+// no-cache or private. Requests with a body, Authorization or Range bypass the
+// cache.
+//
+// handle() may be called concurrently, such as from the reactors of a
+// MultiServer. Concurrent misses for the same key are coalesced: the first
+// one calls the handler, and the others wait for its response, up to
+// max_wait_ms.
+class ResponseCache {
+public:
+
+    ResponseCache(Server::Handler handler,
+                  const ResponseCacheConfig& config = ResponseCacheConfig {});
+    ~ResponseCache();
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // A Server::Handler.
+    void handle(const Message& request, std::string_view body, Response& response);
+
+    // Removes all stored responses.
+    void clear();
+
+    size_t num_cached();
+
+    // Requests answered from the cache, requests passed to the handler, and
+    // those of either kind that waited for another request's response.
+    uint_least64_t num_hits();
+    uint_least64_t num_misses();
+    uint_least64_t num_coalesced();
+
+private:
+
+    struct Entry;
+    struct Shard;
+
+    const Server::Handler m_handler;
+    const ResponseCacheConfig m_config;
+    std::unique_ptr<Shard[]> m_shards;
+
+    bool store(Entry& entry, const Response& response, int_fast64_t now) const;
+    void insert(Shard& shard, std::shared_ptr<Entry> entry);
+    static void erase(Shard& shard, const std::shared_ptr<Entry>& entry);
+    static void serve(std::shared_ptr<const Entry> entry, int_fast64_t now, Response& response);
+    uint_least64_t sum(uint_least64_t Shard::* counter);
+};
+
+}
+}
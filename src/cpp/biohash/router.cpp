@@ -0,0 +1,242 @@
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "router.hpp"
+#include "assert.hpp"
+
+using namespace biohash;
+
+namespace {
+
+constexpr size_t num_methods = static_cast<size_t>(http::Method::TRACE) + 1;
+
+} // anonymous namespace
+
+// A node is reached after matching its static prefix, a parameter or the
+// wildcard. Static children start with distinct bytes, which are indexed by
+// 'first_bytes'.
+struct http::Router::Node {
+    std::string prefix;
+    std::vector<std::unique_ptr<Node>> children;
+    std::string first_bytes;
+    std::unique_ptr<Node> param;
+    std::unique_ptr<Node> wildcard;
+    // The name of the parameter or wildcard that leads to the node.
+    std::string name;
+    Handler handlers[num_methods];
+
+    uint_least32_t methods() const
+    {
+        uint_least32_t methods = 0;
+        for (size_t i = 0; i < num_methods; ++i) {
+            if (handlers[i])
+                methods |= uint_least32_t(1) << i;
+        }
+        return methods;
+    }
+};
+
+std::string_view http::RouteParams::get(std::string_view name) const
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (names[i] == name)
+            return values[i];
+    }
+    return {};
+}
+
+http::Router::Router():
+    m_root {new Node}
+{
+}
+
+http::Router::~Router()
+{
+}
+
+// Returns the node at the end of 'text' below 'node', splitting an edge or
+// adding a child as needed.
+http::Router::Node* http::Router::insert_static(Node* node, std::string_view text)
+{
+    while (!text.empty()) {
+        size_t index = node->first_bytes.find(text[0]);
+        if (index == std::string::npos) {
+            std::unique_ptr<Node> child {new Node};
+            child->prefix = std::string {text};
+            node->first_bytes += text[0];
+            node->children.push_back(std::move(child));
+            return node->children.back().get();
+        }
+
+        std::unique_ptr<Node>& child = node->children[index];
+        const std::string& prefix = child->prefix;
+        size_t common = 0;
+        while (common < prefix.size() && common < text.size() && prefix[common] == text[common])
+            ++common;
+        if (common < prefix.size()) {
+            // The edge is split at the end of the common part.
+            std::unique_ptr<Node> middle {new Node};
+            middle->prefix = prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            middle->first_bytes += child->prefix[0];
+            middle->children.push_back(std::move(child));
+            child = std::move(middle);
+        }
+        node = child.get();
+        text.remove_prefix(common);
+    }
+    return node;
+}
+
+// Matches 'rest' of the path below 'node', whose own part of the path has
+// been matched. The static child, the parameter and the wildcard are tried in
+// turn. Each consumes a part of 'rest' that only depends on the node, so no
+// node is visited twice.
+const http::Router::Handler* http::Router::match_node(const Node& node, std::string_view rest,
+                                                      size_t method, RouteParams& params,
+                                                      uint_least32_t& allowed_methods)
+{
+    if (rest.empty()) {
+        if (node.handlers[method])
+            return &node.handlers[method];
+        allowed_methods |= node.methods();
+    }
+    else {
+        size_t index = node.first_bytes.find(rest[0]);
+        if (index != std::string::npos) {
+            const Node& child = *node.children[index];
+            if (rest.compare(0, child.prefix.size(), child.prefix) == 0) {
+                const Handler* handler = match_node(child, rest.substr(child.prefix.size()),
+                                                    method, params, allowed_methods);
+                if (handler)
+                    return handler;
+            }
+        }
+
+        if (node.param && rest[0] != '/') {
+            std::string_view value = rest.substr(0, rest.find('/'));
+            size_t i = params.size++;
+            params.names[i] = node.param->name;
+            params.values[i] = value;
+            const Handler* handler = match_node(*node.param, rest.substr(value.size()),
+                                                method, params, allowed_methods);
+            if (handler)
+                return handler;
+            --params.size;
+        }
+    }
+
+    if (node.wildcard) {
+        const Node& wildcard = *node.wildcard;
+        if (wildcard.handlers[method]) {
+            size_t i = params.size++;
+            params.names[i] = wildcard.name;
+            params.values[i] = rest;
+            return &wildcard.handlers[method];
+        }
+        allowed_methods |= wildcard.methods();
+    }
+    return nullptr;
+}
+
+bool http::Router::add(Method method, std::string_view pattern, Handler handler)
+{
+    ASSERT(handler);
+    if (pattern.empty() || pattern[0] != '/')
+        return false;
+
+    // The pattern is checked before the tree is changed.
+    size_t num_params = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char ch = pattern[i];
+        if (ch != ':' && ch != '*')
+            continue;
+        if (pattern[i - 1] != '/')
+            return false;
+        size_t end = pattern.find('/', i);
+        if (end == i + 1 || (end == std::string_view::npos && i + 1 == pattern.size()))
+            return false;
+        if (ch == '*' && end != std::string_view::npos)
+            return false;
+        if (++num_params > max_route_params)
+            return false;
+    }
+
+    Node* node = m_root.get();
+    while (!pattern.empty()) {
+        size_t special = pattern.find_first_of(":*");
+        node = insert_static(node, pattern.substr(0, special));
+        if (special == std::string_view::npos)
+            break;
+        pattern.remove_prefix(special);
+
+        size_t end = pattern.find('/');
+        std::string_view name = pattern.substr(1, end == std::string_view::npos ?
+                                               std::string_view::npos : end - 1);
+        std::unique_ptr<Node>& child = pattern[0] == ':' ? node->param : node->wildcard;
+        if (!child) {
+            child.reset(new Node);
+            child->name = std::string {name};
+        }
+        else if (child->name != name)
+            return false;
+        node = child.get();
+        pattern.remove_prefix(end == std::string_view::npos ? pattern.size() : end);
+    }
+
+    Handler& slot = node->handlers[static_cast<size_t>(method)];
+    if (slot)
+        return false;
+    slot = std::move(handler);
+    return true;
+}
+
+const http::Router::Handler* http::Router::match(Method method, std::string_view path,
+                                                 RouteParams& params,
+                                                 uint_least32_t& allowed_methods) const
+{
+    params.size = 0;
+    allowed_methods = 0;
+    const Handler* handler = match_node(*m_root, path, static_cast<size_t>(method), params,
+                                        allowed_methods);
+    if (handler)
+        allowed_methods = 0;
+    return handler;
+}
+
+void http::Router::handle(const Message& request, std::string_view body,
+                          Response& response) const
+{
+    std::string_view path = split_request_target(request.request_target).path;
+
+    RouteParams params;
+    uint_least32_t allowed_methods;
+    const Handler* handler = match(request.method, path, params, allowed_methods);
+    if (handler)
+        return (*handler)(request, params, body, response);
+
+    ResponseBuilder& builder = response.builder;
+    builder.status(allowed_methods ? 405 : 404);
+    builder.date();
+    if (allowed_methods) {
+        // Allow lists the methods in the order of Method.
+        char allow[64];
+        size_t size = 0;
+        for (size_t i = 0; i < num_methods; ++i) {
+            if (!(allowed_methods & (uint_least32_t(1) << i)))
+                continue;
+            const char* name = method_str(static_cast<Method>(i));
+            size_t name_size = strlen(name);
+            if (size > 0) {
+                memcpy(allow + size, ", ", 2);
+                size += 2;
+            }
+            memcpy(allow + size, name, name_size);
+            size += name_size;
+        }
+        builder.header("Allow", std::string_view {allow, size});
+    }
+    builder.content_length(0);
+    builder.end_header();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "http.hpp"
+#include "http_server.hpp"
+
+namespace biohash {
+namespace http {
+
+constexpr size_t max_route_params = 8;
+
+// The parameters captured by a route. The names refer to the route's pattern
+// and the values to the matched path.
+struct RouteParams {
+    std::string_view names[max_route_params];
+    std::string_view values[max_route_params];
+    size_t size = 0;
+
+    // The value of the parameter 'name'. The data() of the returned view is
+    // null if the route has no such parameter.
+    std::string_view get(std::string_view name) const;
+};
+
+// A Router maps a method and a path to a handler. The patterns of the routes
+// consist of static text, parameters and a wildcard tail, such as
+//
+//   /users/:id/files/*path
+//
+// where ":id" matches a non-empty segment up to the next '/' and "*path" the
+// rest of the path, which may be empty. Parameters and the wildcard must
+// start a segment.
+//
+// The routes are compiled into a radix tree with compressed static edges.
+// Matching walks the tree along the path and allocates nothing. At each node
+// static text is preferred to a parameter, and a parameter to the wildcard,
+// and the other branches are tried if the preferred one fails further down.
+// A node can only be reached in one way, so it is visited at most once per
+// match. The backtracking is thus bounded by the routes that share a prefix
+// with the path, not by the length of the path alone.
+class Router {
+public:
+
+    using Handler = std::function<void(const Message& request, const RouteParams& params,
+                                       std::string_view body, Response& response)>;
+
+    Router();
+    ~Router();
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    // Returns false if the pattern is invalid, has more than max_route_params
+    // parameters, names a parameter differently than another route at the
+    // same position, or if the method and pattern have been added before.
+    bool add(Method method, std::string_view pattern, Handler handler);
+
+    // Returns the handler of the route that matches, or null. If the path
+    // matches routes of other methods only, bit i of 'allowed_methods' is set
+    // for each such Method i, and it is zero otherwise.
+    const Handler* match(Method method, std::string_view path, RouteParams& params,
+                         uint_least32_t& allowed_methods) const;
+
+    // Calls the handler of the request's route, with the path of the request
+    // target, which is matched without percent-decoding. A path that is not
+    // found is answered with 404, and one without a route for the method with
+    // 405.
+    void handle(const Message& request, std::string_view body, Response& response) const;
+
+private:
+
+    struct Node;
+
+    std::unique_ptr<Node> m_root;
+
+    static Node* insert_static(Node* node, std::string_view text);
+    static const Handler* match_node(const Node& node, std::string_view rest, size_t method,
+                                     RouteParams& params, uint_least32_t& allowed_methods);
+};
+
+}
+}
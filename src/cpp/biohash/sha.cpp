@@ -0,0 +1,587 @@
+#include <string.h>
+#include <algorithm>
+
+#include "sha.hpp"
+#include "assert.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BIOHASH_SHA_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace biohash;
+
+namespace {
+
+const uint32_t sha1_iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotl(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+inline uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t load_be32(const char* p)
+{
+    const unsigned char* q = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t {q[0]} << 24) | (uint32_t {q[1]} << 16) | (uint32_t {q[2]} << 8) | q[3];
+}
+
+inline void store_be32(char* p, uint32_t value)
+{
+    p[0] = static_cast<char>(value >> 24);
+    p[1] = static_cast<char>(value >> 16);
+    p[2] = static_cast<char>(value >> 8);
+    p[3] = static_cast<char>(value);
+}
+
+void sha1_blocks_scalar(uint32_t state[5], const char* data, size_t num_blocks)
+{
+    for (; num_blocks > 0; --num_blocks, data += sha::block_size) {
+        uint32_t w[80];
+        for (int t = 0; t < 16; ++t)
+            w[t] = load_be32(data + 4 * t);
+        for (int t = 16; t < 80; ++t)
+            w[t] = rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int t = 0; t < 80; ++t) {
+            uint32_t f, k;
+            if (t < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (t < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (t < 60) {
+                f = (b & c) | (d & (b | c));
+                k = 0x8f1bbcdc;
+            }
+            else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t temp = rotl(a, 5) + f + e + k + w[t];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+void sha256_blocks_scalar(uint32_t state[8], const char* data, size_t num_blocks)
+{
+    for (; num_blocks > 0; --num_blocks, data += sha::block_size) {
+        uint32_t w[64];
+        for (int t = 0; t < 16; ++t)
+            w[t] = load_be32(data + 4 * t);
+        for (int t = 16; t < 64; ++t) {
+            uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; ++t) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t temp1 = h + s1 + ch + sha256_k[t] + w[t];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) | (c & (a | b));
+            uint32_t temp2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef BIOHASH_SHA_X86
+
+// The kernels with the SHA extensions follow the structure of Intel's
+// reference code. The loops over the rounds are unrolled, which turns the
+// indices of the message words into registers.
+
+__attribute__((target("sha,sse4.1")))
+inline __m128i sha1_rounds(__m128i abcd, __m128i e, int func)
+{
+    switch (func) {
+        case 0:
+            return _mm_sha1rnds4_epu32(abcd, e, 0);
+        case 1:
+            return _mm_sha1rnds4_epu32(abcd, e, 1);
+        case 2:
+            return _mm_sha1rnds4_epu32(abcd, e, 2);
+        default:
+            return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha1_blocks_shani(uint32_t state[5], const char* data, size_t num_blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607, 0x08090a0b0c0d0e0f);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)),
+                                     0x1b);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+
+    for (; num_blocks > 0; --num_blocks, data += sha::block_size) {
+        const __m128i abcd_save = abcd;
+        const __m128i e_save = e0;
+        __m128i e1 = _mm_setzero_si128();
+        __m128i msgs[4];
+
+        // Each step is 4 rounds. msgs[i % 4] holds the message words of step
+        // i, and the words of later steps are derived from it as it goes.
+#pragma GCC unroll 20
+        for (int i = 0; i < 20; ++i) {
+            if (i < 4) {
+                __m128i msg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i));
+                msgs[i] = _mm_shuffle_epi8(msg, bswap);
+            }
+            __m128i& e_in = i % 2 == 0 ? e0 : e1;
+            __m128i& e_out = i % 2 == 0 ? e1 : e0;
+            if (i == 0)
+                e_in = _mm_add_epi32(e_in, msgs[0]);
+            else
+                e_in = _mm_sha1nexte_epu32(e_in, msgs[i % 4]);
+            e_out = abcd;
+            if (i >= 3 && i < 19)
+                msgs[(i + 1) % 4] = _mm_sha1msg2_epu32(msgs[(i + 1) % 4], msgs[i % 4]);
+            abcd = sha1_rounds(abcd, e_in, i / 5);
+            if (i >= 1 && i < 17)
+                msgs[(i + 3) % 4] = _mm_sha1msg1_epu32(msgs[(i + 3) % 4], msgs[i % 4]);
+            if (i >= 2 && i < 18)
+                msgs[(i + 2) % 4] = _mm_xor_si128(msgs[(i + 2) % 4], msgs[i % 4]);
+        }
+
+        e0 = _mm_sha1nexte_epu32(e0, e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), abcd);
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_blocks_shani(uint32_t state[8], const char* data, size_t num_blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0b, 0x0405060700010203);
+
+    // The state is kept as ABEF and CDGH.
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (; num_blocks > 0; --num_blocks, data += sha::block_size) {
+        const __m128i abef_save = state0;
+        const __m128i cdgh_save = state1;
+        __m128i msgs[4];
+
+        // Each step is 4 rounds, see sha1_blocks_shani().
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; ++i) {
+            if (i < 4) {
+                __m128i msg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i));
+                msgs[i] = _mm_shuffle_epi8(msg, bswap);
+            }
+            __m128i msg = _mm_add_epi32(msgs[i % 4], _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(sha256_k + 4 * i)));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            if (i >= 3 && i < 15) {
+                __m128i& next = msgs[(i + 1) % 4];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(msgs[i % 4], msgs[(i + 3) % 4], 4));
+                next = _mm_sha256msg2_epu32(next, msgs[i % 4]);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (i >= 1 && i < 13)
+                msgs[(i + 3) % 4] = _mm_sha256msg1_epu32(msgs[(i + 3) % 4], msgs[i % 4]);
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+// Transposes the 8x8 matrix of 32-bit words in 'rows'.
+__attribute__((target("avx2")))
+inline void transpose_8x8(__m256i rows[8])
+{
+    __m256i t[8];
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(rows[i], rows[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(rows[i], rows[i + 1]);
+    }
+    __m256i u[8];
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+__attribute__((target("avx2")))
+inline __m256i rotr_x8(__m256i x, int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// Compresses 'num_blocks' consecutive blocks of 8 messages, one in each
+// 32-bit lane.
+__attribute__((target("avx2")))
+void sha256_blocks_x8_avx2(uint32_t* const states[8], const char* const data[8],
+                           size_t num_blocks)
+{
+    const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                          12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i s[8];
+    for (int i = 0; i < 8; ++i)
+        s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(states[i]));
+    transpose_8x8(s);
+
+    for (size_t block = 0; block < num_blocks; ++block) {
+        __m256i w[16];
+        for (int half = 0; half < 2; ++half) {
+            for (int i = 0; i < 8; ++i) {
+                const char* p = data[i] + block * sha::block_size + 32 * half;
+                w[8 * half + i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            }
+            transpose_8x8(w + 8 * half);
+        }
+        for (int t = 0; t < 16; ++t)
+            w[t] = _mm256_shuffle_epi8(w[t], bswap);
+
+        __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int t = 0; t < 64; ++t) {
+            if (t >= 16) {
+                __m256i w15 = w[(t - 15) % 16];
+                __m256i w2 = w[(t - 2) % 16];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(w15, 7), rotr_x8(w15, 18)),
+                                              _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(w2, 17), rotr_x8(w2, 19)),
+                                              _mm256_srli_epi32(w2, 10));
+                w[t % 16] = _mm256_add_epi32(_mm256_add_epi32(w[t % 16], s0),
+                                             _mm256_add_epi32(w[(t - 7) % 16], s1));
+            }
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(e, 6), rotr_x8(e, 11)),
+                                          rotr_x8(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i k = _mm256_set1_epi32(static_cast<int>(sha256_k[t]));
+            __m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, s1),
+                                             _mm256_add_epi32(_mm256_add_epi32(ch, k), w[t % 16]));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(a, 2), rotr_x8(a, 13)),
+                                          rotr_x8(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b),
+                                          _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            __m256i temp2 = _mm256_add_epi32(s0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, temp1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(temp1, temp2);
+        }
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    transpose_8x8(s);
+    for (int i = 0; i < 8; ++i)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(states[i]), s[i]);
+}
+
+#endif // BIOHASH_SHA_X86
+
+struct Features {
+    sha::Isa isa;
+    bool multi_buffer;
+};
+
+Features detect_features()
+{
+    Features features {sha::Isa::scalar, false};
+#ifdef BIOHASH_SHA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+        features.isa = sha::Isa::shani;
+    features.multi_buffer = __builtin_cpu_supports("avx2");
+#endif
+    return features;
+}
+
+const Features features = detect_features();
+
+// Appends 'data' to the partial block of a hash whose input has the size
+// 'total', and compresses the blocks completed.
+template <class Compress>
+void update_blocks(char* buf, uint_least64_t& total, const char* data, size_t size,
+                   Compress compress)
+{
+    size_t buffered = static_cast<size_t>(total % sha::block_size);
+    total += size;
+    if (buffered > 0) {
+        size_t n = std::min(size, sha::block_size - buffered);
+        memcpy(buf + buffered, data, n);
+        data += n;
+        size -= n;
+        if (buffered + n < sha::block_size)
+            return;
+        compress(buf, 1);
+    }
+    size_t num_blocks = size / sha::block_size;
+    if (num_blocks > 0)
+        compress(data, num_blocks);
+    memcpy(buf, data + num_blocks * sha::block_size, size % sha::block_size);
+}
+
+// Pads the partial block with the size of the input in bits and compresses
+// the last one or two blocks.
+template <class Compress>
+void finish_blocks(char* buf, uint_least64_t total, Compress compress)
+{
+    size_t buffered = static_cast<size_t>(total % sha::block_size);
+    buf[buffered++] = '\x80';
+    if (buffered > sha::block_size - 8) {
+        memset(buf + buffered, 0, sha::block_size - buffered);
+        compress(buf, 1);
+        buffered = 0;
+    }
+    memset(buf + buffered, 0, sha::block_size - 8 - buffered);
+    uint_least64_t bits = total * 8;
+    store_be32(buf + sha::block_size - 8, static_cast<uint32_t>(bits >> 32));
+    store_be32(buf + sha::block_size - 4, static_cast<uint32_t>(bits));
+    compress(buf, 1);
+}
+
+} // anonymous namespace
+
+bool sha::isa_supported(Isa isa)
+{
+    return isa == Isa::scalar || isa == features.isa;
+}
+
+sha::Isa sha::default_isa()
+{
+    return features.isa;
+}
+
+bool sha::multi_buffer_supported()
+{
+    return features.multi_buffer;
+}
+
+sha::Sha1::Sha1(Isa isa):
+    m_isa {isa}
+{
+    ASSERT(isa_supported(isa));
+    memcpy(m_state, sha1_iv, sizeof m_state);
+}
+
+void sha::Sha1::compress(const char* data, size_t num_blocks)
+{
+#ifdef BIOHASH_SHA_X86
+    if (m_isa == Isa::shani)
+        return sha1_blocks_shani(m_state, data, num_blocks);
+#endif
+    sha1_blocks_scalar(m_state, data, num_blocks);
+}
+
+void sha::Sha1::update(const char* data, size_t size)
+{
+    update_blocks(m_buf, m_size, data, size, [this](const char* blocks, size_t num_blocks) {
+        compress(blocks, num_blocks);
+    });
+}
+
+void sha::Sha1::finish(char* digest)
+{
+    finish_blocks(m_buf, m_size, [this](const char* blocks, size_t num_blocks) {
+        compress(blocks, num_blocks);
+    });
+    for (int i = 0; i < 5; ++i)
+        store_be32(digest + 4 * i, m_state[i]);
+    memcpy(m_state, sha1_iv, sizeof m_state);
+    m_size = 0;
+}
+
+sha::Sha256::Sha256(Isa isa):
+    m_isa {isa}
+{
+    ASSERT(isa_supported(isa));
+    memcpy(m_state, sha256_iv, sizeof m_state);
+}
+
+void sha::Sha256::compress(const char* data, size_t num_blocks)
+{
+#ifdef BIOHASH_SHA_X86
+    if (m_isa == Isa::shani)
+        return sha256_blocks_shani(m_state, data, num_blocks);
+#endif
+    sha256_blocks_scalar(m_state, data, num_blocks);
+}
+
+void sha::Sha256::update(const char* data, size_t size)
+{
+    update_blocks(m_buf, m_size, data, size, [this](const char* blocks, size_t num_blocks) {
+        compress(blocks, num_blocks);
+    });
+}
+
+void sha::Sha256::finish(char* digest)
+{
+    finish_blocks(m_buf, m_size, [this](const char* blocks, size_t num_blocks) {
+        compress(blocks, num_blocks);
+    });
+    for (int i = 0; i < 8; ++i)
+        store_be32(digest + 4 * i, m_state[i]);
+    memcpy(m_state, sha256_iv, sizeof m_state);
+    m_size = 0;
+}
+
+void sha::Sha256::update_many(Sha256* const* hashers, const char* const* data,
+                              const size_t* sizes, size_t count)
+{
+    if (!features.multi_buffer) {
+        for (size_t i = 0; i < count; ++i)
+            hashers[i]->update(data[i], sizes[i]);
+        return;
+    }
+    for (size_t first = 0; first < count; first += 8)
+        update_lanes(hashers + first, data + first, sizes + first, std::min<size_t>(count - first, 8));
+}
+
+// Updates up to 8 hashers, sharing the lanes of the multi-buffer kernel
+// while at least two of them have complete blocks left.
+void sha::Sha256::update_lanes(Sha256* const* hashers, const char* const* data,
+                               const size_t* sizes, size_t count)
+{
+    constexpr size_t num_lanes = 8;
+    ASSERT(count <= num_lanes);
+
+    // The partial blocks of the hashers are completed first, which leaves
+    // whole blocks for the lanes. Hashers with the SHA extensions, which
+    // outrun all lanes together, take no part.
+    const char* blocks[num_lanes];
+    size_t num_blocks[num_lanes];
+    for (size_t i = 0; i < count; ++i) {
+        Sha256& hasher = *hashers[i];
+        const char* begin = data[i];
+        size_t size = sizes[i];
+        size_t buffered = static_cast<size_t>(hasher.m_size % block_size);
+        if (buffered > 0 && hasher.m_isa == Isa::scalar) {
+            size_t n = std::min(size, block_size - buffered);
+            hasher.update(begin, n);
+            begin += n;
+            size -= n;
+        }
+        blocks[i] = begin;
+        num_blocks[i] = hasher.m_isa == Isa::scalar ? size / block_size : 0;
+    }
+
+#ifdef BIOHASH_SHA_X86
+    // Idle lanes hash the data of the first lane into scratch states.
+    uint32_t scratch[num_lanes][8] = {};
+    for (;;) {
+        uint32_t* lane_states[num_lanes];
+        const char* lane_data[num_lanes];
+        size_t num_active = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (num_blocks[i] == 0)
+                continue;
+            n = num_active == 0 ? num_blocks[i] : std::min(n, num_blocks[i]);
+            lane_states[num_active] = hashers[i]->m_state;
+            lane_data[num_active] = blocks[i];
+            ++num_active;
+        }
+        if (num_active < 2)
+            break;
+        for (size_t lane = num_active; lane < num_lanes; ++lane) {
+            lane_states[lane] = scratch[lane];
+            lane_data[lane] = lane_data[0];
+        }
+
+        sha256_blocks_x8_avx2(lane_states, lane_data, n);
+        for (size_t i = 0; i < count; ++i) {
+            if (num_blocks[i] == 0)
+                continue;
+            blocks[i] += n * block_size;
+            num_blocks[i] -= n;
+            hashers[i]->m_size += n * block_size;
+        }
+    }
+#endif
+
+    // The remaining blocks and the tails.
+    for (size_t i = 0; i < count; ++i)
+        hashers[i]->update(blocks[i], static_cast<size_t>(data[i] + sizes[i] - blocks[i]));
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace biohash {
+namespace sha {
+
+// The instruction set of the compression functions of Sha1 and Sha256. The
+// SHA extensions are selected at startup if the CPU has them.
+enum class Isa {
+    scalar,
+    shani
+};
+
+// Returns true if 'isa' can be used on this CPU.
+bool isa_supported(Isa isa);
+
+// The instruction set selected at startup.
+Isa default_isa();
+
+// Returns true if Sha256::update_many() compresses the blocks of 8 messages
+// at once with AVX2.
+bool multi_buffer_supported();
+
+constexpr size_t block_size = 64;
+
+// A Sha1 computes the SHA-1 digest of data that arrives in pieces of
+// arbitrary size. Less than a block is buffered between calls to update().
+class Sha1 {
+public:
+
+    static constexpr size_t digest_size = 20;
+
+    // 'isa' must be supported.
+    Sha1(Isa isa = default_isa());
+
+    void update(const char* data, size_t size);
+
+    // Places the digest of the data in 'digest', which must have room for
+    // digest_size bytes. The Sha1 can be reused after finish().
+    void finish(char* digest);
+
+private:
+
+    const Isa m_isa;
+    uint32_t m_state[5];
+    char m_buf[block_size];
+    uint_least64_t m_size = 0;
+
+    void compress(const char* data, size_t num_blocks);
+};
+
+// A Sha256 computes the SHA-256 digest of data that arrives in pieces of
+// arbitrary size, like Sha1.
+class Sha256 {
+public:
+
+    static constexpr size_t digest_size = 32;
+
+    // 'isa' must be supported.
+    Sha256(Isa isa = default_isa());
+
+    void update(const char* data, size_t size);
+
+    // Places the digest of the data in 'digest', which must have room for
+    // digest_size bytes. The Sha256 can be reused after finish().
+    void finish(char* digest);
+
+    // Calls hashers[i]->update(data[i], sizes[i]) for each i < count. The
+    // hashers must be distinct. With multi-buffer support, the blocks of up
+    // to 8 hashers are compressed in parallel, one message per 32-bit lane,
+    // which pays off when many streams, such as the bodies of concurrent
+    // uploads, are hashed on one thread without the SHA extensions. Hashers
+    // with the extensions are updated one by one, which is faster.
+    static void update_many(Sha256* const* hashers, const char* const* data,
+                            const size_t* sizes, size_t count);
+
+private:
+
+    const Isa m_isa;
+    uint32_t m_state[8];
+    char m_buf[block_size];
+    uint_least64_t m_size = 0;
+
+    void compress(const char* data, size_t num_blocks);
+    static void update_lanes(Sha256* const* hashers, const char* const* data,
+                             const size_t* sizes, size_t count);
+};
+
+}
+}
@@ -0,0 +1,437 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+
+#include "static_files.hpp"
+#include "assert.hpp"
+#include "time.hpp"
+
+using namespace biohash;
+
+struct http::StaticFiles::File {
+
+    ~File()
+    {
+        if (mapping)
+            munmap(const_cast<char*>(mapping), size);
+        close(fd);
+    }
+
+    // Maps the file when it is first needed, after which all responses share
+    // the mapping. Returns null if the file cannot be mapped.
+    const char* map()
+    {
+        std::call_once(map_once, [this] {
+            void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+                mapping = static_cast<const char*>(addr);
+        });
+        return mapping;
+    }
+
+    int fd;
+    uint_least64_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtim;
+    const char* content_type;
+    std::string etag;
+    char last_modified[time::http_date_size];
+    // The time of the last stat().
+    std::atomic<int_fast64_t> checked;
+    std::once_flag map_once;
+    const char* mapping = nullptr;
+};
+
+namespace {
+
+struct ContentType {
+    const char* extension;
+    const char* type;
+};
+
+const ContentType content_types[] = {
+    {"css", "text/css; charset=utf-8"},
+    {"gif", "image/gif"},
+    {"htm", "text/html; charset=utf-8"},
+    {"html", "text/html; charset=utf-8"},
+    {"ico", "image/vnd.microsoft.icon"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"map", "application/json"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"pdf", "application/pdf"},
+    {"png", "image/png"},
+    {"svg", "image/svg+xml"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"wasm", "application/wasm"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"xml", "application/xml"},
+};
+
+const char* content_type_of(std::string_view path)
+{
+    size_t dot = path.rfind('.');
+    if (dot != std::string_view::npos && path.find('/', dot) == std::string_view::npos) {
+        std::string_view extension = path.substr(dot + 1);
+        for (const ContentType& content_type: content_types) {
+            if (extension.size() == strlen(content_type.extension) &&
+                strncasecmp(extension.data(), content_type.extension, extension.size()) == 0)
+                return content_type.type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+// Returns false if a segment of 'path' is empty, "." or "..", or if it
+// contains a null character.
+bool is_safe_path(std::string_view path)
+{
+    if (path.find('\0') != std::string_view::npos)
+        return false;
+    while (!path.empty()) {
+        size_t slash = path.find('/');
+        std::string_view segment = path.substr(0, slash);
+        if (segment == "." || segment == "..")
+            return false;
+        if (segment.empty() && slash != std::string_view::npos)
+            return false;
+        if (slash == std::string_view::npos)
+            break;
+        path.remove_prefix(slash + 1);
+    }
+    return true;
+}
+
+void append_hex(std::string& out, uint_least64_t value)
+{
+    char buf[16];
+    size_t i = sizeof buf;
+    do {
+        buf[--i] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    }
+    while (value != 0);
+    out.append(buf + i, sizeof buf - i);
+}
+
+// The weak comparison of RFC 9110, section 8.8.3.2, against the entity tags
+// of an If-None-Match list.
+bool etag_matches(std::string_view list, std::string_view etag)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view candidate = list.substr(0, comma);
+        while (!candidate.empty() && (candidate.front() == ' ' || candidate.front() == '\t'))
+            candidate.remove_prefix(1);
+        while (!candidate.empty() && (candidate.back() == ' ' || candidate.back() == '\t'))
+            candidate.remove_suffix(1);
+        if (candidate == "*")
+            return true;
+        if (candidate.substr(0, 2) == "W/")
+            candidate.remove_prefix(2);
+        if (candidate == etag)
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// RFC 9110, section 13.1.5. An entity tag must match strongly, and a date
+// must equal the modification time.
+bool if_range_matches(std::string_view if_range, std::string_view etag, int_fast64_t mtime)
+{
+    if (!if_range.data())
+        return true;
+    if (!if_range.empty() && if_range[0] == '"')
+        return if_range == etag;
+    int_fast64_t date;
+    return time::parse_http_date(if_range.data(), if_range.size(), date) && date == mtime;
+}
+
+std::string content_range(const http::ByteRange& range, uint_least64_t size)
+{
+    return "bytes " + std::to_string(range.first) + '-' + std::to_string(range.last) + '/' +
+        std::to_string(size);
+}
+
+void send_empty(http::Response& response, int status_code)
+{
+    response.builder.status(status_code);
+    response.builder.date();
+    if (status_code == 405)
+        response.builder.header("Allow", "GET, HEAD");
+    response.builder.content_length(0);
+    response.builder.end_header();
+}
+
+} // anonymous namespace
+
+http::StaticFiles::StaticFiles(const StaticFilesConfig& config):
+    m_config {config}
+{
+    ASSERT(m_config.max_open_files > 0);
+}
+
+http::StaticFiles::~StaticFiles()
+{
+    if (m_root_fd >= 0)
+        close(m_root_fd);
+}
+
+bool http::StaticFiles::open(const char* root)
+{
+    ASSERT(m_root_fd < 0);
+    m_root_fd = ::open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return m_root_fd >= 0;
+}
+
+void http::StaticFiles::serve(const Message& request, Response& response)
+{
+    std::string path {split_request_target(request.request_target).path};
+    size_t size;
+    if (!percent_decode(path.data(), path.size(), &path[0], size))
+        return send_empty(response, 400);
+    path.resize(size);
+    serve(request, path, response);
+}
+
+void http::StaticFiles::serve(const Message& request, std::string_view path, Response& response)
+{
+    if (request.method != Method::GET && request.method != Method::HEAD)
+        return send_empty(response, 405);
+    if (path.empty() || path[0] != '/' || !is_safe_path(path.substr(1)))
+        return send_empty(response, 404);
+
+    std::string relative_path {path.substr(1)};
+    if (relative_path.empty() || relative_path.back() == '/')
+        relative_path += m_config.index_file;
+    std::shared_ptr<File> file = get(relative_path);
+    if (!file)
+        return send_empty(response, 404);
+
+    // RFC 9110, section 13.2.2. If-Modified-Since is ignored when
+    // If-None-Match is present.
+    bool not_modified = false;
+    std::string_view if_none_match = request.header(Header::IfNoneMatch);
+    std::string_view if_modified_since = request.header(Header::IfModifiedSince);
+    int_fast64_t since;
+    if (if_none_match.data())
+        not_modified = etag_matches(if_none_match, file->etag);
+    else if (if_modified_since.data() &&
+             time::parse_http_date(if_modified_since.data(), if_modified_since.size(), since))
+        not_modified = file->mtim.tv_sec <= since;
+
+    ResponseBuilder& builder = response.builder;
+    if (not_modified) {
+        builder.status(304);
+        builder.date();
+        add_validators(*file, builder);
+        builder.end_header();
+        return;
+    }
+
+    // RFC 9110, section 14.2. Ranges apply to GET only, and If-Range must
+    // match the current representation.
+    ByteRange ranges[max_byte_ranges];
+    size_t num_ranges = 0;
+    RangeStatus range_status = RangeStatus::Invalid;
+    std::string_view range = request.header(Header::Range);
+    if (range.data() && request.method == Method::GET &&
+        if_range_matches(request.header(Header::IfRange), file->etag, file->mtim.tv_sec))
+        range_status = parse_range(range, file->size, ranges, num_ranges);
+
+    if (range_status == RangeStatus::Unsatisfiable) {
+        std::string content_range = "bytes */" + std::to_string(file->size);
+        builder.status(416);
+        builder.date();
+        builder.header(Header::ContentRange, content_range);
+        builder.content_length(0);
+        builder.end_header();
+        return;
+    }
+    if (range_status == RangeStatus::Satisfiable && num_ranges > 1) {
+        if (file->map())
+            return send_multipart(std::move(file), ranges, num_ranges, response);
+        // The whole file is sent instead.
+        range_status = RangeStatus::Invalid;
+    }
+
+    uint_least64_t offset = 0;
+    uint_least64_t size = file->size;
+    if (range_status == RangeStatus::Satisfiable) {
+        offset = ranges[0].first;
+        size = ranges[0].last - ranges[0].first + 1;
+        builder.status(206);
+        builder.date();
+        builder.header(Header::ContentRange, content_range(ranges[0], file->size));
+    }
+    else {
+        builder.status(200);
+        builder.date();
+        builder.header(Header::AcceptRanges, "bytes");
+    }
+    builder.header(Header::ContentType, file->content_type);
+    builder.content_length(size);
+    add_validators(*file, builder);
+    builder.end_header();
+
+    if (request.method == Method::GET && size > 0) {
+        response.file_fd = file->fd;
+        response.file_offset = offset;
+        response.file_size = size;
+        response.owner = std::move(file);
+    }
+}
+
+// Sends the ranges as a multipart/byteranges body. The delimiters and part
+// headers are kept in the response's body, and the ranges are referenced in
+// the mapping of the file.
+void http::StaticFiles::send_multipart(std::shared_ptr<File> file, const ByteRange* ranges,
+                                       size_t num_ranges, Response& response) const
+{
+    // The boundary only changes with the file.
+    std::string boundary = "biohash-" + file->etag.substr(1, file->etag.size() - 2);
+    std::string& parts = response.body;
+    size_t offsets[max_byte_ranges + 1];
+    uint_least64_t content_length = 0;
+    for (size_t i = 0; i < num_ranges; ++i) {
+        offsets[i] = parts.size();
+        if (i > 0)
+            parts += "\r\n";
+        parts += "--" + boundary + "\r\nContent-Type: " + file->content_type +
+            "\r\nContent-Range: " + content_range(ranges[i], file->size) + "\r\n\r\n";
+        content_length += ranges[i].last - ranges[i].first + 1;
+    }
+    offsets[num_ranges] = parts.size();
+    parts += "\r\n--" + boundary + "--\r\n";
+    content_length += parts.size();
+
+    ResponseBuilder& builder = response.builder;
+    builder.status(206);
+    builder.date();
+    builder.header(Header::ContentType, "multipart/byteranges; boundary=" + boundary);
+    builder.content_length(content_length);
+    add_validators(*file, builder);
+    builder.end_header();
+    for (size_t i = 0; i < num_ranges; ++i) {
+        builder.body(parts.data() + offsets[i], offsets[i + 1] - offsets[i]);
+        builder.body(file->mapping + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    builder.body(parts.data() + offsets[num_ranges], parts.size() - offsets[num_ranges]);
+    response.owner = std::move(file);
+}
+
+void http::StaticFiles::add_validators(const File& file, ResponseBuilder& builder) const
+{
+    builder.header(Header::LastModified,
+                   std::string_view {file.last_modified, time::http_date_size});
+    builder.header(Header::ETag, file.etag);
+    if (!m_config.cache_control.empty())
+        builder.header(Header::CacheControl, m_config.cache_control);
+}
+
+size_t http::StaticFiles::num_cached()
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    return m_entries.size();
+}
+
+// Returns the cached file at 'path', after checking it for changes if it was
+// last checked more than revalidate_ms ago, or opens and caches it. Returns
+// null if there is no regular file at 'path'.
+std::shared_ptr<http::StaticFiles::File> http::StaticFiles::get(const std::string& path)
+{
+    int_fast64_t now = time::monotonic_now();
+    std::shared_ptr<File> cached;
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        auto it = m_index.find(path);
+        if (it != m_index.end()) {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            cached = it->second->file;
+        }
+    }
+    int_fast64_t revalidate = int_fast64_t(m_config.revalidate_ms) * 1000000;
+    if (cached && now - cached->checked.load(std::memory_order_relaxed) < revalidate)
+        return cached;
+
+    struct stat st;
+    if (fstatat(m_root_fd, path.c_str(), &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+        if (cached)
+            erase(path);
+        return nullptr;
+    }
+    if (cached && cached->dev == st.st_dev && cached->ino == st.st_ino &&
+        cached->size == uint_least64_t(st.st_size) &&
+        cached->mtim.tv_sec == st.st_mtim.tv_sec && cached->mtim.tv_nsec == st.st_mtim.tv_nsec) {
+        cached->checked.store(now, std::memory_order_relaxed);
+        return cached;
+    }
+
+    int fd = openat(m_root_fd, path.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    if (fd < 0)
+        return nullptr;
+    // The file may have been replaced since fstatat().
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+
+    std::shared_ptr<File> file {new File};
+    file->fd = fd;
+    file->size = uint_least64_t(st.st_size);
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtim = st.st_mtim;
+    file->content_type = content_type_of(path);
+    file->etag = "\"";
+    append_hex(file->etag, uint_least64_t(st.st_mtim.tv_sec) * 1000000000 +
+               uint_least64_t(st.st_mtim.tv_nsec));
+    file->etag += '-';
+    append_hex(file->etag, file->size);
+    file->etag += '"';
+    time::format_http_date(st.st_mtim.tv_sec, file->last_modified);
+    file->checked.store(now, std::memory_order_relaxed);
+    insert(path, file);
+    return file;
+}
+
+void http::StaticFiles::insert(const std::string& path, std::shared_ptr<File> file)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_index.find(path);
+    if (it != m_index.end()) {
+        it->second->file = std::move(file);
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+    if (m_entries.size() == m_config.max_open_files) {
+        // Responses that are being written keep their file open.
+        m_index.erase(m_entries.back().path);
+        m_entries.pop_back();
+    }
+    m_entries.push_front(Entry {path, std::move(file)});
+    m_index.emplace(m_entries.front().path, m_entries.begin());
+}
+
+void http::StaticFiles::erase(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock {m_mutex};
+    auto it = m_index.find(path);
+    if (it != m_index.end()) {
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+}
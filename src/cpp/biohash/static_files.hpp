@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "http.hpp"
+#include "http_server.hpp"
+
+namespace biohash {
+namespace http {
+
+struct StaticFilesConfig {
+    // The number of open files kept in the cache.
+    size_t max_open_files = 1024;
+    // A cached file is checked for changes with stat() at most this often.
+    int revalidate_ms = 1000;
+    // The file served for a path that ends in '/'.
+    std::string index_file = "index.html";
+    // The value of a Cache-Control header, which is omitted if empty.
+    std::string cache_control;
+};
+
+// StaticFiles serves the files below a root directory. Bodies are sent from
+// the file with sendfile(), and the open descriptor, the stat() results and
+// the ETag of a file are kept in a bounded LRU cache. A conditional request
+// with a matching If-None-Match, or If-Modified-Since, is answered with 304
+// from the cache without touching the file.
+//
+// Single and multiple byte ranges are answered with 206. A single range is
+// sent with sendfile(), and a multipart/byteranges body refers to the parts
+// in a mapping of the file that is shared by all responses.
+//
+// serve() may be called concurrently, such as from the reactors of a
+// MultiServer.
+class StaticFiles {
+public:
+
+    StaticFiles(const StaticFilesConfig& config = StaticFilesConfig {});
+    ~StaticFiles();
+
+    StaticFiles(const StaticFiles&) = delete;
+    StaticFiles& operator=(const StaticFiles&) = delete;
+
+    // Opens the root directory. Returns false, with errno set, on failure.
+    bool open(const char* root);
+
+    // Answers a GET or HEAD request for the file at the percent-decoded path
+    // of the request target. Paths with "." or ".." segments are not found,
+    // and other methods are answered with 405.
+    void serve(const Message& request, Response& response);
+
+    // As above with the decoded path given, which must start with '/'.
+    void serve(const Message& request, std::string_view path, Response& response);
+
+    size_t num_cached();
+
+private:
+
+    struct File;
+
+    struct Entry {
+        std::string path;
+        std::shared_ptr<File> file;
+    };
+
+    const StaticFilesConfig m_config;
+    int m_root_fd = -1;
+
+    std::mutex m_mutex;
+    // Most recently used first.
+    std::list<Entry> m_entries;
+    // Entries by their path, which the key refers to.
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> m_index;
+
+    std::shared_ptr<File> get(const std::string& path);
+    void insert(const std::string& path, std::shared_ptr<File> file);
+    void erase(const std::string& path);
+    void send_multipart(std::shared_ptr<File> file, const ByteRange* ranges, size_t num_ranges,
+                        Response& response) const;
+    void add_validators(const File& file, ResponseBuilder& builder) const;
+};
+
+}
+}
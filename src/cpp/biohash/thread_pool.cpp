@@ -0,0 +1,69 @@
+#include "thread_pool.hpp"
+#include "assert.hpp"
+
+using namespace biohash;
+
+ThreadPool::ThreadPool(size_t num_threads)
+{
+    for (size_t i = 0; i < num_threads; ++i)
+        m_threads.emplace_back(&ThreadPool::run_worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_stop = true;
+    }
+    m_cond_start.notify_all();
+    for (std::thread& t: m_threads)
+        t.join();
+}
+
+size_t ThreadPool::size() const
+{
+    return m_threads.size();
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& func)
+{
+    std::lock_guard<std::mutex> loop_lock {m_loop_mutex};
+    std::unique_lock<std::mutex> lock {m_mutex};
+    m_func = &func;
+    m_count = count;
+    m_next_ndx = 0;
+    m_num_done = 0;
+    ++m_generation;
+    m_cond_start.notify_all();
+
+    run_tasks(lock);
+    m_cond_done.wait(lock, [this] { return m_num_done == m_count; });
+    m_func = nullptr;
+}
+
+void ThreadPool::run_worker()
+{
+    std::unique_lock<std::mutex> lock {m_mutex};
+    unsigned long generation = m_generation;
+    while (true) {
+        m_cond_start.wait(lock, [&] { return m_stop || m_generation != generation; });
+        if (m_stop)
+            return;
+        generation = m_generation;
+        run_tasks(lock);
+    }
+}
+
+void ThreadPool::run_tasks(std::unique_lock<std::mutex>& lock)
+{
+    ASSERT(lock.owns_lock());
+    while (m_func && m_next_ndx < m_count) {
+        size_t ndx = m_next_ndx++;
+        const std::function<void(size_t)>& func = *m_func;
+        lock.unlock();
+        func(ndx);
+        lock.lock();
+        if (++m_num_done == m_count)
+            m_cond_done.notify_all();
+    }
+}
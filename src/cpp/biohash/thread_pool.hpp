@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace biohash {
+
+// A ThreadPool owns a fixed number of worker threads that execute parallel
+// loops. The calling thread takes part in each loop, so a pool with zero
+// threads is valid and runs everything on the calling thread. Only one loop
+// runs at a time; concurrent calls to parallel_for() are serialized.
+class ThreadPool {
+public:
+
+    ThreadPool(size_t num_threads);
+    ~ThreadPool();
+
+    // The number of worker threads.
+    size_t size() const;
+
+    // Calls 'func(i)' for every i in [0, count) and returns when all calls
+    // have returned. The calls are distributed over the worker threads and
+    // the calling thread.
+    void parallel_for(size_t count, const std::function<void(size_t)>& func);
+
+private:
+    std::vector<std::thread> m_threads;
+
+    // Serializes calls to parallel_for().
+    std::mutex m_loop_mutex;
+
+    // The mutex protects the members below.
+    std::mutex m_mutex;
+    std::condition_variable m_cond_start;
+    std::condition_variable m_cond_done;
+    const std::function<void(size_t)>* m_func = nullptr;
+    size_t m_count = 0;
+    size_t m_next_ndx = 0;
+    size_t m_num_done = 0;
+    // Incremented for every loop, so that workers can tell a new loop from
+    // the one they have finished.
+    unsigned long m_generation = 0;
+    bool m_stop = false;
+
+    void run_worker();
+    void run_tasks(std::unique_lock<std::mutex>& lock);
+};
+
+}
@@ -1,5 +1,6 @@
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "time.hpp"
 #include "assert.hpp"
@@ -15,6 +16,174 @@ int_fast64_t timespec_to_int(struct timespec tp)
         + static_cast<int_fast64_t>(tp.tv_nsec);
 }
 
+const char day_names[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+const char* const long_day_names[7] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday",
+    "Friday", "Saturday"};
+const char month_names[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep",
+    "Oct", "Nov", "Dec"};
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar, and the
+// inverse, after Howard Hinnant's days_from_civil and civil_from_days.
+int_fast64_t days_from_civil(int_fast64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int_fast64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int_fast64_t>(doe) - 719468;
+}
+
+void civil_from_days(int_fast64_t days, int_fast64_t& year, unsigned& month, unsigned& day)
+{
+    days += 719468;
+    int_fast64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned doe = static_cast<unsigned>(days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = static_cast<int_fast64_t>(yoe) + era * 400 + (month <= 2);
+}
+
+void write_digits(char* buf, unsigned value, int num_digits)
+{
+    for (int i = num_digits - 1; i >= 0; --i) {
+        buf[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+}
+
+bool read_digits(const char* data, int num_digits, unsigned& value)
+{
+    value = 0;
+    for (int i = 0; i < num_digits; ++i) {
+        if (data[i] < '0' || data[i] > '9')
+            return false;
+        value = 10 * value + (data[i] - '0');
+    }
+    return true;
+}
+
+bool read_day_name(const char* data)
+{
+    for (const char* day_name: day_names) {
+        if (memcmp(data, day_name, 3) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool read_month(const char* data, unsigned& month)
+{
+    for (unsigned i = 0; i < 12; ++i) {
+        if (memcmp(data, month_names[i], 3) == 0) {
+            month = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// hour ":" minute ":" second
+bool read_time_of_day(const char* data, int_fast64_t& seconds)
+{
+    unsigned hour, minute, second;
+    if (!read_digits(data, 2, hour) || data[2] != ':' || !read_digits(data + 3, 2, minute) ||
+        data[5] != ':' || !read_digits(data + 6, 2, second))
+        return false;
+    if (hour > 23 || minute > 59 || second > 60)
+        return false;
+    seconds = 3600 * hour + 60 * minute + second;
+    return true;
+}
+
+bool make_seconds(int_fast64_t year, unsigned month, unsigned day, int_fast64_t time_of_day,
+                  int_fast64_t& seconds)
+{
+    if (day < 1 || day > 31)
+        return false;
+    int_fast64_t days = days_from_civil(year, month, day);
+
+    // Reject days beyond the end of the month.
+    int_fast64_t check_year;
+    unsigned check_month, check_day;
+    civil_from_days(days, check_year, check_month, check_day);
+    if (check_month != month)
+        return false;
+
+    seconds = 86400 * days + time_of_day;
+    return true;
+}
+
+// IMF-fixdate = day-name "," SP date1 SP time-of-day SP GMT
+// date1 = day SP month SP year, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+bool parse_imf_fixdate(const char* data, size_t size, int_fast64_t& seconds)
+{
+    if (size != 29 || data[3] != ',' || data[4] != ' ' || data[7] != ' ' || data[11] != ' ' ||
+        data[16] != ' ' || memcmp(data + 25, " GMT", 4) != 0)
+        return false;
+    unsigned day, month, year;
+    int_fast64_t time_of_day;
+    if (!read_day_name(data) || !read_digits(data + 5, 2, day) || !read_month(data + 8, month) ||
+        !read_digits(data + 12, 4, year) || !read_time_of_day(data + 17, time_of_day))
+        return false;
+    return make_seconds(year, month, day, time_of_day, seconds);
+}
+
+// rfc850-date = day-name-l "," SP date2 SP time-of-day SP GMT
+// date2 = day "-" month "-" 2DIGIT, e.g. "Sunday, 06-Nov-94 08:49:37 GMT"
+bool parse_rfc850_date(const char* data, size_t size, int_fast64_t& seconds)
+{
+    const char* comma = static_cast<const char*>(memchr(data, ',', size));
+    if (!comma)
+        return false;
+    size_t day_name_size = comma - data;
+    bool day_name_valid = false;
+    for (const char* day_name: long_day_names) {
+        if (strlen(day_name) == day_name_size && memcmp(day_name, data, day_name_size) == 0)
+            day_name_valid = true;
+    }
+    if (!day_name_valid)
+        return false;
+    data = comma + 1;
+    size -= day_name_size + 1;
+
+    if (size != 23 || data[0] != ' ' || data[3] != '-' || data[7] != '-' || data[10] != ' ' ||
+        memcmp(data + 19, " GMT", 4) != 0)
+        return false;
+    unsigned day, month, year;
+    int_fast64_t time_of_day;
+    if (!read_digits(data + 1, 2, day) || !read_month(data + 4, month) ||
+        !read_digits(data + 8, 2, year) || !read_time_of_day(data + 11, time_of_day))
+        return false;
+    // Two digit years are taken to be in 1970 to 2069.
+    year += (year < 70) ? 2000 : 1900;
+    return make_seconds(year, month, day, time_of_day, seconds);
+}
+
+// asctime-date = day-name SP date3 SP time-of-day SP year
+// date3 = month SP ( 2DIGIT / ( SP DIGIT )), e.g. "Sun Nov  6 08:49:37 1994"
+bool parse_asctime_date(const char* data, size_t size, int_fast64_t& seconds)
+{
+    if (size != 24 || data[3] != ' ' || data[7] != ' ' || data[10] != ' ' || data[19] != ' ')
+        return false;
+    unsigned day, month, year;
+    int_fast64_t time_of_day;
+    if (data[8] == ' ') {
+        if (!read_digits(data + 9, 1, day))
+            return false;
+    }
+    else if (!read_digits(data + 8, 2, day))
+        return false;
+    if (!read_day_name(data) || !read_month(data + 4, month) ||
+        !read_time_of_day(data + 11, time_of_day) ||
+        !read_digits(data + 20, 4, year))
+        return false;
+    return make_seconds(year, month, day, time_of_day, seconds);
+}
+
 }
 
 int_fast64_t time::realtime_now()
@@ -46,3 +215,57 @@ int time::formatted_now(char* buf, size_t size)
 
     return rc;
 }
+
+void time::format_http_date(int_fast64_t seconds, char* buf)
+{
+    int_fast64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    int_fast64_t time_of_day = seconds - 86400 * days;
+    int_fast64_t year;
+    unsigned month, day;
+    civil_from_days(days, year, month, day);
+    ASSERT(year >= 0 && year <= 9999);
+    int_fast64_t weekday = (days % 7 + 11) % 7;
+
+    memcpy(buf, day_names[weekday], 3);
+    memcpy(buf + 3, ", ", 2);
+    write_digits(buf + 5, day, 2);
+    buf[7] = ' ';
+    memcpy(buf + 8, month_names[month - 1], 3);
+    buf[11] = ' ';
+    write_digits(buf + 12, static_cast<unsigned>(year), 4);
+    buf[16] = ' ';
+    write_digits(buf + 17, static_cast<unsigned>(time_of_day / 3600), 2);
+    buf[19] = ':';
+    write_digits(buf + 20, static_cast<unsigned>(time_of_day / 60 % 60), 2);
+    buf[22] = ':';
+    write_digits(buf + 23, static_cast<unsigned>(time_of_day % 60), 2);
+    memcpy(buf + 25, " GMT", 4);
+}
+
+bool time::parse_http_date(const char* data, size_t size, int_fast64_t& seconds)
+{
+    if (size < 24)
+        return false;
+    if (data[3] == ',')
+        return parse_imf_fixdate(data, size, seconds);
+    if (data[3] == ' ')
+        return parse_asctime_date(data, size, seconds);
+    return parse_rfc850_date(data, size, seconds);
+}
+
+const char* time::cached_http_date()
+{
+    struct Cache {
+        time_t second = -1;
+        char date[http_date_size];
+    };
+    thread_local Cache cache;
+
+    struct timespec tp;
+    clock_gettime(CLOCK_REALTIME_COARSE, &tp);
+    if (tp.tv_sec != cache.second) {
+        format_http_date(tp.tv_sec, cache.date);
+        cache.second = tp.tv_sec;
+    }
+    return cache.date;
+}
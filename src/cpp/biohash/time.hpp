@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace biohash {
@@ -12,5 +13,25 @@ namespace time {
     int_fast64_t monotonic_now();
 
     int formatted_now(char* buf, size_t size);
+
+    // HTTP-date, RFC 9110 section 5.6.7
+
+    // The size of an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT".
+    constexpr size_t http_date_size = 29;
+
+    // Writes the IMF-fixdate of 'seconds' since the epoch into 'buf', which
+    // must have room for http_date_size bytes. The year must be in the range
+    // 0 to 9999.
+    void format_http_date(int_fast64_t seconds, char* buf);
+
+    // Parses an HTTP-date in the IMF-fixdate format or one of the obsolete
+    // RFC 850 and asctime formats into seconds since the epoch. Returns false
+    // if 'data' is not a valid HTTP-date.
+    bool parse_http_date(const char* data, size_t size, int_fast64_t& seconds);
+
+    // Returns the IMF-fixdate of the current second, http_date_size bytes
+    // without a terminating null. The string is kept per thread and formatted
+    // at most once per second.
+    const char* cached_http_date();
 }
 }
@@ -59,7 +59,7 @@ size_t websocket::write_client_handshake_headers(char* buf, size_t size, const c
     if (size_total > size)
         return size_total;
 
-    size_header = http::write_header(buf + size_total, size, "Connection", "Upgrade");
+    size_header = http::write_header(buf + size_total, size - size_total, "Connection", "Upgrade");
     size_total += size_header;
     if (size_total > size)
         return size_total;
@@ -68,17 +68,17 @@ size_t websocket::write_client_handshake_headers(char* buf, size_t size, const c
     make_sec_websocket_key(sec_websocket_key);
     sec_websocket_key[24] = '\0';
 
-    size_header = http::write_header(buf + size_total, size, "Sec-WebSocket-Key", sec_websocket_key);
+    size_header = http::write_header(buf + size_total, size - size_total, "Sec-WebSocket-Key", sec_websocket_key);
     size_total += size_header;
     if (size_total > size)
         return size_total;
 
-    size_header = http::write_header(buf + size_total, size, "Sec-WebSocket-Protocol", protocol);
+    size_header = http::write_header(buf + size_total, size - size_total, "Sec-WebSocket-Protocol", protocol);
     size_total += size_header;
     if (size_total > size)
         return size_total;
 
-    size_header = http::write_header(buf + size_total, size, "Sec-WebSocket-Version", "13");
+    size_header = http::write_header(buf + size_total, size - size_total, "Sec-WebSocket-Version", "13");
     size_total += size_header;
     return size_total;
 }
@@ -95,12 +95,12 @@ size_t websocket::write_server_handshake_status_and_headers(char* buf, size_t si
     if (size_total > size)
         return size_total;
 
-    size_line = http::write_header(buf + size_total, size, "Upgrade", "websocket");
+    size_line = http::write_header(buf + size_total, size - size_total, "Upgrade", "websocket");
     size_total += size_line;
     if (size_total > size)
         return size_total;
 
-    size_line = http::write_header(buf + size_total, size, "Connection", "Upgrade");
+    size_line = http::write_header(buf + size_total, size - size_total, "Connection", "Upgrade");
     size_total += size_line;
     if (size_total > size)
         return size_total;
@@ -109,12 +109,12 @@ size_t websocket::write_server_handshake_status_and_headers(char* buf, size_t si
     calculate_sec_websocket_accept(sec_websocket_key, sec_websocket_accept);
     sec_websocket_accept[28] = '\0';
 
-    size_line = http::write_header(buf + size_total, size, "Sec-WebSocket-Accept", sec_websocket_accept);
+    size_line = http::write_header(buf + size_total, size - size_total, "Sec-WebSocket-Accept", sec_websocket_accept);
     size_total += size_line;
     if (size_total > size)
         return size_total;
 
-    size_line = http::write_header(buf + size_total, size, "Sec-WebSocket-Protocol", protocol);
+    size_line = http::write_header(buf + size_total, size - size_total, "Sec-WebSocket-Protocol", protocol);
     size_total += size_line;
     return size_total;
 }
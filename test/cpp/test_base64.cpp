@@ -1,8 +1,11 @@
 #include <string.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 
 #include "util/test.hpp"
 #include <biohash/base64.hpp>
+#include <biohash/thread_pool.hpp>
 #include <biohash/assert.hpp>
 
 using namespace biohash;
@@ -133,3 +136,359 @@ TEST(base64_random)
         CHECK(memcmp(decoded_data_0, decoded_data_1, decoded_size_0) == 0);
     }
 }
+
+TEST(base64_isa)
+{
+    const base64::Isa isas[] = {
+        base64::Isa::scalar,
+        base64::Isa::sse41,
+        base64::Isa::avx2,
+        base64::Isa::avx512vbmi
+    };
+    CHECK(base64::isa_supported(base64::Isa::scalar));
+    CHECK(base64::isa_supported(base64::default_isa()));
+
+    char decoded_data_0[300];
+    char decoded_data_1[300];
+    char encoded_data_0[400];
+    char encoded_data_1[400];
+
+    for (base64::Isa isa: isas) {
+        if (!base64::isa_supported(isa))
+            continue;
+        for (int i = 0; i < 200; ++i) {
+            const size_t decoded_size = arc4random_uniform(301);
+            arc4random_buf(decoded_data_0, decoded_size);
+            size_t encoded_size = base64::encode(decoded_data_0, decoded_size,
+                                                 encoded_data_0, base64::Isa::scalar);
+            size_t encoded_size_1 = base64::encode(decoded_data_0, decoded_size,
+                                                   encoded_data_1, isa);
+            CHECK_EQUAL(encoded_size, encoded_size_1);
+            CHECK(memcmp(encoded_data_0, encoded_data_1, encoded_size) == 0);
+
+            size_t decoded_size_1;
+            bool ret = base64::decode(encoded_data_1, encoded_size, decoded_data_1,
+                                      decoded_size_1, isa);
+            CHECK(ret);
+            CHECK_EQUAL(decoded_size, decoded_size_1);
+            CHECK(memcmp(decoded_data_0, decoded_data_1, decoded_size) == 0);
+
+            // Corrupt a single character. Decoding fails with the scalar code
+            // if and only if it fails with the kernel.
+            if (encoded_size == 0)
+                continue;
+            const char corruptions[] = {'=', '-', '_', ' ', '\0', '\x80', '\xff', '@'};
+            size_t pos = arc4random_uniform(encoded_size);
+            encoded_data_1[pos] = corruptions[arc4random_uniform(sizeof(corruptions))];
+            bool ret_0 = base64::decode(encoded_data_1, encoded_size, decoded_data_1,
+                                        decoded_size_1, base64::Isa::scalar);
+            bool ret_1 = base64::decode(encoded_data_1, encoded_size, decoded_data_1,
+                                        decoded_size_1, isa);
+            CHECK_EQUAL(ret_0, ret_1);
+        }
+    }
+}
+
+TEST(base64_encoder)
+{
+    char decoded_data[500];
+    char encoded_data_0[700];
+    char encoded_data_1[700];
+
+    base64::Encoder encoder;
+    for (int i = 0; i < 50; ++i) {
+        const size_t decoded_size = arc4random_uniform(501);
+        arc4random_buf(decoded_data, decoded_size);
+        size_t encoded_size_0 = base64::encode(decoded_data, decoded_size, encoded_data_0);
+
+        size_t ndx_in = 0;
+        size_t ndx_out = 0;
+        while (ndx_in < decoded_size) {
+            size_t chunk_size = std::min<size_t>(arc4random_uniform(40), decoded_size - ndx_in);
+            size_t size = encoder.update(decoded_data + ndx_in, chunk_size,
+                                         encoded_data_1 + ndx_out);
+            CHECK(size <= base64::Encoder::max_update_size(chunk_size));
+            ndx_in += chunk_size;
+            ndx_out += size;
+        }
+        ndx_out += encoder.finish(encoded_data_1 + ndx_out);
+        CHECK_EQUAL(encoded_size_0, ndx_out);
+        CHECK(memcmp(encoded_data_0, encoded_data_1, ndx_out) == 0);
+    }
+}
+
+TEST(base64_decoder)
+{
+    char decoded_data_0[500];
+    char decoded_data_1[500];
+    char encoded_data[700];
+
+    base64::Decoder decoder;
+    for (int i = 0; i < 50; ++i) {
+        const size_t decoded_size = arc4random_uniform(501);
+        arc4random_buf(decoded_data_0, decoded_size);
+        size_t encoded_size = base64::encode(decoded_data_0, decoded_size, encoded_data);
+
+        size_t ndx_in = 0;
+        size_t ndx_out = 0;
+        while (ndx_in < encoded_size) {
+            size_t chunk_size = std::min<size_t>(arc4random_uniform(40), encoded_size - ndx_in);
+            size_t size;
+            bool ret = decoder.update(encoded_data + ndx_in, chunk_size,
+                                      decoded_data_1 + ndx_out, size);
+            CHECK(ret);
+            CHECK(size <= base64::Decoder::max_update_size(chunk_size));
+            ndx_in += chunk_size;
+            ndx_out += size;
+        }
+        CHECK(decoder.finish());
+        CHECK_EQUAL(decoded_size, ndx_out);
+        CHECK(memcmp(decoded_data_0, decoded_data_1, ndx_out) == 0);
+    }
+}
+
+TEST(base64_decoder_invalid)
+{
+    size_t num_invalids = sizeof(invalids) / sizeof(char*);
+
+    base64::Decoder decoder;
+    for (size_t i = 0; i < num_invalids; ++i) {
+        const char* encoded_data = invalids[i];
+        const size_t encoded_size = std::strlen(encoded_data);
+        char decoded_data[30];
+        for (size_t j = 0; j <= encoded_size; ++j) {
+            size_t size_0;
+            size_t size_1;
+            bool ret_0 = decoder.update(encoded_data, j, decoded_data, size_0);
+            bool ret_1 = decoder.update(encoded_data + j, encoded_size - j,
+                                        decoded_data, size_1);
+            bool ret_2 = decoder.finish();
+            CHECK(!(ret_0 && ret_1 && ret_2));
+        }
+    }
+
+    // Data after a padded group.
+    size_t size;
+    char decoded_data[10];
+    CHECK(decoder.update("AQ==", 4, decoded_data, size));
+    CHECK_EQUAL(size, 1);
+    CHECK(!decoder.update("AQ==", 4, decoded_data, size));
+    CHECK(!decoder.finish());
+    CHECK(decoder.update("AQ", 2, decoded_data, size));
+    CHECK(decoder.update("=", 1, decoded_data, size));
+    CHECK(!decoder.update("=A", 2, decoded_data, size));
+    CHECK(!decoder.finish());
+}
+
+namespace {
+
+struct VariantPair {
+    base64::Variant variant;
+    const char* decoded_data;
+    const size_t decoded_size;
+    const char* encoded_data;
+};
+
+VariantPair variant_pairs[] = {
+    {base64::Variant::standard_unpadded, "", 0, ""},
+    {base64::Variant::standard_unpadded, "\xff", 1, "/w"},
+    {base64::Variant::standard_unpadded, "\xff\xff", 2, "//8"},
+    {base64::Variant::standard_unpadded, "\xfb\xff\xbf", 3, "+/+/"},
+    {base64::Variant::url, "\xff", 1, "_w=="},
+    {base64::Variant::url, "\xfb\xff\xbf", 3, "-_-_"},
+    {base64::Variant::url, "\x64\x64", 2, "ZGQ="},
+    {base64::Variant::url_unpadded, "\xff\xff", 2, "__8"},
+    {base64::Variant::url_unpadded, "\xfb\xff\xbf\x01", 4, "-_-_AQ"},
+    {base64::Variant::mime, "\1\1", 2, "AQE="},
+};
+
+struct VariantInvalid {
+    base64::Variant variant;
+    const char* encoded_data;
+};
+
+VariantInvalid variant_invalids[] = {
+    {base64::Variant::standard_unpadded, "A"},
+    {base64::Variant::standard_unpadded, "AQ=="},
+    {base64::Variant::standard_unpadded, "AR"},
+    {base64::Variant::standard_unpadded, "AQF"},
+    {base64::Variant::standard_unpadded, "-_-_"},
+    {base64::Variant::url, "+/+/"},
+    {base64::Variant::url, "__8"},
+    {base64::Variant::url, "_x=="},
+    {base64::Variant::url_unpadded, "_w=="},
+    {base64::Variant::url_unpadded, "+/+/"},
+    {base64::Variant::url_unpadded, "AAAAA"},
+    {base64::Variant::mime, "AQ==\r\nAQ=="},
+    {base64::Variant::mime, "AQ\r\n="},
+    {base64::Variant::mime, "AQ-="},
+    {base64::Variant::mime, "AQE=A"},
+};
+
+}
+
+TEST(base64_variants)
+{
+    char result[20];
+    for (const VariantPair& pair: variant_pairs) {
+        size_t encoded_size = strlen(pair.encoded_data);
+        CHECK_EQUAL(base64::encoded_size(pair.decoded_size, pair.variant), encoded_size);
+        size_t size = base64::encode(pair.decoded_data, pair.decoded_size, result, pair.variant);
+        CHECK_EQUAL(size, encoded_size);
+        CHECK(memcmp(pair.encoded_data, result, encoded_size) == 0);
+        bool ret = base64::decode(pair.encoded_data, encoded_size, result, size, pair.variant);
+        CHECK(ret);
+        CHECK_EQUAL(size, pair.decoded_size);
+        CHECK(memcmp(pair.decoded_data, result, size) == 0);
+    }
+    for (const VariantInvalid& invalid: variant_invalids) {
+        size_t size;
+        CHECK(!base64::decode(invalid.encoded_data, strlen(invalid.encoded_data), result,
+                              size, invalid.variant));
+    }
+}
+
+TEST(base64_mime)
+{
+    char decoded_data_0[200];
+    char decoded_data_1[200];
+    char encoded_data[300];
+    char spaced_data[600];
+
+    arc4random_buf(decoded_data_0, 200);
+    size_t encoded_size = base64::encode(decoded_data_0, 200, encoded_data,
+                                         base64::Variant::mime);
+    // 268 characters in 4 lines.
+    CHECK_EQUAL(encoded_size, 268 + 3 * 2);
+    CHECK(memcmp(encoded_data + 76, "\r\n", 2) == 0);
+    CHECK(memcmp(encoded_data + 2 * 78 - 2, "\r\n", 2) == 0);
+    CHECK(memcmp(encoded_data + 3 * 78 - 2, "\r\n", 2) == 0);
+
+    // Whitespace is skipped anywhere.
+    const char spaces[] = {' ', '\t', '\r', '\n'};
+    for (int i = 0; i < 20; ++i) {
+        size_t spaced_size = 0;
+        for (size_t j = 0; j < encoded_size; ++j) {
+            while (arc4random_uniform(4) == 0)
+                spaced_data[spaced_size++] = spaces[arc4random_uniform(4)];
+            spaced_data[spaced_size++] = encoded_data[j];
+        }
+        while (arc4random_uniform(2) == 0)
+            spaced_data[spaced_size++] = spaces[arc4random_uniform(4)];
+        ASSERT(spaced_size <= 600);
+        size_t decoded_size;
+        bool ret = base64::decode(spaced_data, spaced_size, decoded_data_1, decoded_size,
+                                  base64::Variant::mime);
+        CHECK(ret);
+        CHECK_EQUAL(decoded_size, 200);
+        CHECK(memcmp(decoded_data_0, decoded_data_1, 200) == 0);
+    }
+}
+
+TEST(base64_variants_random)
+{
+    const base64::Variant variants[] = {
+        base64::Variant::standard,
+        base64::Variant::standard_unpadded,
+        base64::Variant::url,
+        base64::Variant::url_unpadded,
+        base64::Variant::mime
+    };
+    const base64::Isa isas[] = {
+        base64::Isa::scalar,
+        base64::Isa::sse41,
+        base64::Isa::avx2,
+        base64::Isa::avx512vbmi
+    };
+
+    char decoded_data_0[300];
+    char decoded_data_1[300];
+    char encoded_data_0[500];
+    char encoded_data_1[500];
+
+    for (base64::Variant variant: variants) {
+        for (int i = 0; i < 50; ++i) {
+            const size_t decoded_size = arc4random_uniform(301);
+            arc4random_buf(decoded_data_0, decoded_size);
+            size_t encoded_size = base64::encode(decoded_data_0, decoded_size, encoded_data_0,
+                                                 variant, base64::Isa::scalar);
+            CHECK_EQUAL(encoded_size, base64::encoded_size(decoded_size, variant));
+            for (base64::Isa isa: isas) {
+                if (!base64::isa_supported(isa))
+                    continue;
+                size_t size = base64::encode(decoded_data_0, decoded_size, encoded_data_1,
+                                             variant, isa);
+                CHECK_EQUAL(size, encoded_size);
+                CHECK(memcmp(encoded_data_0, encoded_data_1, encoded_size) == 0);
+                bool ret = base64::decode(encoded_data_1, encoded_size, decoded_data_1, size,
+                                          variant, isa);
+                CHECK(ret);
+                CHECK_EQUAL(size, decoded_size);
+                CHECK(size <= base64::max_decoded_size(encoded_size));
+                CHECK(memcmp(decoded_data_0, decoded_data_1, decoded_size) == 0);
+
+                if (encoded_size == 0)
+                    continue;
+                const char corruptions[] = {'=', '-', '_', '+', '/', '\0', '\x80', '\xdf'};
+                size_t pos = arc4random_uniform(encoded_size);
+                encoded_data_1[pos] = corruptions[arc4random_uniform(sizeof(corruptions))];
+                bool ret_0 = base64::decode(encoded_data_1, encoded_size, decoded_data_1,
+                                            size, variant, base64::Isa::scalar);
+                bool ret_1 = base64::decode(encoded_data_1, encoded_size, decoded_data_1,
+                                            size, variant, isa);
+                CHECK_EQUAL(ret_0, ret_1);
+            }
+        }
+    }
+}
+
+TEST(base64_parallel)
+{
+    const base64::Variant variants[] = {
+        base64::Variant::standard,
+        base64::Variant::standard_unpadded,
+        base64::Variant::url,
+        base64::Variant::url_unpadded,
+        base64::Variant::mime
+    };
+
+    ThreadPool pool {3};
+    std::vector<char> decoded_data_0(5000);
+    std::vector<char> decoded_data_1(5000);
+    std::vector<char> encoded_data_0(7000);
+    std::vector<char> encoded_data_1(7000);
+
+    for (base64::Variant variant: variants) {
+        for (int i = 0; i < 20; ++i) {
+            const size_t decoded_size = arc4random_uniform(5001);
+            const size_t min_chunk_size = 1 + arc4random_uniform(1000);
+            arc4random_buf(decoded_data_0.data(), decoded_size);
+            size_t encoded_size = base64::encode(decoded_data_0.data(), decoded_size,
+                                                 encoded_data_0.data(), variant);
+            size_t size = base64::parallel_encode(pool, decoded_data_0.data(), decoded_size,
+                                                  encoded_data_1.data(), variant, min_chunk_size);
+            CHECK_EQUAL(size, encoded_size);
+            CHECK(memcmp(encoded_data_0.data(), encoded_data_1.data(), encoded_size) == 0);
+
+            bool ret = base64::parallel_decode(pool, encoded_data_1.data(), encoded_size,
+                                               decoded_data_1.data(), size, variant,
+                                               min_chunk_size);
+            CHECK(ret);
+            CHECK_EQUAL(size, decoded_size);
+            CHECK(memcmp(decoded_data_0.data(), decoded_data_1.data(), decoded_size) == 0);
+
+            // Padding or an invalid character anywhere.
+            if (encoded_size == 0)
+                continue;
+            const char corruptions[] = {'=', '*'};
+            size_t pos = arc4random_uniform(encoded_size);
+            encoded_data_1[pos] = corruptions[arc4random_uniform(2)];
+            bool ret_0 = base64::decode(encoded_data_1.data(), encoded_size,
+                                        decoded_data_1.data(), size, variant);
+            bool ret_1 = base64::parallel_decode(pool, encoded_data_1.data(), encoded_size,
+                                                 decoded_data_1.data(), size, variant,
+                                                 min_chunk_size);
+            CHECK_EQUAL(ret_0, ret_1);
+        }
+    }
+}
@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <string>
+
+#include <biohash/assert.hpp>
+#include <biohash/compression.hpp>
+#include <biohash/static_files.hpp>
+
+#include "util/http.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Message = http::Message;
+
+namespace {
+
+// Decompresses gzip with 'window_bits' 15 + 16 and the zlib format with 15.
+bool inflate_all(const std::string& data, int window_bits, std::string& out)
+{
+    z_stream stream {};
+    if (inflateInit2(&stream, window_bits) != Z_OK)
+        return false;
+    char buf[4096];
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    int rc;
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(buf);
+        stream.avail_out = sizeof buf;
+        rc = inflate(&stream, Z_NO_FLUSH);
+        out.append(buf, sizeof buf - stream.avail_out);
+    } while (rc == Z_OK);
+    inflateEnd(&stream);
+    return rc == Z_STREAM_END && stream.avail_in == 0;
+}
+
+std::string text(size_t size)
+{
+    std::string str;
+    while (str.size() < size)
+        str += "{\"id\": " + std::to_string(arc4random_uniform(1000)) +
+            ", \"name\": \"biohash\"}, ";
+    str.resize(size);
+    return str;
+}
+
+// Answers with a body whose Content-Type, size and header fields are selected by
+// the query.
+void handler(const Message& request, std::string_view, http::Response& response)
+{
+    std::string_view query = http::split_request_target(request.request_target).query;
+    auto has = [&](const char* name) {
+        return http::query_param(query, name).data() != nullptr;
+    };
+    response.body = text(has("small") ? 100 : 10000);
+    response.builder.status(has("not-found") ? 404 : 200);
+    response.builder.header(http::Header::ContentType,
+                            has("png") ? "image/png" : "application/json; charset=utf-8");
+    if (has("etag"))
+        response.builder.header(http::Header::ETag, "\"abc\"");
+    if (has("vary"))
+        response.builder.header(http::Header::Vary, "Cookie");
+    if (has("no-transform"))
+        response.builder.header(http::Header::CacheControl, "public, no-transform");
+    if (has("encoded"))
+        response.builder.header(http::Header::ContentEncoding, "br");
+    response.builder.content_length(response.body.size());
+    response.builder.end_header();
+    if (request.method != http::Method::HEAD)
+        response.builder.body(response.body.data(), response.body.size());
+}
+
+std::string get(http::Compressor& compressor, const std::string& target,
+                const std::string& accept_encoding)
+{
+    return handle(compressor, "GET " + target + " HTTP/1.1\r\nAccept-Encoding: " +
+                  accept_encoding + "\r\n\r\n");
+}
+
+} // anonymous namespace
+
+TEST(compression_round_trip)
+{
+    std::string data = text(100000);
+    for (int level: {1, 6, 9, -1}) {
+        std::string gzip = "prefix";
+        CHECK(http::compress(http::ContentCoding::gzip, level, data.data(), data.size(), gzip));
+        CHECK(gzip.compare(0, 8, "prefix\x1f\x8b") == 0);
+        CHECK(gzip.size() < data.size() / 2);
+        std::string out;
+        CHECK(inflate_all(gzip.substr(6), 15 + 16, out));
+        CHECK(out == data);
+
+        std::string deflate;
+        CHECK(http::compress(http::ContentCoding::deflate, level, data.data(), data.size(),
+                             deflate));
+        CHECK_EQUAL(deflate[0], 0x78);
+        out.clear();
+        CHECK(inflate_all(deflate, 15, out));
+        CHECK(out == data);
+    }
+
+    // The streams are reused for small and empty inputs.
+    for (size_t size: {0, 1, 100}) {
+        std::string gzip;
+        CHECK(http::compress(http::ContentCoding::gzip, 6, data.data(), size, gzip));
+        std::string out;
+        CHECK(inflate_all(gzip, 15 + 16, out));
+        CHECK(out == data.substr(0, size));
+    }
+}
+
+TEST(compression_compressor)
+{
+    http::Compressor compressor {handler};
+
+    std::string first = get(compressor, "/?etag&vary", "br, gzip");
+    Message msg {Message::Kind::Response, first.data(), first.size()};
+    CHECK(msg.complete);
+    CHECK_EQUAL(msg.status_code, 200);
+    CHECK(msg.header(http::Header::ContentEncoding) == "gzip");
+    CHECK(msg.header(http::Header::Vary) == "Cookie, Accept-Encoding");
+    CHECK(msg.header(http::Header::ETag) == "W/\"abc\"");
+    CHECK(msg.header(http::Header::ContentType) == "application/json; charset=utf-8");
+    CHECK(msg.content_length < 5000);
+    CHECK_EQUAL(msg.message_size, first.size());
+    std::string body;
+    CHECK(inflate_all(std::string {msg.body, msg.content_length}, 15 + 16, body));
+    CHECK_EQUAL(body.size(), 10000);
+
+    // The body with an ETag is compressed once per coding.
+    std::string second = get(compressor, "/?etag&vary", "gzip");
+    CHECK(second == first);
+    CHECK_EQUAL(compressor.num_compressed(), 1);
+    CHECK_EQUAL(compressor.num_cache_hits(), 1);
+    std::string deflate = get(compressor, "/?etag&vary", "deflate");
+    Message deflate_msg {Message::Kind::Response, deflate.data(), deflate.size()};
+    CHECK(deflate_msg.header(http::Header::ContentEncoding) == "deflate");
+    CHECK_EQUAL(compressor.num_compressed(), 2);
+    CHECK_EQUAL(compressor.num_cached(), 2);
+
+    // The response to HEAD has the header of the cached compressed response.
+    std::string head = handle(compressor, "HEAD /?etag&vary HTTP/1.1\r\n"
+                              "Accept-Encoding: gzip\r\n\r\n");
+    CHECK(head == first.substr(0, first.find("\r\n\r\n") + 4));
+    CHECK_EQUAL(compressor.num_compressed(), 2);
+
+    // Without an ETag, the body is compressed every time.
+    std::string dynamic = get(compressor, "/", "gzip");
+    Message dynamic_msg {Message::Kind::Response, dynamic.data(), dynamic.size()};
+    CHECK(dynamic_msg.header(http::Header::Vary) == "Accept-Encoding");
+    CHECK(!dynamic_msg.header(http::Header::ETag).data());
+    get(compressor, "/", "gzip");
+    CHECK_EQUAL(compressor.num_compressed(), 4);
+    CHECK_EQUAL(compressor.num_cached(), 2);
+}
+
+TEST(compression_compressor_unchanged)
+{
+    http::Compressor compressor {handler};
+
+    // Responses that could have been compressed only get a Vary field, and
+    // so do responses to HEAD without a cached compressed body.
+    const char* identity_requests[] = {
+        "GET / HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nAccept-Encoding: br, identity\r\n\r\n",
+        "GET / HTTP/1.1\r\nAccept-Encoding: gzip;q=0\r\n\r\n",
+        "HEAD / HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+    };
+    for (const char* request_str: identity_requests) {
+        std::string response = handle(compressor, request_str);
+        Message msg {Message::Kind::Response, response.data(), response.size()};
+        // The response to HEAD has no body.
+        CHECK(msg.complete || strncmp(request_str, "HEAD", 4) == 0);
+        CHECK_EQUAL(msg.status_code, 200);
+        CHECK(msg.header(http::Header::Vary) == "Accept-Encoding");
+        CHECK(!msg.header(http::Header::ContentEncoding).data());
+        CHECK_EQUAL(msg.content_length, 10000);
+    }
+
+    const char* requests[] = {
+        "GET /?small HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+        "GET /?png HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+        "GET /?not-found HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+        "GET /?no-transform HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+        "GET /?encoded HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n",
+    };
+    for (const char* request_str: requests) {
+        std::string compressed = handle(compressor, request_str);
+        Message request {Message::Kind::Request, request_str, strlen(request_str)};
+        http::Response response;
+        handler(request, {}, response);
+        std::string expected = serialize(response);
+        // The bodies are random, so only the headers are compared.
+        CHECK(compressed.substr(0, compressed.find("\r\n\r\n")) ==
+              expected.substr(0, expected.find("\r\n\r\n")));
+    }
+    CHECK_EQUAL(compressor.num_compressed(), 0);
+
+    // A limit below the size of the body.
+    http::CompressorConfig config;
+    config.max_size = 1000;
+    http::Compressor limited {handler, config};
+    std::string response = get(limited, "/", "gzip");
+    CHECK(response.find("Content-Encoding") == std::string::npos);
+    CHECK_EQUAL(limited.num_compressed(), 0);
+}
+
+TEST(compression_static_files)
+{
+    char templ[] = "/tmp/biohash_test_XXXXXX";
+    const char* dir = mkdtemp(templ);
+    ASSERT(dir);
+    std::string content = text(20000);
+    std::string path = std::string {dir} + "/data.json";
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT(fd >= 0);
+    ssize_t rc = ::write(fd, content.data(), content.size());
+    ASSERT(rc == ssize_t(content.size()));
+    close(fd);
+
+    http::StaticFiles files;
+    CHECK(files.open(dir));
+    http::Compressor compressor {[&](const Message& request, std::string_view,
+                                     http::Response& response) {
+        files.serve(request, response);
+    }};
+
+    for (int i = 0; i < 3; ++i) {
+        std::string response = get(compressor, "/data.json", "gzip");
+        Message msg {Message::Kind::Response, response.data(), response.size()};
+        CHECK(msg.complete);
+        CHECK(msg.header(http::Header::ContentEncoding) == "gzip");
+        CHECK(msg.header(http::Header::ETag).substr(0, 3) == "W/\"");
+        CHECK(msg.header(http::Header::Vary) == "Accept-Encoding");
+        // Ranges are not served of the compressed body.
+        CHECK(!msg.header(http::Header::AcceptRanges).data());
+        std::string body;
+        CHECK(inflate_all(std::string {msg.body, msg.content_length}, 15 + 16, body));
+        CHECK(body == content);
+    }
+    CHECK_EQUAL(compressor.num_compressed(), 1);
+    CHECK_EQUAL(compressor.num_cache_hits(), 2);
+
+    // A conditional request with the weak ETag is answered with 304.
+    std::string etag;
+    {
+        std::string response = get(compressor, "/data.json", "gzip");
+        Message msg {Message::Kind::Response, response.data(), response.size()};
+        etag = std::string {msg.header(http::Header::ETag)};
+    }
+    std::string not_modified = handle(compressor, "GET /data.json HTTP/1.1\r\n"
+                                      "Accept-Encoding: gzip\r\nIf-None-Match: " + etag +
+                                      "\r\n\r\n");
+    Message not_modified_msg {Message::Kind::Response, not_modified.data(),
+                              not_modified.size()};
+    CHECK_EQUAL(not_modified_msg.status_code, 304);
+    CHECK(not_modified_msg.header(http::Header::ETag) == etag);
+    CHECK(not_modified_msg.header(http::Header::Vary) == "Accept-Encoding");
+
+    // The identity response keeps its strong ETag and its ranges.
+    std::string identity = get(compressor, "/data.json", "identity");
+    Message identity_msg {Message::Kind::Response, identity.data(), identity.size()};
+    CHECK_EQUAL(identity_msg.status_code, 200);
+    CHECK_EQUAL(identity_msg.content_length, content.size());
+    CHECK(identity_msg.header(http::Header::ETag) == etag.substr(2));
+    CHECK(identity_msg.header(http::Header::AcceptRanges) == "bytes");
+    CHECK(identity_msg.header(http::Header::Vary) == "Accept-Encoding");
+    not_modified = handle(compressor, "GET /data.json HTTP/1.1\r\nIf-None-Match: " +
+                          etag.substr(2) + "\r\n\r\n");
+    Message strong_msg {Message::Kind::Response, not_modified.data(), not_modified.size()};
+    CHECK_EQUAL(strong_msg.status_code, 304);
+    CHECK(strong_msg.header(http::Header::ETag) == etag.substr(2));
+    CHECK(strong_msg.header(http::Header::Vary) == "Accept-Encoding");
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,278 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <biohash/event_loop.hpp>
+
+#include "util/system.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+
+namespace {
+
+// Reads everything from a pipe when it is readable and records the events.
+struct PipeReader: EventLoop::Handler {
+
+    int fd;
+    std::vector<uint32_t> events;
+    std::string data;
+
+    void on_event(uint32_t ev) override
+    {
+        events.push_back(ev);
+        char buf[64];
+        ssize_t rc;
+        while ((rc = read(fd, buf, sizeof buf)) > 0)
+            data.append(buf, static_cast<size_t>(rc));
+    }
+};
+
+// Reads a stream socket added with Mode::stream through the loop, unless
+// 'reading' is cleared.
+struct StreamReader: EventLoop::Handler {
+
+    EventLoop* loop;
+    int fd;
+    bool reading = true;
+    size_t num_events = 0;
+    std::string data;
+    bool eof = false;
+
+    void on_event(uint32_t) override
+    {
+        ++num_events;
+        if (reading)
+            drain();
+    }
+
+    void drain()
+    {
+        char buf[4096];
+        ssize_t rc;
+        while ((rc = loop->read(fd, buf, sizeof buf)) > 0)
+            data.append(buf, static_cast<size_t>(rc));
+        if (rc == 0)
+            eof = true;
+    }
+};
+
+// Accepts connections of a socket added with Mode::listener.
+struct Acceptor: EventLoop::Handler {
+
+    EventLoop* loop;
+    int fd;
+    std::vector<int> accepted;
+
+    void on_event(uint32_t) override
+    {
+        int rc;
+        while ((rc = loop->accept(fd)) >= 0)
+            accepted.push_back(rc);
+    }
+};
+
+struct FuncHandler: EventLoop::Handler {
+
+    std::function<void()> func;
+
+    void on_event(uint32_t) override
+    {
+        func();
+    }
+};
+
+void check_loop(TestBase::Context& test_context, EventLoop& loop)
+{
+    int fds[2];
+    CHECK(pipe2(fds, O_NONBLOCK) == 0);
+    PipeReader reader;
+    reader.fd = fds[0];
+    CHECK(loop.add(fds[0], EPOLLIN | EPOLLET, reader));
+
+    // Nothing to do.
+    loop.run_once(0);
+    CHECK(reader.events.empty());
+
+    CHECK(write(fds[1], "abc", 3) == 3);
+    loop.run_once(1000);
+    CHECK_EQUAL(reader.events.size(), 1);
+    CHECK(reader.data == "abc");
+
+    // Edge triggered: one event for each write.
+    CHECK(write(fds[1], "de", 2) == 2);
+    loop.run_once(1000);
+    CHECK_EQUAL(reader.events.size(), 2);
+    CHECK(reader.data == "abcde");
+
+    // A closed writer.
+    close(fds[1]);
+    loop.run_once(1000);
+    CHECK_EQUAL(reader.events.size(), 3);
+    if (reader.events.size() == 3)
+        CHECK(reader.events[2] & EPOLLHUP);
+
+    loop.remove(fds[0]);
+    loop.run_once(10);
+    CHECK_EQUAL(reader.events.size(), 3);
+    close(fds[0]);
+
+    // Registering twice fails.
+    CHECK(pipe2(fds, O_NONBLOCK) == 0);
+    CHECK(loop.add(fds[0], EPOLLIN | EPOLLET, reader));
+    CHECK(!loop.add(fds[0], EPOLLIN | EPOLLET, reader));
+    CHECK(loop.modify(fds[0], EPOLLIN | EPOLLET, reader));
+    loop.remove(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+
+    // A stream socket.
+    {
+        int pair[2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == 0);
+        StreamReader stream;
+        stream.loop = &loop;
+        stream.fd = pair[0];
+        CHECK(loop.add(pair[0], EPOLLIN | EPOLLRDHUP | EPOLLET, stream,
+                       EventLoop::Mode::stream));
+        CHECK(write(pair[1], "abc", 3) == 3);
+        loop.run_once(1000);
+        CHECK(stream.data == "abc");
+
+        // More than the loop keeps for a reader that does not read, which
+        // then reads everything up to the end of the stream.
+        std::string content(1 << 20, 'x');
+        for (size_t i = 0; i < content.size(); i += 997)
+            content[i] = static_cast<char>('a' + i % 26);
+        stream.reading = false;
+        fcntl(pair[1], F_SETFL, 0);
+        std::thread writer {[&] {
+            size_t offset = 0;
+            while (offset < content.size()) {
+                ssize_t rc = write(pair[1], content.data() + offset, content.size() - offset);
+                if (rc <= 0)
+                    break;
+                offset += static_cast<size_t>(rc);
+            }
+            shutdown(pair[1], SHUT_WR);
+        }};
+        size_t num_events;
+        do {
+            num_events = stream.num_events;
+            loop.run_once(100);
+        } while (stream.num_events != num_events);
+        stream.reading = true;
+        stream.drain();
+        for (int i = 0; i < 1000 && !stream.eof; ++i)
+            loop.run_once(1000);
+        writer.join();
+        CHECK(stream.eof);
+        CHECK_EQUAL(stream.data.size(), 3 + content.size());
+        CHECK(stream.data.compare(3, std::string::npos, content) == 0);
+        loop.remove(pair[0]);
+        close(pair[0]);
+        close(pair[1]);
+    }
+
+    // A listening socket.
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addr_size = sizeof addr;
+        CHECK(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) == 0);
+        CHECK(listen(fd, 16) == 0);
+        CHECK(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_size) == 0);
+        Acceptor acceptor;
+        acceptor.loop = &loop;
+        acceptor.fd = fd;
+        CHECK(loop.add(fd, EPOLLIN | EPOLLET, acceptor, EventLoop::Mode::listener));
+
+        std::vector<int> clients;
+        for (int i = 0; i < 3; ++i) {
+            int client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            CHECK(connect(client, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) == 0);
+            clients.push_back(client);
+        }
+        for (int i = 0; i < 100 && acceptor.accepted.size() < 3; ++i)
+            loop.run_once(1000);
+        CHECK_EQUAL(acceptor.accepted.size(), 3);
+
+        // Connections accepted but not taken are closed on removal.
+        int last = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        CHECK(connect(last, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) == 0);
+        clients.push_back(last);
+        loop.remove(fd);
+        loop.run_once(10);
+        close(fd);
+        for (int accepted: acceptor.accepted)
+            close(accepted);
+        for (int client: clients)
+            close(client);
+    }
+
+    // Functions posted by handlers are called after the events of the
+    // iteration, so that they may destroy other handlers.
+    {
+        int first_fds[2];
+        int second_fds[2];
+        CHECK(pipe2(first_fds, O_NONBLOCK) == 0);
+        CHECK(pipe2(second_fds, O_NONBLOCK) == 0);
+        std::vector<std::string> order;
+        FuncHandler first;
+        FuncHandler second;
+        first.func = [&] {
+            order.push_back("event");
+            loop.post([&] { order.push_back("posted"); });
+        };
+        second.func = first.func;
+        CHECK(loop.add(first_fds[0], EPOLLIN | EPOLLET, first));
+        CHECK(loop.add(second_fds[0], EPOLLIN | EPOLLET, second));
+        CHECK(write(first_fds[1], "a", 1) == 1);
+        CHECK(write(second_fds[1], "b", 1) == 1);
+        loop.run_once(1000);
+        CHECK(order == std::vector<std::string>({"event", "event", "posted", "posted"}));
+        for (int* pair: {first_fds, second_fds}) {
+            loop.remove(pair[0]);
+            close(pair[0]);
+            close(pair[1]);
+        }
+    }
+
+    // post() and stop() from another thread.
+    int calls = 0;
+    std::thread thread {[&] {
+        loop.post([&] { ++calls; });
+        loop.post([&] { ++calls; loop.stop(); });
+    }};
+    loop.run();
+    thread.join();
+    CHECK_EQUAL(calls, 2);
+}
+
+} // anonymous namespace
+
+TEST(event_loop_epoll)
+{
+    EventLoop loop;
+    CHECK(loop.backend() == EventLoop::Backend::epoll);
+    check_loop(test_context, loop);
+}
+
+TEST(event_loop_io_uring)
+{
+    // Falls back to epoll where io_uring is not available.
+    EventLoop loop {EventLoop::Backend::io_uring};
+    if (io_uring_available())
+        CHECK(loop.backend() == EventLoop::Backend::io_uring);
+    check_loop(test_context, loop);
+}
@@ -0,0 +1,399 @@
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <biohash/assert.hpp>
+#include <biohash/http_client.hpp>
+#include <biohash/http_server.hpp>
+
+#include "util/http.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Client = http::Client;
+using Message = http::Message;
+
+namespace {
+
+int listen_socket(uint16_t& port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_size = sizeof addr;
+    int rc = bind(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_size);
+    ASSERT(rc == 0);
+    rc = getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_size);
+    ASSERT(rc == 0);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Answers every request header with a fixed response, or never if it is
+// empty, and closes the connection after the response if 'close' is true.
+struct RawServer {
+
+    uint16_t port;
+    int listen_fd;
+    std::string response;
+    bool close_after;
+    std::atomic<int> connection_fd {-1};
+    std::thread thread;
+
+    RawServer(std::string response, bool close_after = false):
+        listen_fd {listen_socket(port)},
+        response {std::move(response)},
+        close_after {close_after}
+    {
+        int rc = listen(listen_fd, 16);
+        ASSERT(rc == 0);
+        thread = std::thread {[this] { serve(); }};
+    }
+
+    ~RawServer()
+    {
+        // The client may keep its connection open.
+        shutdown(listen_fd, SHUT_RDWR);
+        int fd = connection_fd.load();
+        if (fd >= 0)
+            shutdown(fd, SHUT_RDWR);
+        thread.join();
+        close(listen_fd);
+    }
+
+    void serve()
+    {
+        for (;;) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+                return;
+            connection_fd = fd;
+            serve_connection(fd);
+            connection_fd = -1;
+            close(fd);
+        }
+    }
+
+    void serve_connection(int fd)
+    {
+        std::string data;
+        for (;;) {
+            char buf[4096];
+            ssize_t rc = recv(fd, buf, sizeof buf, 0);
+            if (rc <= 0)
+                return;
+            data.append(buf, static_cast<size_t>(rc));
+            size_t end;
+            while ((end = data.find("\r\n\r\n")) != std::string::npos) {
+                data.erase(0, end + 4);
+                if (response.empty())
+                    continue;
+                ssize_t sent = send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+                ASSERT(sent == ssize_t(response.size()));
+                if (close_after)
+                    return;
+            }
+        }
+    }
+};
+
+struct Result {
+    bool done = false;
+    Client::Error error = Client::Error::None;
+    int status_code = 0;
+    std::string content_type;
+    std::string body;
+};
+
+Client::Callback store(Result& result)
+{
+    return [&result](Client::Error error, const Message& response, std::string_view body) {
+        result.done = true;
+        result.error = error;
+        result.status_code = response.status_code;
+        result.content_type = std::string {response.header(http::Header::ContentType)};
+        result.body = std::string {body};
+    };
+}
+
+void run_until(EventLoop& loop, std::initializer_list<const Result*> results)
+{
+    for (int i = 0; i < 100; ++i) {
+        bool done = true;
+        for (const Result* result: results)
+            done = done && result->done;
+        if (done)
+            return;
+        loop.run_once(100);
+    }
+}
+
+void run_until(EventLoop& loop, const Result& result)
+{
+    for (int i = 0; i < 100 && !result.done; ++i)
+        loop.run_once(100);
+}
+
+// Reads 'size' bytes from the non-blocking socket 'fd'.
+std::string read_stream(int fd, uint_least64_t size)
+{
+    std::string data;
+    while (data.size() < size) {
+        char buf[65536];
+        ssize_t rc = recv(fd, buf, std::min<uint_least64_t>(sizeof buf, size - data.size()), 0);
+        if (rc > 0)
+            data.append(buf, static_cast<size_t>(rc));
+        else if (rc < 0 && errno == EAGAIN) {
+            struct pollfd pfd {fd, POLLIN, 0};
+            poll(&pfd, 1, 1000);
+        }
+        else
+            break;
+    }
+    return data;
+}
+
+uint16_t unused_port()
+{
+    uint16_t port;
+    int fd = listen_socket(port);
+    close(fd);
+    return port;
+}
+
+} // anonymous namespace
+
+TEST(http_client_keep_alive)
+{
+    TestServer server {echo};
+    EventLoop loop;
+    Client client {loop};
+
+    Result results[3];
+    http::ClientRequest request;
+    request.request_target = "/first";
+    CHECK(client.request("127.0.0.1", server.server.port(), request, store(results[0])));
+    run_until(loop, results[0]);
+    CHECK(results[0].error == Client::Error::None);
+    CHECK_EQUAL(results[0].status_code, 200);
+    CHECK(results[0].content_type == "text/plain");
+    CHECK(results[0].body == "/first:");
+    CHECK_EQUAL(client.num_connections(), 1);
+    CHECK_EQUAL(client.num_idle_connections(), 1);
+
+    // The idle connection is reused, also for a request sent from a callback.
+    request.request_target = "/second";
+    auto callback = store(results[1]);
+    client.request("127.0.0.1", server.server.port(), request,
+                   [&](Client::Error error, const Message& response, std::string_view body) {
+        callback(error, response, body);
+        http::ClientRequest next;
+        next.request_target = "/third";
+        client.request("127.0.0.1", server.server.port(), next, store(results[2]));
+    });
+    run_until(loop, {&results[1], &results[2]});
+    CHECK(results[1].done && results[2].done);
+    CHECK(results[1].body == "/second:");
+    CHECK(results[2].body == "/third:");
+    CHECK_EQUAL(client.num_connections(), 1);
+}
+
+TEST(http_client_post)
+{
+    TestServer server {echo};
+    EventLoop loop;
+    Client client {loop};
+
+    Result result;
+    http::ClientRequest request;
+    request.method = http::Method::POST;
+    request.request_target = "/upload";
+    request.headers.emplace_back("Content-Type", "text/plain");
+    request.body = "some data";
+    client.request("127.0.0.1", server.server.port(), request, store(result));
+    run_until(loop, result);
+    CHECK(result.error == Client::Error::None);
+    CHECK(result.body == "/upload:some data");
+}
+
+TEST(http_client_pipelining)
+{
+    TestServer server {echo};
+    EventLoop loop;
+    http::ClientConfig config;
+    config.max_connections_per_host = 2;
+    Client client {loop, config};
+
+    std::vector<Result> results(10);
+    for (size_t i = 0; i < results.size(); ++i) {
+        http::ClientRequest request;
+        request.request_target = "/" + std::to_string(i);
+        client.request("127.0.0.1", server.server.port(), request, store(results[i]));
+    }
+    for (const Result& result: results)
+        run_until(loop, result);
+    for (size_t i = 0; i < results.size(); ++i) {
+        CHECK(results[i].done);
+        CHECK(results[i].error == Client::Error::None);
+        CHECK(results[i].body == "/" + std::to_string(i) + ":");
+    }
+    CHECK_EQUAL(client.num_connections(), 2);
+    CHECK_EQUAL(client.num_idle_connections(), 2);
+}
+
+TEST(http_client_framing)
+{
+    EventLoop loop;
+    // Requests to the same server are pipelined on one connection.
+    http::ClientConfig config;
+    config.max_connections_per_host = 1;
+    Client client {loop, config};
+
+    {
+        RawServer server {"HTTP/1.1 100 Continue\r\n\r\n"
+                          "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"};
+        Result result;
+        client.request("127.0.0.1", server.port, {}, store(result));
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::None);
+        CHECK_EQUAL(result.status_code, 200);
+        CHECK(result.body == "hello world");
+        CHECK_EQUAL(client.num_idle_connections(), 1);
+    }
+
+    {
+        // The body of a response without a length ends with the connection.
+        RawServer server {"HTTP/1.1 200 OK\r\n\r\nuntil the end", true};
+        Result result;
+        client.request("127.0.0.1", server.port, {}, store(result));
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::None);
+        CHECK(result.body == "until the end");
+    }
+
+    {
+        // A response to HEAD has no body. The server accepts one connection
+        // at a time, so the second request is pipelined.
+        RawServer server {"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n"};
+        Result results[2];
+        http::ClientRequest request;
+        request.method = http::Method::HEAD;
+        client.request("127.0.0.1", server.port, request, store(results[0]));
+        client.request("127.0.0.1", server.port, request, store(results[1]));
+        run_until(loop, {&results[0], &results[1]});
+        CHECK(results[0].done && results[1].done);
+        CHECK(results[0].error == Client::Error::None);
+        CHECK(results[1].error == Client::Error::None);
+        CHECK(results[1].body == "");
+    }
+
+    {
+        RawServer server {"HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok"};
+        Result result;
+        client.request("127.0.0.1", server.port, {}, store(result));
+        run_until(loop, result);
+        CHECK(result.body == "ok");
+        CHECK_EQUAL(client.num_idle_connections(), 0);
+    }
+}
+
+TEST(http_client_stream)
+{
+    std::string content(1000000, 'x');
+    TestServer server {[&content](const Message&, std::string_view, http::Response& response) {
+        response.send(200, "text/plain", content);
+    }};
+    EventLoop loop;
+    // The body of a streamed response is not limited, and the limit makes
+    // sure that the rest of it is still in the socket.
+    http::ClientConfig config;
+    config.max_response_size = 64 * 1024;
+    Client client {loop, config};
+
+    for (bool finish: {true, false}) {
+        Result result;
+        std::unique_ptr<Client::BodyStream> stream;
+        auto callback = store(result);
+        client.stream("127.0.0.1", server.server.port(), {},
+                      [&](Client::Error error, const Message& response, std::string_view body,
+                          std::unique_ptr<Client::BodyStream> rest) {
+            callback(error, response, body);
+            stream = std::move(rest);
+        });
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::None);
+        CHECK(stream != nullptr);
+        if (!stream)
+            break;
+        CHECK_EQUAL(result.body.size() + stream->size(), content.size());
+        CHECK(result.body + read_stream(stream->fd(), stream->size()) == content);
+        CHECK_EQUAL(client.num_idle_connections(), 0);
+
+        // The connection is reused after a finished stream and closed after
+        // another one.
+        if (finish)
+            stream->finish();
+        stream.reset();
+        loop.run_once(100);
+        CHECK_EQUAL(client.num_idle_connections(), finish ? 1 : 0);
+        CHECK_EQUAL(client.num_connections(), finish ? 1 : 0);
+    }
+}
+
+TEST(http_client_errors)
+{
+    EventLoop loop;
+    http::ClientConfig config;
+    config.request_timeout_ms = 200;
+    config.timer_interval_ms = 20;
+    config.max_response_size = 1024;
+    Client client {loop, config};
+
+    CHECK(!client.request("localhost", 80, {}, [](Client::Error, const Message&,
+                                                   std::string_view) {}));
+
+    {
+        Result result;
+        client.request("127.0.0.1", unused_port(), {}, store(result));
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::Connect);
+    }
+
+    {
+        RawServer server {""};
+        Result result;
+        client.request("127.0.0.1", server.port, {}, store(result));
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::Timeout);
+        CHECK_EQUAL(client.num_connections(), 0);
+    }
+
+    {
+        RawServer server {"HTTP/1.1 200 OK\r\nContent-Length: 2000\r\n\r\n"};
+        Result result;
+        client.request("127.0.0.1", server.port, {}, store(result));
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::TooLarge);
+    }
+
+    {
+        RawServer server {"HTTP/1.1 2000 OK\r\n\r\n"};
+        Result result;
+        client.request("127.0.0.1", server.port, {}, store(result));
+        run_until(loop, result);
+        CHECK(result.error == Client::Error::InvalidResponse);
+    }
+}
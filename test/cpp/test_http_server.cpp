@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <biohash/assert.hpp>
+#include <biohash/http_server.hpp>
+
+#include "util/http.hpp"
+#include "util/system.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Message = http::Message;
+
+namespace {
+
+void send_all(int fd, std::string_view data)
+{
+    while (!data.empty()) {
+        ssize_t rc = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        ASSERT(rc > 0);
+        data.remove_prefix(static_cast<size_t>(rc));
+    }
+}
+
+// Reads until 'count' complete responses have arrived and returns them.
+std::vector<std::string> read_responses(int fd, size_t count)
+{
+    std::string data;
+    std::vector<std::string> responses;
+    while (responses.size() < count) {
+        char buf[4096];
+        ssize_t rc = recv(fd, buf, sizeof buf, 0);
+        if (rc <= 0)
+            break;
+        data.append(buf, static_cast<size_t>(rc));
+
+        std::vector<Message> messages;
+        bool valid;
+        size_t offset = http::parse_pipeline(Message::Kind::Response, data.data(), data.size(),
+                                             messages, valid);
+        ASSERT(valid);
+        size_t begin = 0;
+        for (const Message& msg: messages) {
+            responses.emplace_back(data, begin, msg.message_size);
+            begin += msg.message_size;
+        }
+        data.erase(0, offset);
+    }
+    return responses;
+}
+
+bool is_closed(int fd)
+{
+    char buf[64];
+    return recv(fd, buf, sizeof buf, 0) == 0;
+}
+
+// Collects a body and records the size of the largest fragment.
+class TestSink: public http::BodySink {
+public:
+
+    TestSink(size_t& max_fragment):
+        m_max_fragment {max_fragment}
+    {
+    }
+
+    bool write(const char* data, size_t size) override
+    {
+        m_max_fragment = std::max(m_max_fragment, size);
+        m_data.append(data, size);
+        return true;
+    }
+
+    void finish(const Message& request, bool complete, http::Response& response) override
+    {
+        if (complete)
+            echo(request, m_data, response);
+    }
+
+private:
+
+    size_t& m_max_fragment;
+    std::string m_data;
+};
+
+} // anonymous namespace
+
+TEST(http_server_keep_alive)
+{
+    TestServer test {echo};
+    int fd = connect_to(test.server.port());
+
+    for (int i = 0; i < 3; ++i) {
+        send_all(fd, "GET /home HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        std::vector<std::string> responses = read_responses(fd, 1);
+        CHECK_EQUAL(responses.size(), 1);
+        if (responses.size() != 1)
+            break;
+        Message msg {Message::Kind::Response, responses[0].data(), responses[0].size()};
+        CHECK(msg.complete);
+        CHECK_EQUAL(msg.status_code, 200);
+        CHECK(msg.header(http::Header::ContentType) == "text/plain");
+        CHECK(msg.header(http::Header::Date).size() == 29);
+        CHECK(body_of(responses[0]) == "/home:");
+    }
+    close(fd);
+}
+
+TEST(http_server_pipelined)
+{
+    TestServer test {echo};
+    int fd = connect_to(test.server.port());
+
+    send_all(fd,
+             "GET /a HTTP/1.1\r\n\r\n"
+             "POST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+             "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+             "GET /d HTTP/1.1\r\n");
+    send_all(fd, "Connection: close\r\n\r\n");
+
+    std::vector<std::string> responses = read_responses(fd, 4);
+    CHECK_EQUAL(responses.size(), 4);
+    if (responses.size() == 4) {
+        CHECK(body_of(responses[0]) == "/a:");
+        CHECK(body_of(responses[1]) == "/b:hello");
+        CHECK(body_of(responses[2]) == "/c:abcde");
+        CHECK(body_of(responses[3]) == "/d:");
+    }
+    CHECK(is_closed(fd));
+    close(fd);
+}
+
+TEST(http_server_slow_client)
+{
+    TestServer test {echo};
+    int fd = connect_to(test.server.port());
+
+    std::string request = "PUT /slow HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody";
+    for (char ch: request) {
+        send_all(fd, std::string_view {&ch, 1});
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    std::vector<std::string> responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(body_of(responses[0]) == "/slow:body");
+    close(fd);
+}
+
+TEST(http_server_errors)
+{
+    http::ServerConfig config;
+    config.max_header_size = 1024;
+    config.max_body_size = 1024;
+    TestServer test {echo, config};
+
+    int fd = connect_to(test.server.port());
+    send_all(fd, "GET /home HTTP/1.0\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 24, "HTTP/1.1 400 Bad Request") == 0);
+    CHECK(is_closed(fd));
+    close(fd);
+
+    fd = connect_to(test.server.port());
+    send_all(fd, "GET /home HTTP/1.1\r\nX-Large: " + std::string(2000, 'x') + "\r\n\r\n");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 12, "HTTP/1.1 431") == 0);
+    close(fd);
+
+    fd = connect_to(test.server.port());
+    send_all(fd, "POST /home HTTP/1.1\r\nContent-Length: 1025\r\n\r\n");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 12, "HTTP/1.1 413") == 0);
+    close(fd);
+
+    fd = connect_to(test.server.port());
+    send_all(fd, "POST /home HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "400\r\n" + std::string(1024, 'x') + "\r\n1\r\nx\r\n0\r\n\r\n");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 12, "HTTP/1.1 413") == 0);
+    close(fd);
+}
+
+TEST(http_server_io_uring)
+{
+    http::ServerConfig config;
+    config.backend = EventLoop::Backend::io_uring;
+    http::MultiServer server {2, echo, config};
+    CHECK(server.start("127.0.0.1", 0));
+    if (io_uring_available())
+        CHECK(server.backend() == EventLoop::Backend::io_uring);
+
+    for (int i = 0; i < 4; ++i) {
+        int fd = connect_to(server.port());
+        send_all(fd, "GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 2\r\n\r\nxy");
+        std::vector<std::string> responses = read_responses(fd, 2);
+        CHECK_EQUAL(responses.size(), 2);
+        if (responses.size() == 2) {
+            CHECK(body_of(responses[0]) == "/a:");
+            CHECK(body_of(responses[1]) == "/b:xy");
+        }
+        close(fd);
+    }
+}
+
+TEST(http_server_large_response)
+{
+    std::string content(1 << 22, 'z');
+    TestServer test {[&](const Message&, std::string_view, http::Response& response) {
+        response.builder.status(200);
+        response.builder.content_length(content.size());
+        response.builder.end_header();
+        response.builder.body(content.data(), content.size());
+    }};
+
+    int fd = connect_to(test.server.port());
+    send_all(fd, "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 2);
+    CHECK_EQUAL(responses.size(), 2);
+    for (const std::string& response: responses)
+        CHECK(body_of(response) == content);
+    close(fd);
+}
+
+TEST(http_server_deferred)
+{
+    // The deferred responses are completed from the loop after their handlers
+    // have returned, and the requests after them wait.
+    TestServer test {[&test](const Message& request, std::string_view body,
+                             http::Response& response) {
+        std::string_view target = request.request_target;
+        if (target != "/later" && target != "/empty")
+            return echo(request, body, response);
+        std::shared_ptr<http::DeferredResponse> deferred = response.defer();
+        bool empty = target == "/empty";
+        test.loop.post([deferred, empty] {
+            if (!empty)
+                deferred->response()->send(200, "text/plain", "later");
+            deferred->complete();
+        });
+    }};
+
+    int fd = connect_to(test.server.port());
+    send_all(fd, "GET /later HTTP/1.1\r\n\r\nGET /a HTTP/1.1\r\n\r\n"
+                 "GET /empty HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 4);
+    CHECK_EQUAL(responses.size(), 4);
+    if (responses.size() == 4) {
+        CHECK(body_of(responses[0]) == "later");
+        CHECK(body_of(responses[1]) == "/a:");
+        CHECK_EQUAL(status_of(responses[2]), 500);
+        CHECK(body_of(responses[3]) == "/b:");
+    }
+    close(fd);
+}
+
+TEST(http_multi_server)
+{
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    http::MultiServer server {3, [&](const Message& request, std::string_view body,
+                                     http::Response& response) {
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            threads.insert(std::this_thread::get_id());
+        }
+        echo(request, body, response);
+    }, http::ServerConfig {}, true};
+    CHECK_EQUAL(server.size(), 3);
+    CHECK(server.start("127.0.0.1", 0));
+    CHECK(server.port() != 0);
+
+    std::vector<int> fds;
+    for (int i = 0; i < 24; ++i)
+        fds.push_back(connect_to(server.port()));
+    for (int fd: fds) {
+        send_all(fd, "GET /multi HTTP/1.1\r\n\r\n");
+        std::vector<std::string> responses = read_responses(fd, 1);
+        CHECK_EQUAL(responses.size(), 1);
+        if (responses.size() == 1)
+            CHECK(body_of(responses[0]) == "/multi:");
+        close(fd);
+    }
+    CHECK(threads.size() >= 1 && threads.size() <= 3);
+
+    // A second group cannot take the port without SO_REUSEPORT.
+    EventLoop loop;
+    http::Server other {loop, echo};
+    CHECK(!other.listen("127.0.0.1", server.port()));
+
+    server.stop();
+}
+
+TEST(http_server_body_sink)
+{
+    http::ServerConfig config;
+    config.body_window = 100;
+    config.max_body_size = 10;
+    size_t max_fragment = 0;
+    TestServer test {echo, config, [&](const Message& request, http::Response&) {
+        if (request.request_target == "/buffered")
+            return std::unique_ptr<http::BodySink> {};
+        return std::unique_ptr<http::BodySink> {new TestSink {max_fragment}};
+    }};
+    int fd = connect_to(test.server.port());
+
+    // The bodies are larger than max_body_size and the window. Each header is
+    // handled before its body arrives, as the 100 responses show, and the
+    // requests follow the bodies in the same packet.
+    std::string body(1000, 'x');
+    for (size_t i = 0; i < body.size(); ++i)
+        body[i] = static_cast<char>('a' + i % 26);
+    send_all(fd, "POST /length HTTP/1.1\r\nContent-Length: 1000\r\nExpect: 100-continue\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+
+    send_all(fd, body + "POST /chunked HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+             "Expect: 100-continue\r\n\r\n");
+    responses = read_responses(fd, 2);
+    CHECK_EQUAL(responses.size(), 2);
+    if (responses.size() == 2) {
+        CHECK(body_of(responses[0]) == "/length:" + body);
+        CHECK(responses[1] == "HTTP/1.1 100 Continue\r\n\r\n");
+    }
+
+    send_all(fd, "3e8\r\n" + body + "\r\n3\r\nend\r\n0\r\n\r\n"
+             "POST /buffered HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+             "GET /last HTTP/1.1\r\n\r\n");
+    responses = read_responses(fd, 3);
+    CHECK_EQUAL(responses.size(), 3);
+    if (responses.size() == 3) {
+        CHECK(body_of(responses[0]) == "/chunked:" + body + "end");
+        CHECK(body_of(responses[1]) == "/buffered:hello");
+        CHECK(body_of(responses[2]) == "/last:");
+    }
+    CHECK(max_fragment > 0);
+    CHECK(max_fragment <= config.body_window);
+    close(fd);
+}
+
+TEST(http_server_expect_continue)
+{
+    TestServer test {echo, {}, [](const Message& request, http::Response& response) {
+        if (request.request_target == "/forbidden")
+            response.send(403, "", "");
+        return std::unique_ptr<http::BodySink> {new http::MemorySink {8, echo}};
+    }};
+
+    int fd = connect_to(test.server.port());
+    send_all(fd, "PUT /upload HTTP/1.1\r\nContent-Length: 4\r\nExpect: 100-continue\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0] == "HTTP/1.1 100 Continue\r\n\r\n");
+    send_all(fd, "data");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(body_of(responses[0]) == "/upload:data");
+
+    // The body has already started.
+    send_all(fd, "PUT /eager HTTP/1.1\r\nContent-Length: 4\r\nExpect: 100-continue\r\n\r\nda");
+    send_all(fd, "ta");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(body_of(responses[0]) == "/eager:data");
+    close(fd);
+
+    // A rejected request receives no 100 response, and the connection closes.
+    fd = connect_to(test.server.port());
+    send_all(fd, "PUT /forbidden HTTP/1.1\r\nContent-Length: 4\r\nExpect: 100-continue\r\n\r\n");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 12, "HTTP/1.1 403") == 0);
+    CHECK(is_closed(fd));
+    close(fd);
+
+    // The sink's limit.
+    fd = connect_to(test.server.port());
+    send_all(fd, "PUT /large HTTP/1.1\r\nContent-Length: 9\r\n\r\n123456789");
+    responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 12, "HTTP/1.1 413") == 0);
+    CHECK(is_closed(fd));
+    close(fd);
+}
+
+TEST(http_server_file_sink)
+{
+    FILE* file = tmpfile();
+    ASSERT(file);
+    int file_fd = fileno(file);
+    uint_least64_t received = 0;
+    TestServer test {echo, {}, [&](const Message&, http::Response&) {
+        return std::unique_ptr<http::BodySink> {new http::FileSink {file_fd, 2,
+            [&](const Message&, uint_least64_t size, http::Response& response) {
+                received = size;
+                response.send(201, "", "");
+            }}};
+    }};
+
+    int fd = connect_to(test.server.port());
+    std::string body(300000, 'y');
+    send_all(fd, "PUT /file HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "493e0\r\n" + body + "\r\n0\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 1);
+    CHECK_EQUAL(responses.size(), 1);
+    if (responses.size() == 1)
+        CHECK(responses[0].compare(0, 12, "HTTP/1.1 201") == 0);
+    CHECK_EQUAL(received, body.size());
+
+    std::string content(body.size(), '\0');
+    CHECK_EQUAL(pread(file_fd, content.data(), content.size(), 2), body.size());
+    CHECK(content == body);
+    close(fd);
+    fclose(file);
+}
+
+TEST(http_server_hash_sink)
+{
+    std::string digest;
+    TestServer test {echo, {}, [&](const Message& request, http::Response&) {
+        if (request.request_target == "/sha1") {
+            return std::unique_ptr<http::BodySink> {new http::HashSink {
+                http::HashSink::Algorithm::sha1,
+                [](const Message&, std::string_view digest, uint_least64_t, http::Response& response) {
+                    response.send(200, "", digest);
+                }}};
+        }
+        // The digest is recorded and the response is built by the next sink.
+        return std::unique_ptr<http::BodySink> {new http::HashSink {
+            http::HashSink::Algorithm::sha256,
+            [&](const Message&, std::string_view hex, uint_least64_t size, http::Response&) {
+                digest = std::string {hex} + ":" + std::to_string(size);
+            },
+            std::unique_ptr<http::BodySink> {new http::MemorySink {16, echo}}}};
+    }};
+    int fd = connect_to(test.server.port());
+
+    send_all(fd, "POST /sha1 HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+             "POST /sha256 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "1\r\na\r\n2\r\nbc\r\n0\r\n\r\n");
+    std::vector<std::string> responses = read_responses(fd, 2);
+    CHECK_EQUAL(responses.size(), 2);
+    if (responses.size() == 2) {
+        CHECK(body_of(responses[0]) == "a9993e364706816aba3e25717850c26c9cd0d89d");
+        CHECK(body_of(responses[1]) == "/sha256:abc");
+    }
+    CHECK(digest == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad:3");
+    close(fd);
+}
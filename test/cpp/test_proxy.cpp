@@ -0,0 +1,342 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <biohash/assert.hpp>
+#include <biohash/http_server.hpp>
+#include <biohash/proxy.hpp>
+
+#include "util/http.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Message = http::Message;
+
+namespace {
+
+// An upstream that answers with its name, the request and the body. The
+// target selects responses that exercise the framing of the proxy.
+struct Upstream {
+
+    std::string name;
+    TestServer server;
+
+    Upstream(const std::string& upstream_name):
+        name {upstream_name},
+        server {[this](const Message& request, std::string_view body,
+                       http::Response& response) {
+            handle(request, body, response);
+        }}
+    {
+    }
+
+    void handle(const Message& request, std::string_view body, http::Response& response)
+    {
+        std::string_view target = request.request_target;
+        if (target == "/large") {
+            std::string content(1000000, 'x');
+            for (size_t i = 0; i < content.size(); i += 1000)
+                content[i] = static_cast<char>('a' + i % 26);
+            return reply(request, std::move(content), response);
+        }
+        if (target == "/chunked") {
+            response.builder.status(200);
+            response.builder.header(http::Header::TransferEncoding, "chunked");
+            response.builder.header(http::Header::Connection, "X-Hop");
+            response.builder.header("X-Hop", "1");
+            response.builder.end_header();
+            response.body = "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+            response.builder.body(response.body.data(), response.body.size());
+            return;
+        }
+        if (target == "/slow")
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+        std::string content = name + " " + http::method_str(request.method) + " " +
+            std::string {target} + " body=" + std::string {body};
+        for (std::string_view field: {"Host", "Via", "X-Hop", "Keep-Alive", "Expect"}) {
+            std::string_view value = request.header(field);
+            if (value.data())
+                content += " " + std::string {field} + "=" + std::string {value};
+        }
+        reply(request, std::move(content), response);
+    }
+
+    // The response to HEAD has no body.
+    void reply(const Message& request, std::string content, http::Response& response)
+    {
+        response.body = std::move(content);
+        response.builder.status(200);
+        response.builder.date();
+        response.builder.content_length(response.body.size());
+        response.builder.end_header();
+        if (request.method != http::Method::HEAD)
+            response.builder.body(response.body.data(), response.body.size());
+    }
+};
+
+// Runs a server with a proxy to 'upstream_port' on a loop thread.
+struct ProxyServer {
+
+    EventLoop loop;
+    http::Proxy proxy;
+    http::Server server;
+    std::thread thread;
+
+    ProxyServer(uint16_t upstream_port):
+        proxy {loop},
+        server {loop, [this](const Message& request, std::string_view body,
+                             http::Response& response) {
+            proxy.handle(request, body, response);
+        }}
+    {
+        bool rc = proxy.add_upstream("127.0.0.1", upstream_port) &&
+            server.listen("127.0.0.1", 0);
+        ASSERT(rc);
+        thread = std::thread {[this] { loop.run(); }};
+    }
+
+    ~ProxyServer()
+    {
+        loop.stop();
+        thread.join();
+    }
+};
+
+// Reads the next response from 'fd', of which 'data' holds the bytes
+// received so far.
+std::string receive(int fd, std::string& data)
+{
+    for (;;) {
+        Message msg {Message::Kind::Response, data.data(), data.size()};
+        if (msg.complete) {
+            std::string response = data.substr(0, msg.message_size);
+            data.erase(0, msg.message_size);
+            return response;
+        }
+        char buf[65536];
+        ssize_t rc = recv(fd, buf, sizeof buf, 0);
+        if (rc <= 0)
+            return std::move(data);
+        data.append(buf, static_cast<size_t>(rc));
+    }
+}
+
+// Sends a request on 'fd' and reads one response.
+std::string exchange(int fd, const std::string& request)
+{
+    ssize_t rc = send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    ASSERT(rc == ssize_t(request.size()));
+    std::string data;
+    return receive(fd, data);
+}
+
+// Passes a request to the proxy, which defers the response until the
+// upstream has answered.
+void start(http::Proxy& proxy, const std::string& request_str, http::Response& response)
+{
+    Message request {Message::Kind::Request, request_str.data(), request_str.size()};
+    std::string_view body {request.body, request.content_length};
+    proxy.handle(request, body, response);
+}
+
+// Runs the loop until the response is complete and returns it. The response
+// has the header and the buffered part of the body, if the rest of it is
+// spliced.
+std::string wait_for(EventLoop& loop, http::Response& response)
+{
+    for (int i = 0; i < 100 && response.deferred && response.deferred->response(); ++i)
+        loop.run_once(100);
+    return serialize(response);
+}
+
+std::string handle(EventLoop& loop, http::Proxy& proxy, const std::string& request_str,
+                   http::Response& response)
+{
+    start(proxy, request_str, response);
+    return wait_for(loop, response);
+}
+
+std::string handle(EventLoop& loop, http::Proxy& proxy, const std::string& request_str)
+{
+    http::Response response;
+    return handle(loop, proxy, request_str, response);
+}
+
+} // anonymous namespace
+
+TEST(proxy_forward)
+{
+    Upstream upstream {"a"};
+    EventLoop loop;
+    http::Proxy proxy {loop};
+    CHECK(proxy.add_upstream("127.0.0.1", upstream.server.server.port()));
+    CHECK(!proxy.add_upstream("localhost", 80));
+
+    std::string response = handle(loop, proxy, "GET /x?y HTTP/1.1\r\nHost: example.com\r\n"
+                                  "Connection: keep-alive, X-Hop\r\nX-Hop: 1\r\n"
+                                  "Keep-Alive: timeout=5\r\n\r\n");
+    Message msg {Message::Kind::Response, response.data(), response.size()};
+    CHECK(msg.complete);
+    CHECK_EQUAL(msg.status_code, 200);
+    CHECK(msg.header("Via") == "1.1 biohash");
+    CHECK(body_of(response) == "a GET /x?y body= Host=example.com Via=1.1 biohash");
+
+    // The connection is kept alive and reused. A request without a Host is
+    // sent with that of the upstream.
+    CHECK_EQUAL(proxy.num_idle_connections(), 1);
+    CHECK(body_of(handle(loop, proxy, "POST /p HTTP/1.1\r\nContent-Length: 3\r\n"
+                         "Expect: 100-continue\r\n\r\nabc")) ==
+          "a POST /p body=abc Host=127.0.0.1:" +
+          std::to_string(upstream.server.server.port()) + " Via=1.1 biohash");
+    CHECK_EQUAL(proxy.num_idle_connections(), 1);
+    CHECK_EQUAL(upstream.server.server.num_connections(), 1);
+    CHECK_EQUAL(proxy.num_outstanding(0), 0);
+
+    // The Host may be replaced.
+    http::ProxyConfig config;
+    config.host = "upstream.local";
+    http::Proxy host_proxy {loop, config};
+    host_proxy.add_upstream("127.0.0.1", upstream.server.server.port());
+    std::string head = handle(loop, host_proxy, "HEAD / HTTP/1.1\r\nHost: example.com\r\n\r\n");
+    CHECK(head.compare(head.size() - 4, 4, "\r\n\r\n") == 0);
+    CHECK(body_of(handle(loop, host_proxy, "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n")) ==
+          "a GET / body= Host=upstream.local Via=1.1 biohash");
+}
+
+TEST(proxy_framing)
+{
+    Upstream upstream {"a"};
+    EventLoop loop;
+    // The limit makes sure that the rest of a large body is spliced.
+    http::ProxyConfig config;
+    config.client.max_response_size = 64 * 1024;
+    http::Proxy proxy {loop, config};
+    proxy.add_upstream("127.0.0.1", upstream.server.server.port());
+
+    // A chunked body is decoded and sent with a Content-Length, and the
+    // hop-by-hop fields of the response are removed.
+    std::string response = handle(loop, proxy, "GET /chunked HTTP/1.1\r\n\r\n");
+    Message msg {Message::Kind::Response, response.data(), response.size()};
+    CHECK(msg.complete);
+    CHECK(!msg.chunked);
+    CHECK(body_of(response) == "hello world");
+    CHECK(!msg.header("X-Hop").data());
+    CHECK(!msg.header(http::Header::Connection).data());
+    CHECK_EQUAL(proxy.num_idle_connections(), 1);
+
+    // The response to HEAD has no body, whatever its Content-Length.
+    response = handle(loop, proxy, "HEAD /large HTTP/1.1\r\n\r\n");
+    CHECK(response.find("Content-Length: 1000000\r\n") != std::string::npos);
+    CHECK(response.compare(response.size() - 4, 4, "\r\n\r\n") == 0);
+    CHECK_EQUAL(proxy.num_idle_connections(), 1);
+
+    // The rest of a body with a Content-Length is spliced. The connection is
+    // closed if the response is dropped before the body has been sent.
+    {
+        http::Response large;
+        response = handle(loop, proxy, "GET /large HTTP/1.1\r\n\r\n", large);
+        CHECK(large.splice_fd >= 0);
+        CHECK(large.splice_size > 0);
+        CHECK(large.splice_size < 1000000);
+        CHECK_EQUAL(proxy.num_outstanding(0), 1);
+        CHECK_EQUAL(proxy.num_idle_connections(), 0);
+        large.reset();
+        loop.run_once(100);
+        CHECK_EQUAL(proxy.num_outstanding(0), 0);
+        CHECK_EQUAL(proxy.num_idle_connections(), 0);
+    }
+}
+
+TEST(proxy_splice)
+{
+    Upstream upstream {"a"};
+    ProxyServer server {upstream.server.server.port()};
+
+    int fd = connect_to(server.server.port());
+    for (int i = 0; i < 3; ++i) {
+        std::string response = exchange(fd, "GET /large HTTP/1.1\r\n\r\n");
+        std::string body = body_of(response);
+        CHECK_EQUAL(body.size(), 1000000);
+        bool intact = true;
+        for (size_t j = 0; j < body.size(); ++j)
+            intact = intact && body[j] == (j % 1000 == 0 ? char('a' + j % 26) : 'x');
+        CHECK(intact);
+        // A small response follows the spliced one on the same connection.
+        CHECK(body_of(exchange(fd, "GET /small HTTP/1.1\r\n\r\n")).compare(0, 13,
+                                                                            "a GET /small ") == 0);
+    }
+
+    // Pipelined requests wait for the deferred responses before them.
+    std::string request = "GET /large HTTP/1.1\r\n\r\nGET /small HTTP/1.1\r\n\r\n";
+    ssize_t rc = send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    CHECK_EQUAL(rc, ssize_t(request.size()));
+    std::string data;
+    CHECK_EQUAL(body_of(receive(fd, data)).size(), 1000000);
+    CHECK(body_of(receive(fd, data)).compare(0, 13, "a GET /small ") == 0);
+    close(fd);
+    CHECK_EQUAL(upstream.server.server.num_connections(), 1);
+}
+
+TEST(proxy_least_outstanding)
+{
+    Upstream a {"a"};
+    Upstream b {"b"};
+    EventLoop loop;
+    http::Proxy proxy {loop};
+    proxy.add_upstream("127.0.0.1", a.server.server.port());
+    proxy.add_upstream("127.0.0.1", b.server.server.port());
+    CHECK_EQUAL(proxy.num_upstreams(), 2);
+
+    // Without outstanding requests, the upstreams take turns.
+    std::string first = body_of(handle(loop, proxy, "GET / HTTP/1.1\r\n\r\n"));
+    std::string second = body_of(handle(loop, proxy, "GET / HTTP/1.1\r\n\r\n"));
+    CHECK(first[0] != second[0]);
+
+    // While a slow request is outstanding on one upstream, the others go to
+    // the other one.
+    http::Response slow;
+    start(proxy, "GET /slow HTTP/1.1\r\n\r\n", slow);
+    CHECK_EQUAL(proxy.num_outstanding(0) + proxy.num_outstanding(1), 1);
+    size_t busy = proxy.num_outstanding(0) == 1 ? 0 : 1;
+    char other = busy == 0 ? 'b' : 'a';
+    for (int i = 0; i < 4; ++i)
+        CHECK_EQUAL(body_of(handle(loop, proxy, "GET / HTTP/1.1\r\n\r\n"))[0], other);
+    CHECK_EQUAL(body_of(wait_for(loop, slow))[0], busy == 0 ? 'a' : 'b');
+    slow.reset();
+    CHECK_EQUAL(proxy.num_outstanding(0), 0);
+    CHECK_EQUAL(proxy.num_outstanding(1), 0);
+}
+
+TEST(proxy_errors)
+{
+    EventLoop loop;
+    http::Proxy empty {loop};
+    CHECK_EQUAL(status_of(handle(loop, empty, "GET / HTTP/1.1\r\n\r\n")), 502);
+
+    // A port without a listener.
+    uint16_t port;
+    {
+        Upstream closed {"closed"};
+        port = closed.server.server.port();
+    }
+    http::Proxy refused {loop};
+    refused.add_upstream("127.0.0.1", port);
+    CHECK_EQUAL(status_of(handle(loop, refused, "GET / HTTP/1.1\r\n\r\n")), 502);
+    CHECK_EQUAL(refused.num_outstanding(0), 0);
+
+    Upstream upstream {"a"};
+    http::ProxyConfig config;
+    config.client.request_timeout_ms = 100;
+    config.client.timer_interval_ms = 20;
+    http::Proxy proxy {loop, config};
+    proxy.add_upstream("127.0.0.1", upstream.server.server.port());
+    CHECK_EQUAL(status_of(handle(loop, proxy, "GET /slow HTTP/1.1\r\n\r\n")), 504);
+    CHECK_EQUAL(proxy.num_idle_connections(), 0);
+    CHECK_EQUAL(status_of(handle(loop, proxy, "CONNECT example.com:443 HTTP/1.1\r\n\r\n")), 501);
+}
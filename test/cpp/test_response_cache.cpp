@@ -0,0 +1,216 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <biohash/response_cache.hpp>
+
+#include "util/http.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Message = http::Message;
+
+namespace {
+
+// A handler that answers with the request target and the number of calls so
+// far. The query selects the status and header fields that affect caching.
+struct TestHandler {
+
+    std::atomic<int> num_calls {0};
+    int delay_ms = 0;
+
+    void operator()(const Message& request, std::string_view, http::Response& response)
+    {
+        int n = ++num_calls;
+        if (delay_ms > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        std::string_view query = http::split_request_target(request.request_target).query;
+        int status = query.find("status=500") != std::string_view::npos ? 500 : 200;
+        response.builder.status(status);
+        response.builder.date();
+        if (query.find("set-cookie") != std::string_view::npos)
+            response.builder.header(http::Header::SetCookie, "a=b");
+        if (query.find("no-store") != std::string_view::npos)
+            response.builder.header(http::Header::CacheControl, "no-store");
+        if (query.find("max-age-0") != std::string_view::npos)
+            response.builder.header(http::Header::CacheControl, "public, max-age=0");
+        if (query.find("vary-cookie") != std::string_view::npos)
+            response.builder.header(http::Header::Vary, "Accept-Encoding, Cookie");
+        if (query.find("vary-encoding") != std::string_view::npos)
+            response.builder.header(http::Header::Vary, "accept-encoding");
+        response.body = std::string {request.request_target} + ":" + std::to_string(n);
+        response.builder.content_length(response.body.size());
+        response.builder.end_header();
+        if (request.method != http::Method::HEAD)
+            response.builder.body(response.body.data(), response.body.size());
+    }
+};
+
+std::string get(http::ResponseCache& cache, const std::string& target,
+                const std::string& fields = "")
+{
+    return body_of(handle(cache, "GET " + target + " HTTP/1.1\r\n" + fields + "\r\n"));
+}
+
+} // anonymous namespace
+
+TEST(response_cache_hit)
+{
+    TestHandler handler;
+    http::ResponseCache cache {std::ref(handler)};
+
+    std::string first = handle(cache, "GET /a HTTP/1.1\r\n\r\n");
+    std::string second = handle(cache, "GET /a HTTP/1.1\r\n\r\n");
+    CHECK(body_of(first) == "/a:1");
+    CHECK(body_of(second) == "/a:1");
+    CHECK_EQUAL(handler.num_calls.load(), 1);
+
+    // The stored response with an Age field.
+    Message msg {Message::Kind::Response, second.data(), second.size()};
+    CHECK(msg.complete);
+    CHECK_EQUAL(msg.status_code, 200);
+    CHECK(msg.header("Age") == "0");
+    CHECK(msg.header(http::Header::Date) == Message(Message::Kind::Response, first.data(),
+                                                    first.size()).header(http::Header::Date));
+
+    // The method and the whole target are part of the key.
+    CHECK(get(cache, "/a?x=1") == "/a?x=1:2");
+    std::string head = handle(cache, "HEAD /a HTTP/1.1\r\n\r\n");
+    CHECK_EQUAL(handler.num_calls.load(), 3);
+    CHECK(handle(cache, "HEAD /a HTTP/1.1\r\n\r\n") ==
+          head.substr(0, head.size() - 2) + "Age: 0\r\n\r\n");
+    CHECK_EQUAL(handler.num_calls.load(), 3);
+
+    CHECK_EQUAL(cache.num_cached(), 3);
+    CHECK_EQUAL(cache.num_hits(), 2);
+    CHECK_EQUAL(cache.num_misses(), 3);
+    CHECK_EQUAL(cache.num_coalesced(), 0);
+
+    cache.clear();
+    CHECK_EQUAL(cache.num_cached(), 0);
+    CHECK(get(cache, "/a") == "/a:4");
+}
+
+TEST(response_cache_uncacheable)
+{
+    TestHandler handler;
+    http::ResponseCache cache {std::ref(handler)};
+
+    const char* targets[] = {
+        "/?status=500", "/?set-cookie", "/?no-store", "/?max-age-0", "/?vary-cookie",
+    };
+    for (const char* target: targets) {
+        get(cache, target);
+        get(cache, target);
+    }
+    CHECK_EQUAL(handler.num_calls.load(), 10);
+
+    // Requests that bypass the cache.
+    get(cache, "/", "Authorization: Basic YTpi\r\n");
+    get(cache, "/", "Authorization: Basic YTpi\r\n");
+    get(cache, "/", "Range: bytes=0-1\r\n");
+    get(cache, "/", "Range: bytes=0-1\r\n");
+    handle(cache, "POST / HTTP/1.1\r\nContent-Length: 1\r\n\r\nx");
+    handle(cache, "POST / HTTP/1.1\r\nContent-Length: 1\r\n\r\nx");
+    CHECK_EQUAL(handler.num_calls.load(), 16);
+    CHECK_EQUAL(cache.num_cached(), 0);
+}
+
+TEST(response_cache_ttl)
+{
+    TestHandler handler;
+    http::ResponseCacheConfig config;
+    config.ttl_ms = 50;
+    http::ResponseCache cache {std::ref(handler), config};
+
+    CHECK(get(cache, "/") == "/:1");
+    CHECK(get(cache, "/") == "/:1");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(get(cache, "/") == "/:2");
+    CHECK(get(cache, "/") == "/:2");
+}
+
+TEST(response_cache_vary)
+{
+    TestHandler handler;
+    http::ResponseCacheConfig config;
+    config.vary = {"Accept-Encoding"};
+    http::ResponseCache cache {std::ref(handler), config};
+
+    CHECK(get(cache, "/?vary-encoding", "Accept-Encoding: gzip\r\n") == "/?vary-encoding:1");
+    CHECK(get(cache, "/?vary-encoding") == "/?vary-encoding:2");
+    CHECK(get(cache, "/?vary-encoding", "Accept-Encoding: gzip\r\n") == "/?vary-encoding:1");
+    CHECK(get(cache, "/?vary-encoding") == "/?vary-encoding:2");
+    CHECK(get(cache, "/?vary-cookie") == "/?vary-cookie:3");
+    CHECK(get(cache, "/?vary-cookie") == "/?vary-cookie:4");
+}
+
+TEST(response_cache_lru)
+{
+    TestHandler handler;
+    http::ResponseCacheConfig config;
+    config.num_shards = 1;
+    config.max_size = 1000;
+    http::ResponseCache cache {std::ref(handler), config};
+
+    // Each entry takes roughly 100 bytes.
+    for (int i = 0; i < 20; ++i)
+        get(cache, "/" + std::to_string(i));
+    CHECK(cache.num_cached() < 20);
+    CHECK(cache.num_cached() > 5);
+    // The most recent ones are kept.
+    int num_calls = handler.num_calls.load();
+    get(cache, "/19");
+    CHECK_EQUAL(handler.num_calls.load(), num_calls);
+    get(cache, "/0");
+    CHECK_EQUAL(handler.num_calls.load(), num_calls + 1);
+}
+
+TEST(response_cache_coalescing)
+{
+    TestHandler handler;
+    handler.delay_ms = 100;
+    http::ResponseCache cache {std::ref(handler)};
+
+    std::string first;
+    std::thread thread {[&] { first = get(cache, "/slow"); }};
+    while (handler.num_calls == 0)
+        std::this_thread::yield();
+    // The handler is running for the first request.
+    std::string second = get(cache, "/slow");
+    thread.join();
+
+    CHECK(first == "/slow:1");
+    CHECK(second == "/slow:1");
+    CHECK_EQUAL(handler.num_calls.load(), 1);
+    CHECK_EQUAL(cache.num_coalesced(), 1);
+    CHECK_EQUAL(cache.num_hits(), 1);
+    CHECK_EQUAL(cache.num_misses(), 1);
+}
+
+TEST(response_cache_coalescing_timeout)
+{
+    TestHandler handler;
+    handler.delay_ms = 300;
+    http::ResponseCacheConfig config;
+    config.max_wait_ms = 50;
+    http::ResponseCache cache {std::ref(handler), config};
+
+    std::string first;
+    std::thread thread {[&] { first = get(cache, "/slow"); }};
+    while (handler.num_calls == 0)
+        std::this_thread::yield();
+    // The second request gives up waiting and calls the handler itself.
+    std::string second = get(cache, "/slow");
+    thread.join();
+
+    CHECK(first == "/slow:1");
+    CHECK(second == "/slow:2");
+    CHECK_EQUAL(handler.num_calls.load(), 2);
+    CHECK_EQUAL(cache.num_coalesced(), 1);
+    CHECK_EQUAL(cache.num_misses(), 2);
+    // The first response is stored.
+    CHECK(get(cache, "/slow") == "/slow:1");
+}
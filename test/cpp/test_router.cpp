@@ -0,0 +1,195 @@
+#include <string>
+#include <vector>
+
+#include <biohash/router.hpp>
+
+#include "util/http.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Message = http::Message;
+using Method = http::Method;
+
+namespace {
+
+// Routes whose handlers report the route's name in the response body.
+struct TestRouter {
+
+    http::Router router;
+
+    bool add(Method method, const std::string& pattern)
+    {
+        return router.add(method, pattern, [pattern](const Message&, const http::RouteParams&,
+                                                     std::string_view, http::Response& response) {
+            response.body = pattern;
+        });
+    }
+
+    // Returns the pattern of the matching route or "" if there is none.
+    std::string match(Method method, std::string_view path, http::RouteParams& params)
+    {
+        uint_least32_t allowed_methods;
+        const http::Router::Handler* handler = router.match(method, path, params, allowed_methods);
+        if (!handler)
+            return "";
+        Message request {Message::Kind::Request};
+        http::Response response;
+        (*handler)(request, params, {}, response);
+        return response.body;
+    }
+
+    std::string match(std::string_view path)
+    {
+        http::RouteParams params;
+        return match(Method::GET, path, params);
+    }
+};
+
+} // anonymous namespace
+
+TEST(router_static)
+{
+    TestRouter test;
+    const char* patterns[] = {
+        "/", "/about", "/api", "/api/users", "/api/user", "/api/users/all", "/apple", "/b",
+    };
+    for (const char* pattern: patterns)
+        CHECK(test.add(Method::GET, pattern));
+
+    for (const char* pattern: patterns)
+        CHECK(test.match(pattern) == pattern);
+    CHECK(test.match("") == "");
+    CHECK(test.match("/ap") == "");
+    CHECK(test.match("/api/") == "");
+    CHECK(test.match("/api/users/") == "");
+    CHECK(test.match("/abc") == "");
+
+    // A route can be added once per method.
+    CHECK(!test.add(Method::GET, "/api"));
+    CHECK(test.add(Method::POST, "/api"));
+    http::RouteParams params;
+    CHECK(test.match(Method::POST, "/api", params) == "/api");
+    CHECK(test.match(Method::PUT, "/api", params) == "");
+}
+
+TEST(router_params)
+{
+    TestRouter test;
+    CHECK(test.add(Method::GET, "/users/:id"));
+    CHECK(test.add(Method::GET, "/users/:id/files/*path"));
+    CHECK(test.add(Method::GET, "/users/new"));
+    CHECK(test.add(Method::GET, "/users/:id/posts/:post"));
+    CHECK(test.add(Method::GET, "/static/*file"));
+
+    http::RouteParams params;
+    std::string path = "/users/42";
+    CHECK(test.match(Method::GET, path, params) == "/users/:id");
+    CHECK_EQUAL(params.size, 1);
+    CHECK(params.get("id") == "42");
+    // The values refer to the path.
+    CHECK(params.get("id").data() == path.data() + 7);
+    CHECK(!params.get("post").data());
+
+    CHECK(test.match(Method::GET, "/users/new", params) == "/users/new");
+    CHECK_EQUAL(params.size, 0);
+    CHECK(test.match(Method::GET, "/users/newer", params) == "/users/:id");
+    CHECK(params.get("id") == "newer");
+
+    CHECK(test.match(Method::GET, "/users/7/posts/hello", params) == "/users/:id/posts/:post");
+    CHECK(params.get("id") == "7");
+    CHECK(params.get("post") == "hello");
+
+    CHECK(test.match(Method::GET, "/users/7/files/a/b.txt", params) == "/users/:id/files/*path");
+    CHECK(params.get("path") == "a/b.txt");
+    CHECK(test.match(Method::GET, "/users/7/files/", params) == "/users/:id/files/*path");
+    CHECK(params.get("path") == "");
+
+    // A static prefix that leads nowhere falls back to the parameter.
+    CHECK(test.match(Method::GET, "/users/new/posts/1", params) == "/users/:id/posts/:post");
+    CHECK(params.get("id") == "new");
+    CHECK_EQUAL(params.size, 2);
+
+    CHECK(test.match(Method::GET, "/static/css/site.css", params) == "/static/*file");
+    CHECK(params.get("file") == "css/site.css");
+
+    CHECK(test.match("/users/") == "");
+    CHECK(test.match("/users//posts/1") == "");
+    CHECK(test.match("/users/7/posts") == "");
+}
+
+TEST(router_backtracking)
+{
+    // Every combination of static text and parameters over four segments,
+    // where only the routes with a parameter in the last segment end in "/x".
+    TestRouter router;
+    const char* names[] = {":a", ":b", ":c", ":d"};
+    for (int mask = 0; mask < 16; ++mask) {
+        std::string pattern;
+        for (int i = 0; i < 4; ++i)
+            pattern += mask & (1 << i) ? std::string {"/"} + names[i] : "/s";
+        CHECK(router.add(Method::GET, pattern + (mask & 8 ? "/x" : "/y")));
+    }
+
+    // Each static branch fails at the end, and the parameters are dropped
+    // when their branch fails.
+    http::RouteParams params;
+    CHECK(router.match(Method::GET, "/s/s/s/s/x", params) == "/s/s/s/:d/x");
+    CHECK_EQUAL(params.size, 1);
+    CHECK(params.get("d") == "s");
+    CHECK(router.match(Method::GET, "/s/v/s/s/y", params) == "/s/:b/s/s/y");
+    CHECK_EQUAL(params.size, 1);
+    CHECK(router.match(Method::GET, "/u/v/w/z/x", params) == "/:a/:b/:c/:d/x");
+    CHECK_EQUAL(params.size, 4);
+    CHECK(router.match(Method::GET, "/s/s/s/s/z", params) == "");
+    CHECK(router.match(Method::GET, "/s/s/s/s/x/y", params) == "");
+}
+
+TEST(router_invalid_patterns)
+{
+    TestRouter test;
+    CHECK(!test.add(Method::GET, ""));
+    CHECK(!test.add(Method::GET, "users"));
+    CHECK(!test.add(Method::GET, "/users/:"));
+    CHECK(!test.add(Method::GET, "/users/:/x"));
+    CHECK(!test.add(Method::GET, "/users/x:id"));
+    CHECK(!test.add(Method::GET, "/files/*"));
+    CHECK(!test.add(Method::GET, "/files/*path/more"));
+    CHECK(!test.add(Method::GET, "/:a/:b/:c/:d/:e/:f/:g/:h/:i"));
+    CHECK(test.add(Method::GET, "/:a/:b/:c/:d/:e/:f/:g/:h"));
+
+    // A parameter has one name at each position.
+    CHECK(test.add(Method::GET, "/users/:id"));
+    CHECK(!test.add(Method::POST, "/users/:name"));
+    CHECK(test.add(Method::POST, "/users/:id"));
+}
+
+TEST(router_handle)
+{
+    TestRouter test;
+    CHECK(test.add(Method::GET, "/items/:id"));
+    CHECK(test.add(Method::PUT, "/items/:id"));
+    CHECK(test.add(Method::DELETE, "/files/*path"));
+
+    auto handle = [&](const std::string& request_str, http::Response& response) {
+        Message request {Message::Kind::Request, request_str.data(), request_str.size()};
+        response.reset();
+        test.router.handle(request, {}, response);
+    };
+
+    http::Response response;
+    handle("GET /items/3?full=1 HTTP/1.1\r\n\r\n", response);
+    CHECK(response.body == "/items/:id");
+
+    handle("GET /nothing HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 404);
+
+    handle("POST /items/3 HTTP/1.1\r\nContent-Length: 0\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 405);
+    std::string header(static_cast<const char*>(response.builder.segments()[0].iov_base),
+                       response.builder.segments()[0].iov_len);
+    CHECK(header.find("\r\nAllow: GET, PUT\r\n") != std::string::npos);
+
+    handle("GET /files/a HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 405);
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <bearssl_hash.h>
+
+#include "util/test.hpp"
+#include <biohash/sha.hpp>
+
+using namespace biohash;
+using namespace biohash::test;
+
+namespace {
+
+const sha::Isa isas[] = {
+    sha::Isa::scalar,
+    sha::Isa::shani
+};
+
+struct Vector {
+    std::string data;
+    const char* sha1;
+    const char* sha256;
+};
+
+// The test vectors of FIPS 180-2.
+const Vector vectors[] = {
+    {"", "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", "a9993e364706816aba3e25717850c26c9cd0d89d",
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {std::string(1000000, 'a'), "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+};
+
+std::string hex(const char* data, size_t size)
+{
+    std::string out;
+    for (size_t i = 0; i < size; ++i) {
+        out += "0123456789abcdef"[static_cast<unsigned char>(data[i]) >> 4];
+        out += "0123456789abcdef"[static_cast<unsigned char>(data[i]) & 0xf];
+    }
+    return out;
+}
+
+template <class Hasher>
+std::string digest(Hasher& hasher)
+{
+    char out[Hasher::digest_size];
+    hasher.finish(out);
+    return hex(out, sizeof out);
+}
+
+} // anonymous namespace
+
+TEST(sha_vectors)
+{
+    CHECK(sha::isa_supported(sha::Isa::scalar));
+    CHECK(sha::isa_supported(sha::default_isa()));
+
+    for (sha::Isa isa: isas) {
+        if (!sha::isa_supported(isa))
+            continue;
+        sha::Sha1 sha1 {isa};
+        sha::Sha256 sha256 {isa};
+        for (const Vector& vector: vectors) {
+            sha1.update(vector.data.data(), vector.data.size());
+            CHECK(digest(sha1) == vector.sha1);
+            sha256.update(vector.data.data(), vector.data.size());
+            CHECK(digest(sha256) == vector.sha256);
+        }
+    }
+}
+
+TEST(sha_random)
+{
+    std::vector<char> data(2000);
+    for (int i = 0; i < 200; ++i) {
+        size_t size = arc4random_uniform(static_cast<uint32_t>(data.size() + 1));
+        arc4random_buf(data.data(), size);
+
+        char expected_sha1[br_sha1_SIZE];
+        br_sha1_context sha1_ctx;
+        br_sha1_init(&sha1_ctx);
+        br_sha1_update(&sha1_ctx, data.data(), size);
+        br_sha1_out(&sha1_ctx, expected_sha1);
+        char expected_sha256[br_sha256_SIZE];
+        br_sha256_context sha256_ctx;
+        br_sha256_init(&sha256_ctx);
+        br_sha256_update(&sha256_ctx, data.data(), size);
+        br_sha256_out(&sha256_ctx, expected_sha256);
+
+        // The data is split into random pieces.
+        for (sha::Isa isa: isas) {
+            if (!sha::isa_supported(isa))
+                continue;
+            sha::Sha1 sha1 {isa};
+            sha::Sha256 sha256 {isa};
+            size_t offset = 0;
+            while (offset < size) {
+                size_t n = 1 + arc4random_uniform(static_cast<uint32_t>(size - offset));
+                if (arc4random_uniform(2))
+                    n = std::min<size_t>(n, 70);
+                sha1.update(data.data() + offset, n);
+                sha256.update(data.data() + offset, n);
+                offset += n;
+            }
+            CHECK(digest(sha1) == hex(expected_sha1, sizeof expected_sha1));
+            CHECK(digest(sha256) == hex(expected_sha256, sizeof expected_sha256));
+        }
+    }
+}
+
+TEST(sha_update_many)
+{
+    // More hashers than lanes, with pieces of different sizes in several
+    // rounds, so that lanes go idle at different times.
+    constexpr size_t count = 11;
+    for (sha::Isa isa: isas) {
+        if (!sha::isa_supported(isa))
+            continue;
+        std::vector<sha::Sha256> many(count, sha::Sha256 {isa});
+        std::vector<sha::Sha256> single(count, sha::Sha256 {sha::Isa::scalar});
+        std::vector<sha::Sha256*> hashers;
+        for (sha::Sha256& hasher: many)
+            hashers.push_back(&hasher);
+
+        for (int round = 0; round < 4; ++round) {
+            std::vector<std::string> pieces(count);
+            const char* data[count];
+            size_t sizes[count];
+            for (size_t i = 0; i < count; ++i) {
+                pieces[i].resize(arc4random_uniform(i % 3 == 0 ? 100 : 3000));
+                arc4random_buf(pieces[i].data(), pieces[i].size());
+                data[i] = pieces[i].data();
+                sizes[i] = pieces[i].size();
+                single[i].update(data[i], sizes[i]);
+            }
+            sha::Sha256::update_many(hashers.data(), data, sizes, count);
+        }
+        for (size_t i = 0; i < count; ++i)
+            CHECK(digest(many[i]) == digest(single[i]));
+    }
+}
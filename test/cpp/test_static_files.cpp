@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <thread>
+
+#include <biohash/assert.hpp>
+#include <biohash/http_client.hpp>
+#include <biohash/static_files.hpp>
+#include <biohash/time.hpp>
+
+#include "util/http.hpp"
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+using Message = http::Message;
+
+namespace {
+
+// A temporary directory with files that is removed with the object.
+struct TestDir {
+
+    std::string path;
+
+    TestDir()
+    {
+        char templ[] = "/tmp/biohash_test_XXXXXX";
+        const char* dir = mkdtemp(templ);
+        ASSERT(dir);
+        path = dir;
+    }
+
+    ~TestDir()
+    {
+        std::string command = "rm -rf " + path;
+        int rc = system(command.c_str());
+        static_cast<void>(rc);
+    }
+
+    void write(const std::string& name, const std::string& content)
+    {
+        int fd = ::open((path + "/" + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT(fd >= 0);
+        ssize_t rc = ::write(fd, content.data(), content.size());
+        ASSERT(rc == ssize_t(content.size()));
+        close(fd);
+    }
+
+    void mkdir(const std::string& name)
+    {
+        int rc = ::mkdir((path + "/" + name).c_str(), 0755);
+        ASSERT(rc == 0);
+    }
+};
+
+void serve(http::StaticFiles& files, const std::string& request, http::Response& response)
+{
+    Message msg {Message::Kind::Request, request.data(), request.size()};
+    ASSERT(msg.complete);
+    response.reset();
+    files.serve(msg, response);
+}
+
+} // anonymous namespace
+
+TEST(static_files_serve)
+{
+    TestDir dir;
+    dir.write("index.html", "<html></html>");
+    dir.write("style.css", "body {}");
+    dir.mkdir("sub");
+    dir.write("sub/data.bin", std::string(5000, 'x'));
+
+    http::StaticFiles files;
+    CHECK(files.open(dir.path.c_str()));
+    http::Response response;
+
+    serve(files, "GET /style.css HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+    CHECK(field_of(response, http::Header::ContentType) == "text/css; charset=utf-8");
+    CHECK(field_of(response, http::Header::ContentLength) == "7");
+    CHECK(response.file_fd >= 0);
+    CHECK_EQUAL(response.file_size, 7);
+    char buf[16];
+    CHECK_EQUAL(pread(response.file_fd, buf, sizeof buf, 0), 7);
+    CHECK_MEMCMP(buf, "body {}", 7);
+
+    serve(files, "GET /?query HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+    CHECK(field_of(response, http::Header::ContentType) == "text/html; charset=utf-8");
+
+    serve(files, "HEAD /sub/data.bin HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+    CHECK(field_of(response, http::Header::ContentType) == "application/octet-stream");
+    CHECK(field_of(response, http::Header::ContentLength) == "5000");
+    CHECK_EQUAL(response.file_size, 0);
+    CHECK_EQUAL(files.num_cached(), 3);
+
+    serve(files, "GET /missing HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 404);
+    serve(files, "GET /sub HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 404);
+    serve(files, "GET /sub/../style.css HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 404);
+    serve(files, "POST /style.css HTTP/1.1\r\nContent-Length: 0\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 405);
+    CHECK(serialize(response).find("\r\nAllow: GET, HEAD\r\n") != std::string::npos);
+}
+
+TEST(static_files_conditional)
+{
+    TestDir dir;
+    dir.write("a.txt", "content");
+
+    http::StaticFiles files;
+    CHECK(files.open(dir.path.c_str()));
+    http::Response response;
+
+    serve(files, "GET /a.txt HTTP/1.1\r\n\r\n", response);
+    std::string etag = field_of(response, http::Header::ETag);
+    std::string last_modified = field_of(response, http::Header::LastModified);
+    CHECK(etag.size() > 2 && etag.front() == '"' && etag.back() == '"');
+    CHECK_EQUAL(last_modified.size(), time::http_date_size);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nIf-None-Match: \"x\", W/" + etag + "\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 304);
+    CHECK_EQUAL(response.file_size, 0);
+    CHECK(field_of(response, http::Header::ETag) == etag);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nIf-None-Match: *\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 304);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nIf-None-Match: \"x\"\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nIf-Modified-Since: " + last_modified + "\r\n\r\n",
+          response);
+    CHECK_EQUAL(status_of(response), 304);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nIf-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n",
+          response);
+    CHECK_EQUAL(status_of(response), 200);
+
+    // If-None-Match takes precedence.
+    serve(files, "GET /a.txt HTTP/1.1\r\nIf-None-Match: \"x\"\r\nIf-Modified-Since: " +
+          last_modified + "\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+}
+
+TEST(static_files_cache)
+{
+    TestDir dir;
+    dir.write("a.txt", "a");
+    dir.write("b.txt", "b");
+    dir.write("c.txt", "c");
+
+    http::StaticFilesConfig config;
+    config.max_open_files = 2;
+    config.revalidate_ms = 0;
+    http::StaticFiles files {config};
+    CHECK(files.open(dir.path.c_str()));
+    http::Response response;
+
+    serve(files, "GET /a.txt HTTP/1.1\r\n\r\n", response);
+    // The response keeps the evicted file open.
+    int fd = response.file_fd;
+    http::Response other;
+    serve(files, "GET /b.txt HTTP/1.1\r\n\r\n", other);
+    serve(files, "GET /c.txt HTTP/1.1\r\n\r\n", other);
+    CHECK_EQUAL(files.num_cached(), 2);
+    char c;
+    CHECK_EQUAL(pread(fd, &c, 1, 0), 1);
+    CHECK_EQUAL(c, 'a');
+
+    // A changed file is reopened.
+    std::string etag = field_of(other, http::Header::ETag);
+    dir.write("c.txt", "changed");
+    serve(files, "GET /c.txt HTTP/1.1\r\n\r\n", other);
+    CHECK_EQUAL(other.file_size, 7);
+    CHECK(field_of(other, http::Header::ETag) != etag);
+
+    unlink((dir.path + "/c.txt").c_str());
+    serve(files, "GET /c.txt HTTP/1.1\r\n\r\n", other);
+    CHECK_EQUAL(status_of(other), 404);
+    CHECK_EQUAL(files.num_cached(), 1);
+}
+
+TEST(static_files_sendfile)
+{
+    TestDir dir;
+    std::string content;
+    for (int i = 0; content.size() < 1000000; ++i)
+        content += std::to_string(i) + '\n';
+    dir.write("big.txt", content);
+    dir.write("small.txt", "small");
+
+    http::StaticFiles files;
+    CHECK(files.open(dir.path.c_str()));
+    EventLoop server_loop;
+    http::Server server {server_loop, [&](const Message& request, std::string_view,
+                                          http::Response& response) {
+        files.serve(request, response);
+    }};
+    CHECK(server.listen("127.0.0.1", 0));
+    std::thread thread {[&] { server_loop.run(); }};
+
+    // Pipelined responses with file bodies are written in order.
+    EventLoop loop;
+    http::ClientConfig config;
+    config.max_connections_per_host = 1;
+    http::Client client {loop, config};
+    std::string bodies[3];
+    int num_done = 0;
+    const char* targets[3] = {"/big.txt", "/small.txt", "/big.txt"};
+    for (int i = 0; i < 3; ++i) {
+        http::ClientRequest request;
+        request.request_target = targets[i];
+        client.request("127.0.0.1", server.port(), request,
+                       [&, i](http::Client::Error error, const Message&, std::string_view body) {
+            ASSERT(error == http::Client::Error::None);
+            bodies[i] = std::string {body};
+            ++num_done;
+        });
+    }
+    for (int i = 0; i < 100 && num_done < 3; ++i)
+        loop.run_once(100);
+
+    server_loop.stop();
+    thread.join();
+    CHECK_EQUAL(num_done, 3);
+    CHECK(bodies[0] == content);
+    CHECK(bodies[1] == "small");
+    CHECK(bodies[2] == content);
+}
+
+TEST(static_files_ranges)
+{
+    TestDir dir;
+    std::string content;
+    for (int i = 0; i < 1000; ++i)
+        content += static_cast<char>('a' + i % 26);
+    dir.write("a.txt", content);
+
+    http::StaticFiles files;
+    CHECK(files.open(dir.path.c_str()));
+    http::Response response;
+
+    serve(files, "GET /a.txt HTTP/1.1\r\n\r\n", response);
+    CHECK(field_of(response, http::Header::AcceptRanges) == "bytes");
+    std::string etag = field_of(response, http::Header::ETag);
+    std::string last_modified = field_of(response, http::Header::LastModified);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=10-19\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 206);
+    CHECK(field_of(response, http::Header::ContentRange) == "bytes 10-19/1000");
+    CHECK(field_of(response, http::Header::ContentLength) == "10");
+    CHECK_EQUAL(response.file_offset, 10);
+    CHECK_EQUAL(response.file_size, 10);
+
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=1000-\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 416);
+    CHECK(field_of(response, http::Header::ContentRange) == "bytes */1000");
+
+    // Ranges only apply to GET, and to the representation named by If-Range.
+    serve(files, "HEAD /a.txt HTTP/1.1\r\nRange: bytes=10-19\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=10-19\r\nIf-Range: \"x\"\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+    CHECK_EQUAL(response.file_size, 1000);
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=10-19\r\nIf-Range: W/" + etag + "\r\n\r\n",
+          response);
+    CHECK_EQUAL(status_of(response), 200);
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=10-19\r\nIf-Range: " + etag + "\r\n\r\n",
+          response);
+    CHECK_EQUAL(status_of(response), 206);
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=10-19\r\nIf-Range: " + last_modified +
+          "\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 206);
+
+    // The header and the parts of a multipart body are the segments of the
+    // builder.
+    serve(files, "GET /a.txt HTTP/1.1\r\nRange: bytes=0-2, -3\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 206);
+    CHECK_EQUAL(response.file_size, 0);
+    std::string data = serialize(response);
+    Message msg {Message::Kind::Response, data.data(), data.size()};
+    CHECK(msg.complete);
+    std::string_view content_type = msg.header(http::Header::ContentType);
+    std::string prefix = "multipart/byteranges; boundary=";
+    CHECK(content_type.substr(0, prefix.size()) == prefix);
+    std::string boundary {content_type.substr(prefix.size())};
+    std::string expected =
+        "--" + boundary + "\r\n"
+        "Content-Type: text/plain; charset=utf-8\r\n"
+        "Content-Range: bytes 0-2/1000\r\n"
+        "\r\n"
+        "abc\r\n"
+        "--" + boundary + "\r\n"
+        "Content-Type: text/plain; charset=utf-8\r\n"
+        "Content-Range: bytes 997-999/1000\r\n"
+        "\r\n" + content.substr(997) + "\r\n"
+        "--" + boundary + "--\r\n";
+    CHECK_EQUAL(msg.content_length, expected.size());
+    CHECK(std::string_view(msg.body, msg.content_length) == expected);
+}
+
+TEST(static_files_percent_decoding)
+{
+    TestDir dir;
+    dir.write("a b.txt", "space");
+
+    http::StaticFiles files;
+    CHECK(files.open(dir.path.c_str()));
+    http::Response response;
+
+    serve(files, "GET /a%20b.txt HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 200);
+    CHECK_EQUAL(response.file_size, 5);
+
+    // Segments are checked after decoding.
+    serve(files, "GET /%2e%2e/etc/passwd HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 404);
+    serve(files, "GET /a%00 HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 404);
+    serve(files, "GET /a%2 HTTP/1.1\r\n\r\n", response);
+    CHECK_EQUAL(status_of(response), 400);
+}
@@ -0,0 +1,25 @@
+#include <atomic>
+#include <vector>
+
+#include <biohash/thread_pool.hpp>
+
+#include "util/test.hpp"
+
+using namespace biohash;
+using namespace biohash::test;
+
+TEST(thread_pool)
+{
+    for (size_t num_threads = 0; num_threads < 4; ++num_threads) {
+        ThreadPool pool {num_threads};
+        CHECK_EQUAL(pool.size(), num_threads);
+        for (size_t count = 0; count < 50; count += 7) {
+            std::vector<std::atomic<int>> calls(count);
+            pool.parallel_for(count, [&](size_t i) {
+                ++calls[i];
+            });
+            for (size_t i = 0; i < count; ++i)
+                CHECK_EQUAL(calls[i].load(), 1);
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include "util/test.hpp"
+
+#include <biohash/time.hpp>
+
+using namespace biohash;
+using namespace biohash::test;
+
+TEST(time_format_http_date)
+{
+    char buf[time::http_date_size];
+
+    time::format_http_date(784111777, buf);
+    CHECK_MEMCMP(buf, "Sun, 06 Nov 1994 08:49:37 GMT", 29);
+
+    time::format_http_date(0, buf);
+    CHECK_MEMCMP(buf, "Thu, 01 Jan 1970 00:00:00 GMT", 29);
+
+    time::format_http_date(951782400, buf);
+    CHECK_MEMCMP(buf, "Tue, 29 Feb 2000 00:00:00 GMT", 29);
+
+    time::format_http_date(-1, buf);
+    CHECK_MEMCMP(buf, "Wed, 31 Dec 1969 23:59:59 GMT", 29);
+
+    // Agrees with gmtime_r() and strftime().
+    for (int_fast64_t seconds = -5000000000; seconds < 5000000000; seconds += 86400 * 37 + 3607) {
+        time_t t = static_cast<time_t>(seconds);
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char expected[64];
+        strftime(expected, sizeof expected, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        time::format_http_date(seconds, buf);
+        CHECK_MEMCMP(buf, expected, 29);
+
+        int_fast64_t parsed;
+        CHECK(time::parse_http_date(buf, 29, parsed));
+        CHECK_EQUAL(parsed, seconds);
+    }
+}
+
+TEST(time_parse_http_date)
+{
+    int_fast64_t seconds = 0;
+    CHECK(time::parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT", 29, seconds));
+    CHECK_EQUAL(seconds, 784111777);
+
+    seconds = 0;
+    const char rfc850[] = "Sunday, 06-Nov-94 08:49:37 GMT";
+    CHECK(time::parse_http_date(rfc850, strlen(rfc850), seconds));
+    CHECK_EQUAL(seconds, 784111777);
+
+    seconds = 0;
+    CHECK(time::parse_http_date("Sun Nov  6 08:49:37 1994", 24, seconds));
+    CHECK_EQUAL(seconds, 784111777);
+
+    CHECK(time::parse_http_date("Thu Feb 29 12:00:00 2024", 24, seconds));
+    CHECK_EQUAL(seconds, 1709208000);
+
+    const char* invalids[] = {
+        "",
+        "Sun, 06 Nov 1994 08:49:37 UTC",
+        "Sun, 06 Nov 1994 08:49:37 GMT ",
+        "Sun, 6 Nov 1994 08:49:37 GMT",
+        "Sun, 06 nov 1994 08:49:37 GMT",
+        "Xyz, 06 Nov 1994 08:49:37 GMT",
+        "Sun, 31 Nov 1994 08:49:37 GMT",
+        "Sun, 06 Nov 1994 24:49:37 GMT",
+        "Sun, 06 Nov 1994 08:60:37 GMT",
+        "Sun, 06 Nov 1994 08-49-37 GMT",
+        "Sonday, 06-Nov-94 08:49:37 GMT",
+        "Sunday, 06-Nov-1994 08:49:37 GMT",
+        "Sun Nov 6 08:49:37 1994",
+        "Sun Feb 30 08:49:37 1994",
+    };
+    for (const char* invalid: invalids)
+        CHECK(!time::parse_http_date(invalid, strlen(invalid), seconds));
+}
+
+TEST(time_cached_http_date)
+{
+    const char* date = time::cached_http_date();
+    int_fast64_t seconds;
+    CHECK(time::parse_http_date(date, time::http_date_size, seconds));
+    int_fast64_t now = time::realtime_now() / 1000000000;
+    CHECK(seconds <= now && seconds + 2 >= now);
+    CHECK(time::cached_http_date() == date);
+}
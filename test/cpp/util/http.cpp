@@ -0,0 +1,81 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <biohash/assert.hpp>
+
+#include "http.hpp"
+
+using namespace biohash;
+using Message = http::Message;
+
+std::string test::serialize(const http::Response& response)
+{
+    std::string str;
+    const iovec* segments = response.builder.segments();
+    for (int i = 0; i < response.builder.num_segments(); ++i)
+        str.append(static_cast<const char*>(segments[i].iov_base), segments[i].iov_len);
+    return str;
+}
+
+int test::status_of(const std::string& response)
+{
+    Message msg {Message::Kind::Response, response.data(), response.size()};
+    return msg.valid && msg.header_complete ? msg.status_code : 0;
+}
+
+int test::status_of(const http::Response& response)
+{
+    return status_of(serialize(response));
+}
+
+std::string test::field_of(const std::string& response, http::Header name)
+{
+    Message msg {Message::Kind::Response, response.data(), response.size()};
+    return std::string {msg.header(name)};
+}
+
+std::string test::field_of(const http::Response& response, http::Header name)
+{
+    return field_of(serialize(response), name);
+}
+
+std::string test::body_of(const std::string& response)
+{
+    Message msg {Message::Kind::Response, response.data(), response.size()};
+    return std::string {msg.body, static_cast<size_t>(msg.content_length)};
+}
+
+test::TestServer::TestServer(http::Server::Handler handler, const http::ServerConfig& config,
+                             http::Server::BodyHandler body_handler):
+    server {loop, std::move(handler), config}
+{
+    server.set_body_handler(std::move(body_handler));
+    bool rc = server.listen("127.0.0.1", 0);
+    ASSERT(rc);
+    thread = std::thread {[this] { loop.run(); }};
+}
+
+test::TestServer::~TestServer()
+{
+    loop.stop();
+    thread.join();
+}
+
+int test::connect_to(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int rc = connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr);
+    ASSERT(rc == 0);
+    return fd;
+}
+
+void test::echo(const Message& request, std::string_view body, http::Response& response)
+{
+    std::string content = std::string {request.request_target} + ":" + std::string {body};
+    response.send(200, "text/plain", content);
+}
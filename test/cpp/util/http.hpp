@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <biohash/event_loop.hpp>
+#include <biohash/http.hpp>
+#include <biohash/http_server.hpp>
+
+namespace biohash {
+namespace test {
+
+// Helpers for the tests of handlers, which are called directly and whose
+// responses are inspected without a server.
+
+// The segments of the response, which are the header and the body unless the
+// body is sent from a file or a socket.
+std::string serialize(const http::Response& response);
+
+// The status code of a serialized response, or 0 if its header is incomplete
+// or invalid.
+int status_of(const std::string& response);
+int status_of(const http::Response& response);
+
+// The value of a header field of a response, which is empty if the field is
+// absent.
+std::string field_of(const std::string& response, http::Header name);
+std::string field_of(const http::Response& response, http::Header name);
+
+// The body of a serialized response with a Content-Length.
+std::string body_of(const std::string& response);
+
+// Parses 'request_str', passes it to the handle() function of 'handler', such
+// as a ResponseCache, and returns the serialized response.
+template <typename T>
+std::string handle(T& handler, const std::string& request_str)
+{
+    http::Message request {http::Message::Kind::Request, request_str.data(),
+                           request_str.size()};
+    std::string_view body {request.body, static_cast<size_t>(request.content_length)};
+    http::Response response;
+    handler.handle(request, body, response);
+    return serialize(response);
+}
+
+// Helpers for the tests that talk to servers over sockets.
+
+// Runs a server on a loop thread for the lifetime of the object.
+struct TestServer {
+
+    EventLoop loop;
+    http::Server server;
+    std::thread thread;
+
+    TestServer(http::Server::Handler handler, const http::ServerConfig& config = {},
+               http::Server::BodyHandler body_handler = nullptr);
+    ~TestServer();
+};
+
+// Returns a socket connected to 'port' on the loopback address.
+int connect_to(uint16_t port);
+
+// A handler that answers with the request target and the body, separated by
+// a colon.
+void echo(const http::Message& request, std::string_view body, http::Response& response);
+
+}
+}
@@ -0,0 +1,19 @@
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+#include "system.hpp"
+
+using namespace biohash;
+
+bool test::io_uring_available()
+{
+    struct io_uring_params params {};
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, 4, &params));
+    if (fd < 0)
+        return false;
+    close(fd);
+    // The features an EventLoop requires.
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    return (params.features & required) == required;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace biohash {
+namespace test {
+
+// Whether the kernel lets the process set up an io_uring instance with the
+// features an EventLoop needs, in which case a loop asked for io_uring must
+// not fall back to epoll.
+bool io_uring_available();
+
+}
+}